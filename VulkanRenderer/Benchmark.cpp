@@ -0,0 +1,188 @@
+#include "Benchmark.h"
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+VBenchmark::VBenchmark(const Scene& scene)
+	: timestep(scene.benchmark_timestep)
+	, warmup_frame_count(scene.benchmark_warmup_frames)
+	, measured_frame_count(scene.benchmark_measured_frames)
+{
+	scene_camera.position = scene.camera_position;
+	scene_camera.rotation = scene.camera_rotation;
+
+	if (!scene.benchmark_camera_path.empty())
+	{
+		keyframes = loadCameraPath(scene.benchmark_camera_path);
+	}
+
+	cpu_frame_times.reserve(measured_frame_count);
+	light_index_counts.reserve(measured_frame_count);
+}
+
+std::vector<CameraKeyframe> VBenchmark::loadCameraPath(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open camera path " + path);
+	}
+
+	std::vector<CameraKeyframe> keyframes;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		std::istringstream stream(line);
+		CameraKeyframe keyframe;
+		stream >> keyframe.time
+			>> keyframe.position.x >> keyframe.position.y >> keyframe.position.z
+			>> keyframe.rotation.w >> keyframe.rotation.x >> keyframe.rotation.y >> keyframe.rotation.z;
+		if (stream.fail())
+		{
+			throw std::runtime_error("Malformed camera keyframe in " + path + ": " + line);
+		}
+		keyframe.rotation = glm::normalize(keyframe.rotation);
+		keyframes.push_back(keyframe);
+	}
+
+	std::stable_sort(keyframes.begin(), keyframes.end(), [](const CameraKeyframe& a, const CameraKeyframe& b)
+	{
+		return a.time < b.time;
+	});
+	return keyframes;
+}
+
+void VBenchmark::getCamera(int frame, Camera& camera) const
+{
+	if (keyframes.empty())
+	{
+		camera.position = scene_camera.position;
+		camera.rotation = scene_camera.rotation;
+		return;
+	}
+
+	// time derives from the frame number only, never from the wall clock
+	float time = frame * timestep;
+
+	auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time, [](float t, const CameraKeyframe& keyframe)
+	{
+		return t < keyframe.time;
+	});
+
+	if (next == keyframes.begin() || next == keyframes.end())
+	{
+		// hold the first or last pose outside of the path
+		const auto& keyframe = (next == keyframes.begin()) ? keyframes.front() : keyframes.back();
+		camera.position = keyframe.position;
+		camera.rotation = keyframe.rotation;
+		return;
+	}
+
+	const auto& a = *(next - 1);
+	const auto& b = *next;
+	float t = (time - a.time) / (b.time - a.time);
+	camera.position = glm::mix(a.position, b.position, t);
+	camera.rotation = glm::slerp(a.rotation, b.rotation, t);
+}
+
+void VBenchmark::addCpuFrameTime(double milliseconds)
+{
+	cpu_frame_times.push_back(milliseconds);
+}
+
+void VBenchmark::addLightIndexCount(uint32_t light_index_count)
+{
+	light_index_counts.push_back(static_cast<double>(light_index_count));
+}
+
+void VBenchmark::clearLightIndexCounts()
+{
+	light_index_counts.clear();
+}
+
+VBenchmark::SampleStats VBenchmark::computeStats(std::vector<double> samples)
+{
+	SampleStats stats;
+	stats.sample_count = samples.size();
+	if (samples.empty()) return stats;
+
+	for (auto sample : samples)
+	{
+		stats.mean += sample;
+	}
+	stats.mean /= static_cast<double>(samples.size());
+
+	// nearest rank percentiles, the smallest sample with at least p of the samples at or below it
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&samples](double p)
+	{
+		auto rank = static_cast<size_t>(std::ceil(p * samples.size()));
+		return samples[std::max(rank, size_t(1)) - 1];
+	};
+	stats.p50 = percentile(0.50);
+	stats.p95 = percentile(0.95);
+	stats.p99 = percentile(0.99);
+	stats.max = samples.back();
+
+	return stats;
+}
+
+namespace
+{
+	void writeStats(std::ostream& file, const char* name, const VBenchmark::SampleStats& stats, bool last = false)
+	{
+		file << "\t\"" << name << "\": { \"samples\": " << stats.sample_count
+			<< ", \"mean\": " << stats.mean
+			<< ", \"p50\": " << stats.p50
+			<< ", \"p95\": " << stats.p95
+			<< ", \"p99\": " << stats.p99
+			<< ", \"max\": " << stats.max
+			<< " }" << (last ? "\n" : ",\n");
+	}
+}
+
+void VBenchmark::writeReport(const std::string& path, const std::vector<std::pair<std::string, double>>& settings
+	, const VGpuProfiler& gpu_profiler, uint32_t tile_count) const
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open benchmark report file " + path);
+	}
+
+	file << "{\n\t\"settings\": {";
+	for (size_t i = 0; i < settings.size(); i++)
+	{
+		file << (i == 0 ? " " : ", ") << "\"" << settings[i].first << "\": " << settings[i].second;
+	}
+	file << " },\n";
+
+	writeStats(file, "cpu_frame_ms", computeStats(cpu_frame_times));
+	writeStats(file, "gpu_frame_ms", gpu_profiler.getFrameStats().time_ms);
+	for (int i = 0; i < VGpuProfiler::PASS_COUNT; i++)
+	{
+		auto pass = static_cast<VGpuProfiler::Pass>(i);
+		auto name = std::string("gpu_") + VGpuProfiler::getPassName(pass) + "_ms";
+		writeStats(file, name.c_str(), gpu_profiler.getStats(pass).time_ms);
+	}
+
+	std::vector<double> lights_per_tile;
+	lights_per_tile.reserve(light_index_counts.size());
+	for (auto count : light_index_counts)
+	{
+		lights_per_tile.push_back(count / tile_count);
+	}
+	writeStats(file, "light_indices_per_frame", computeStats(light_index_counts));
+	writeStats(file, "average_lights_per_tile", computeStats(lights_per_tile), true);
+
+	file << "}\n";
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "Scene.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class VGpuProfiler;
+
+struct CameraKeyframe
+{
+	float time;
+	glm::vec3 position;
+	glm::quat rotation;
+};
+
+/**
+* a deterministic benchmark run: the camera follows a keyframe file, the simulation advances by a fixed timestep,
+* and only the frames after the warm-up are measured and reported
+*/
+class VBenchmark
+{
+public:
+	// mean and nearest rank percentiles of one measured quantity
+	struct SampleStats
+	{
+		size_t sample_count = 0;
+		double mean = 0.0;
+		double p50 = 0.0;
+		double p95 = 0.0;
+		double p99 = 0.0;
+		double max = 0.0;
+	};
+
+	VBenchmark() = default;
+	explicit VBenchmark(const Scene& scene);
+
+	// keyframes are read one per line as "time px py pz qw qx qy qz", lines starting with # are comments
+	static std::vector<CameraKeyframe> loadCameraPath(const std::string& path);
+
+	int getTotalFrameCount() const
+	{
+		return warmup_frame_count + measured_frame_count;
+	}
+
+	int getWarmupFrameCount() const
+	{
+		return warmup_frame_count;
+	}
+
+	bool isMeasuring(int frame) const
+	{
+		return frame >= warmup_frame_count;
+	}
+
+	float getTimestep() const
+	{
+		return timestep;
+	}
+
+	// camera pose at a frame, interpolated along the keyframes, the scene's camera if there are none
+	void getCamera(int frame, Camera& camera) const;
+
+	void addCpuFrameTime(double milliseconds);
+	// light indices written by all tiles in a frame, read back after the frame's fence
+	void addLightIndexCount(uint32_t light_index_count);
+	// discard light counts of warm-up frames that were collected late
+	void clearLightIndexCounts();
+
+	static SampleStats computeStats(std::vector<double> samples);
+
+	// settings are written as is so runs with different light_num, TILE_SIZE or resolution can be told apart
+	void writeReport(const std::string& path, const std::vector<std::pair<std::string, double>>& settings
+		, const VGpuProfiler& gpu_profiler, uint32_t tile_count) const;
+
+private:
+	std::vector<CameraKeyframe> keyframes;
+	Camera scene_camera;
+	float timestep = 1.0f / 60.0f;
+	int warmup_frame_count = 0;
+	int measured_frame_count = 0;
+
+	std::vector<double> cpu_frame_times;
+	std::vector<double> light_index_counts;
+};
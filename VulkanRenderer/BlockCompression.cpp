@@ -0,0 +1,429 @@
+#include "BlockCompression.h"
+#include "Utilities.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_COMPRESSION_SSE2
+#endif
+
+namespace
+{
+	const uint32_t TEXELS_PER_BLOCK = 16;
+
+	// per channel minimum and maximum of the block's rgba texels
+	void getBounds(const uint8_t* texels, uint8_t* min, uint8_t* max)
+	{
+#ifdef BLOCK_COMPRESSION_SSE2
+		__m128i row_0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels));
+		__m128i row_1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels + 16));
+		__m128i row_2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels + 32));
+		__m128i row_3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels + 48));
+		__m128i low = _mm_min_epu8(_mm_min_epu8(row_0, row_1), _mm_min_epu8(row_2, row_3));
+		__m128i high = _mm_max_epu8(_mm_max_epu8(row_0, row_1), _mm_max_epu8(row_2, row_3));
+
+		// fold the four texels left in each register
+		low = _mm_min_epu8(low, _mm_srli_si128(low, 8));
+		low = _mm_min_epu8(low, _mm_srli_si128(low, 4));
+		high = _mm_max_epu8(high, _mm_srli_si128(high, 8));
+		high = _mm_max_epu8(high, _mm_srli_si128(high, 4));
+
+		int32_t packed_min = _mm_cvtsi128_si32(low);
+		int32_t packed_max = _mm_cvtsi128_si32(high);
+		memcpy(min, &packed_min, 4);
+		memcpy(max, &packed_max, 4);
+#else
+		memcpy(min, texels, 4);
+		memcpy(max, texels, 4);
+		for (uint32_t i = 1; i < TEXELS_PER_BLOCK; i++)
+		{
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				min[c] = std::min(min[c], texels[4 * i + c]);
+				max[c] = std::max(max[c], texels[4 * i + c]);
+			}
+		}
+#endif
+	}
+
+#ifdef BLOCK_COMPRESSION_SSE2
+	// the r, g, b and a of the four texels of a block row, one 32 bit lane per texel
+	inline void loadChannels(const uint8_t* row_texels, __m128i* channels)
+	{
+		__m128i row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row_texels));
+		__m128i byte_mask = _mm_set1_epi32(0xff);
+		channels[0] = _mm_and_si128(row, byte_mask);
+		channels[1] = _mm_and_si128(_mm_srli_epi32(row, 8), byte_mask);
+		channels[2] = _mm_and_si128(_mm_srli_epi32(row, 16), byte_mask);
+		channels[3] = _mm_srli_epi32(row, 24);
+	}
+
+	// the lane sums of four vectors at once, transposed into the lanes of one
+	inline __m128i horizontalSums(__m128i a, __m128i b, __m128i c, __m128i d)
+	{
+		__m128i ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+		__m128i cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+		return _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+	}
+#endif
+
+	// rgb covariance as xx, xy, xz, yy, yz, zz, scaled by 256 so it is the exact integer
+	// 16 * sum(x * y) - sum(x) * sum(y), which no order of summation can change
+	void getCovariance(const uint8_t* texels, float* covariance)
+	{
+		int32_t sums[3], products[6];
+#ifdef BLOCK_COMPRESSION_SSE2
+		// channels are below 2^15 with a zero high half, so madd multiplies the lanes exactly
+		__m128i sum_vectors[3] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+		__m128i product_vectors[6] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()
+			, _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+		for (uint32_t row = 0; row < 4; row++)
+		{
+			__m128i channels[4];
+			loadChannels(texels + 16 * row, channels);
+			for (uint32_t c = 0, k = 0; c < 3; c++)
+			{
+				sum_vectors[c] = _mm_add_epi32(sum_vectors[c], channels[c]);
+				for (uint32_t d = c; d < 3; d++, k++)
+				{
+					product_vectors[k] = _mm_add_epi32(product_vectors[k], _mm_madd_epi16(channels[c], channels[d]));
+				}
+			}
+		}
+		int32_t lane_sums[12];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lane_sums), horizontalSums(sum_vectors[0], sum_vectors[1], sum_vectors[2], _mm_setzero_si128()));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lane_sums + 4), horizontalSums(product_vectors[0], product_vectors[1], product_vectors[2], product_vectors[3]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lane_sums + 8), horizontalSums(product_vectors[4], product_vectors[5], _mm_setzero_si128(), _mm_setzero_si128()));
+		std::copy_n(lane_sums, 3, sums);
+		std::copy_n(lane_sums + 4, 6, products);
+#else
+		std::fill_n(sums, 3, 0);
+		std::fill_n(products, 6, 0);
+		for (uint32_t i = 0; i < TEXELS_PER_BLOCK; i++)
+		{
+			const uint8_t* texel = texels + 4 * i;
+			for (uint32_t c = 0, k = 0; c < 3; c++)
+			{
+				sums[c] += texel[c];
+				for (uint32_t d = c; d < 3; d++, k++)
+				{
+					products[k] += texel[c] * texel[d];
+				}
+			}
+		}
+#endif
+		for (uint32_t c = 0, k = 0; c < 3; c++)
+		{
+			for (uint32_t d = c; d < 3; d++, k++)
+			{
+				covariance[k] = static_cast<float>(int32_t(TEXELS_PER_BLOCK) * products[k] - sums[c] * sums[d]);
+			}
+		}
+	}
+
+	// the first texels with the lowest and the highest projection onto axis
+	void getExtremeTexels(const uint8_t* texels, const float* axis, uint32_t& lowest_texel, uint32_t& highest_texel)
+	{
+#ifdef BLOCK_COMPRESSION_SSE2
+		__m128 axis_r = _mm_set1_ps(axis[0]);
+		__m128 axis_g = _mm_set1_ps(axis[1]);
+		__m128 axis_b = _mm_set1_ps(axis[2]);
+		__m128 projections[4];
+		__m128 lowest = _mm_set1_ps(FLT_MAX);
+		__m128 highest = _mm_set1_ps(-FLT_MAX);
+		for (uint32_t row = 0; row < 4; row++)
+		{
+			__m128i channels[4];
+			loadChannels(texels + 16 * row, channels);
+			projections[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(channels[0]), axis_r)
+				, _mm_mul_ps(_mm_cvtepi32_ps(channels[1]), axis_g)), _mm_mul_ps(_mm_cvtepi32_ps(channels[2]), axis_b));
+			lowest = _mm_min_ps(lowest, projections[row]);
+			highest = _mm_max_ps(highest, projections[row]);
+		}
+
+		// broadcast the extremes to every lane, then the first lane holding them is the texel
+		lowest = _mm_min_ps(lowest, _mm_shuffle_ps(lowest, lowest, _MM_SHUFFLE(2, 3, 0, 1)));
+		lowest = _mm_min_ps(lowest, _mm_shuffle_ps(lowest, lowest, _MM_SHUFFLE(1, 0, 3, 2)));
+		highest = _mm_max_ps(highest, _mm_shuffle_ps(highest, highest, _MM_SHUFFLE(2, 3, 0, 1)));
+		highest = _mm_max_ps(highest, _mm_shuffle_ps(highest, highest, _MM_SHUFFLE(1, 0, 3, 2)));
+		uint32_t lowest_mask = 0, highest_mask = 0;
+		for (uint32_t row = 0; row < 4; row++)
+		{
+			lowest_mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpeq_ps(projections[row], lowest))) << (4 * row);
+			highest_mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpeq_ps(projections[row], highest))) << (4 * row);
+		}
+		lowest_texel = 0;
+		highest_texel = 0;
+		while (!(lowest_mask & (1u << lowest_texel))) lowest_texel++;
+		while (!(highest_mask & (1u << highest_texel))) highest_texel++;
+#else
+		float lowest = FLT_MAX, highest = -FLT_MAX;
+		lowest_texel = 0;
+		highest_texel = 0;
+		for (uint32_t i = 0; i < TEXELS_PER_BLOCK; i++)
+		{
+			float projection = texels[4 * i + 0] * axis[0] + texels[4 * i + 1] * axis[1] + texels[4 * i + 2] * axis[2];
+			if (projection < lowest)
+			{
+				lowest = projection;
+				lowest_texel = i;
+			}
+			if (projection > highest)
+			{
+				highest = projection;
+				highest_texel = i;
+			}
+		}
+#endif
+	}
+
+	// the step of every texel on the ramp from end_1 (0) to end_0 (3), which is round(3 * t / length_squared) with t
+	// the texel's projection onto the ramp clamped to [0, 3]. every value is an integer below 2^24, exact in a float
+	void getColorSteps(const uint8_t* texels, const int32_t* end_1, const int32_t* direction, int32_t length_squared, int32_t* steps)
+	{
+#ifdef BLOCK_COMPRESSION_SSE2
+		__m128 end_r = _mm_set1_ps(float(end_1[0])), end_g = _mm_set1_ps(float(end_1[1])), end_b = _mm_set1_ps(float(end_1[2]));
+		__m128 direction_r = _mm_set1_ps(float(direction[0])), direction_g = _mm_set1_ps(float(direction[1])), direction_b = _mm_set1_ps(float(direction[2]));
+		__m128 half_length = _mm_set1_ps(float(length_squared / 2));
+		__m128 thresholds[3] = { _mm_set1_ps(float(length_squared)), _mm_set1_ps(float(2 * length_squared)), _mm_set1_ps(float(3 * length_squared)) };
+		for (uint32_t row = 0; row < 4; row++)
+		{
+			__m128i channels[4];
+			loadChannels(texels + 16 * row, channels);
+			__m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(channels[0]), end_r), direction_r)
+				, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(channels[1]), end_g), direction_g))
+				, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(channels[2]), end_b), direction_b));
+			__m128 scaled = _mm_add_ps(_mm_mul_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(3.0f)), half_length);
+
+			// each threshold passed is one step further, a passed compare is -1
+			__m128i step = _mm_setzero_si128();
+			for (const auto& threshold : thresholds)
+			{
+				step = _mm_sub_epi32(step, _mm_castps_si128(_mm_cmpge_ps(scaled, threshold)));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(steps + 4 * row), step);
+		}
+#else
+		for (uint32_t i = 0; i < TEXELS_PER_BLOCK; i++)
+		{
+			int32_t t = (texels[4 * i + 0] - end_1[0]) * direction[0]
+				+ (texels[4 * i + 1] - end_1[1]) * direction[1]
+				+ (texels[4 * i + 2] - end_1[2]) * direction[2];
+			steps[i] = std::min(3, (std::max(0, t) * 3 + length_squared / 2) / length_squared);
+		}
+#endif
+	}
+
+	// the step of every texel on the ramp from low (0) to high (7), round(7 * (value - low) / range)
+	void getChannelSteps(const uint8_t* texels, uint32_t channel, int32_t low, int32_t range, int16_t* steps)
+	{
+#ifdef BLOCK_COMPRESSION_SSE2
+		// all 16 texels in two registers of 16 bit lanes, (value - low) * 7 + range / 2 stays below 2^11
+		__m128i shift = _mm_cvtsi32_si128(static_cast<int>(8 * channel));
+		__m128i byte_mask = _mm_set1_epi32(0xff);
+		__m128i rows[4];
+		for (uint32_t row = 0; row < 4; row++)
+		{
+			rows[row] = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(texels + 16 * row)), shift), byte_mask);
+		}
+		__m128i values[2] = { _mm_packs_epi32(rows[0], rows[1]), _mm_packs_epi32(rows[2], rows[3]) };
+
+		for (uint32_t half = 0; half < 2; half++)
+		{
+			__m128i offset = _mm_sub_epi16(values[half], _mm_set1_epi16(static_cast<int16_t>(low)));
+			__m128i scaled = _mm_add_epi16(_mm_sub_epi16(_mm_slli_epi16(offset, 3), offset), _mm_set1_epi16(static_cast<int16_t>(range / 2)));
+			__m128i step = _mm_setzero_si128();
+			for (int32_t k = 1; k < 8; k++)
+			{
+				step = _mm_sub_epi16(step, _mm_cmpgt_epi16(scaled, _mm_set1_epi16(static_cast<int16_t>(k * range - 1))));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(steps + 8 * half), step);
+		}
+#else
+		for (uint32_t i = 0; i < TEXELS_PER_BLOCK; i++)
+		{
+			steps[i] = static_cast<int16_t>(((texels[4 * i + channel] - low) * 7 + range / 2) / range);
+		}
+#endif
+	}
+
+	uint16_t packRgb565(const uint8_t* rgb)
+	{
+		uint32_t r = (rgb[0] * 31 + 127) / 255;
+		uint32_t g = (rgb[1] * 63 + 127) / 255;
+		uint32_t b = (rgb[2] * 31 + 127) / 255;
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void unpackRgb565(uint16_t color, int32_t* rgb)
+	{
+		int32_t r = (color >> 11) & 31;
+		int32_t g = (color >> 5) & 63;
+		int32_t b = color & 31;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	// the 8 byte BC1 color block, always in the four color mode BC3 requires
+	void encodeColorBlock(const uint8_t* texels, uint8_t* block)
+	{
+		uint8_t min[4], max[4];
+		getBounds(texels, min, max);
+
+		float covariance[6];
+		getCovariance(texels, covariance);
+
+		// principal axis by power iteration, starting from the bounding box diagonal
+		float axis[3] = { float(max[0] - min[0]), float(max[1] - min[1]), float(max[2] - min[2]) };
+		for (int iteration = 0; iteration < 4; iteration++)
+		{
+			float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+			float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+			float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+			float length = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+			if (length < FLT_EPSILON)
+			{
+				break;
+			}
+			axis[0] = x / length;
+			axis[1] = y / length;
+			axis[2] = z / length;
+		}
+
+		// the texels furthest apart along the axis become the endpoints
+		uint32_t lowest_texel, highest_texel;
+		getExtremeTexels(texels, axis, lowest_texel, highest_texel);
+
+		uint16_t color_0 = packRgb565(texels + 4 * highest_texel);
+		uint16_t color_1 = packRgb565(texels + 4 * lowest_texel);
+		if (color_0 < color_1)
+		{
+			std::swap(color_0, color_1);
+		}
+
+		uint32_t indices = 0;
+		if (color_0 != color_1)
+		{
+			int32_t end_0[3], end_1[3];
+			unpackRgb565(color_0, end_0);
+			unpackRgb565(color_1, end_1);
+			int32_t direction[3] = { end_0[0] - end_1[0], end_0[1] - end_1[1], end_0[2] - end_1[2] };
+			int32_t length_squared = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+
+			int32_t steps[TEXELS_PER_BLOCK];
+			getColorSteps(texels, end_1, direction, length_squared, steps);
+
+			// position on the ramp from color_1 (0) to color_0 (3) to the index of that palette entry
+			static const uint32_t ramp_index[4] = { 1, 3, 2, 0 };
+			for (uint32_t i = 0; i < TEXELS_PER_BLOCK; i++)
+			{
+				indices |= ramp_index[steps[i]] << (2 * i);
+			}
+		}
+
+		memcpy(block, &color_0, 2);
+		memcpy(block + 2, &color_1, 2);
+		memcpy(block + 4, &indices, 4);
+	}
+
+	// the 8 byte interpolated single channel block of BC3 alpha and BC5
+	void encodeChannelBlock(const uint8_t* texels, uint32_t channel, uint8_t* block)
+	{
+		uint8_t min[4], max[4];
+		getBounds(texels, min, max);
+		int32_t low = min[channel];
+		int32_t high = max[channel];
+
+		// the endpoint with the larger value first selects the eight value mode
+		block[0] = static_cast<uint8_t>(high);
+		block[1] = static_cast<uint8_t>(low);
+
+		uint64_t indices = 0;
+		if (high > low)
+		{
+			int16_t steps[TEXELS_PER_BLOCK];
+			getChannelSteps(texels, channel, low, high - low, steps);
+
+			// position on the ramp from low (0) to high (7) to the index of that palette entry
+			static const uint64_t ramp_index[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+			for (uint32_t i = 0; i < TEXELS_PER_BLOCK; i++)
+			{
+				indices |= ramp_index[steps[i]] << (3 * i);
+			}
+		}
+
+		for (uint32_t i = 0; i < 6; i++)
+		{
+			block[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+		}
+	}
+}
+
+void BlockCompression::encodeBC1Block(const uint8_t* texels, uint8_t* block)
+{
+	encodeColorBlock(texels, block);
+}
+
+void BlockCompression::encodeBC3Block(const uint8_t* texels, uint8_t* block)
+{
+	encodeChannelBlock(texels, 3, block);
+	encodeColorBlock(texels, block + 8);
+}
+
+void BlockCompression::encodeBC5Block(const uint8_t* texels, uint8_t* block)
+{
+	encodeChannelBlock(texels, 0, block);
+	encodeChannelBlock(texels, 1, block + 8);
+}
+
+uint32_t BlockCompression::getBlockSize(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		return 16;
+	default:
+		throw std::invalid_argument("unsupported block compressed format!");
+	}
+}
+
+std::vector<uint8_t> BlockCompression::compressImage(VkFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t thread_count)
+{
+	auto block_size = getBlockSize(format);
+	auto encodeBlock = format == VK_FORMAT_BC1_RGB_UNORM_BLOCK ? encodeBC1Block
+		: format == VK_FORMAT_BC3_UNORM_BLOCK ? encodeBC3Block
+		: encodeBC5Block;
+
+	uint32_t block_columns = (width + 3) / 4;
+	uint32_t block_rows = (height + 3) / 4;
+	std::vector<uint8_t> blocks(static_cast<size_t>(block_columns) * block_rows * block_size);
+
+	Utilities::parallelFor(block_rows, [&](size_t block_row)
+	{
+		uint8_t texels[TEXELS_PER_BLOCK * 4];
+		for (uint32_t block_column = 0; block_column < block_columns; block_column++)
+		{
+			for (uint32_t y = 0; y < 4; y++)
+			{
+				auto source_y = std::min(static_cast<uint32_t>(block_row) * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++)
+				{
+					auto source_x = std::min(block_column * 4 + x, width - 1);
+					memcpy(texels + 4 * (4 * y + x), pixels + 4 * (static_cast<size_t>(source_y) * width + source_x), 4);
+				}
+			}
+			encodeBlock(texels, blocks.data() + (block_row * block_columns + block_column) * block_size);
+		}
+	}, thread_count);
+
+	return blocks;
+}
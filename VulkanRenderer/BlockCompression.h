@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+* cpu encoders for the BC1, BC3 and BC5 block compressed formats. a block holds 4x4 texels, read as 16 rgba8 texels
+* in row order. endpoints come from the principal axis of the block's colors, indices from projecting onto the
+* quantized endpoints. with SSE2 the bounds, the covariance, the projections and the index search work on four
+* texels per register, the scalar fallback encodes the same blocks
+*/
+namespace BlockCompression
+{
+	// 8 bytes, rgb
+	void encodeBC1Block(const uint8_t* texels, uint8_t* block);
+	// 16 bytes, rgb of BC1 plus interpolated alpha
+	void encodeBC3Block(const uint8_t* texels, uint8_t* block);
+	// 16 bytes, red and green each interpolated on their own, for tangent space normal maps
+	void encodeBC5Block(const uint8_t* texels, uint8_t* block);
+
+	// bytes per 4x4 block of VK_FORMAT_BC1_RGB_UNORM_BLOCK, BC3_UNORM_BLOCK or BC5_UNORM_BLOCK
+	uint32_t getBlockSize(VkFormat format);
+
+	// encode an rgba8 image, rows of blocks are spread over up to thread_count threads (0 for one per core).
+	// edges of images whose size is not a multiple of 4 are padded by repeating the last row and column
+	std::vector<uint8_t> compressImage(VkFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t thread_count = 0);
+}
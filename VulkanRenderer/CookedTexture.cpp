@@ -0,0 +1,208 @@
+#include "CookedTexture.h"
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace
+{
+	const char COOKED_TEXTURE_MAGIC[8] = { 'V', 'T', 'E', 'X', 'T', 'U', 'R', 'E' };
+	const uint64_t DATA_ALIGNMENT = 16;
+
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t kind;
+		uint32_t format; // VkFormat
+		uint32_t width;
+		uint32_t height;
+		uint32_t mip_levels;
+		uint64_t source_size;
+		int64_t source_mtime;
+		uint64_t source_hash;
+	};
+
+	// offsets are from the start of the file
+	struct LevelEntry
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	uint64_t getDataOffset(uint32_t mip_levels)
+	{
+		uint64_t offset = sizeof(FileHeader) + sizeof(LevelEntry) * mip_levels;
+		return (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+	}
+
+	bool isCookedFormat(uint32_t format)
+	{
+		return format == VK_FORMAT_BC1_RGB_UNORM_BLOCK || format == VK_FORMAT_BC3_UNORM_BLOCK || format == VK_FORMAT_BC5_UNORM_BLOCK;
+	}
+}
+
+std::string VCookedTexture::getCookedPath(const std::string& source_path, VTextureKind kind)
+{
+	return source_path + (kind == VTextureKind::NormalMap ? ".normal.vtex" : ".color.vtex");
+}
+
+bool VCookedTexture::load(const std::string& source_path, VTextureKind kind)
+{
+	auto cooked_path = getCookedPath(source_path, kind);
+	std::error_code error;
+	if (!std::filesystem::exists(cooked_path, error))
+	{
+		return false;
+	}
+
+	// only kept once accepted, so a rejected file is unmapped on return and can be overwritten
+	VMappedFile mapping;
+	try
+	{
+		mapping = VMappedFile(cooked_path);
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
+
+	if (mapping.size() < sizeof(FileHeader))
+	{
+		return false;
+	}
+
+	FileHeader header;
+	memcpy(&header, mapping.data(), sizeof(header));
+	if (memcmp(header.magic, COOKED_TEXTURE_MAGIC, sizeof(COOKED_TEXTURE_MAGIC)) != 0
+		|| header.version != VERSION
+		|| header.kind != static_cast<uint32_t>(kind)
+		|| !isCookedFormat(header.format)
+		|| header.width == 0 || header.height == 0
+		|| header.mip_levels == 0 || header.mip_levels > Utilities::getMipLevelCount(header.width, header.height))
+	{
+		return false;
+	}
+
+	if (!Utilities::isSourceUnchanged(source_path, header.source_size, header.source_mtime, header.source_hash))
+	{
+		return false;
+	}
+
+	// the levels must follow each other with exactly the size of their blocks
+	auto data_offset = getDataOffset(header.mip_levels);
+	if (data_offset > mapping.size())
+	{
+		return false;
+	}
+	auto offset = data_offset;
+	for (uint32_t level = 0; level < header.mip_levels; level++)
+	{
+		LevelEntry entry;
+		memcpy(&entry, mapping.data() + sizeof(FileHeader) + level * sizeof(LevelEntry), sizeof(entry));
+
+		auto level_size = Utilities::getImageLevelSize(static_cast<VkFormat>(header.format)
+			, std::max(1u, header.width >> level), std::max(1u, header.height >> level));
+		if (entry.offset != offset || entry.size != level_size)
+		{
+			return false;
+		}
+		offset += entry.size;
+	}
+	if (offset > mapping.size())
+	{
+		return false;
+	}
+
+	file = std::move(mapping);
+	this->kind = kind;
+	format = static_cast<VkFormat>(header.format);
+	width = header.width;
+	height = header.height;
+	mip_levels = header.mip_levels;
+	data = reinterpret_cast<const uint8_t*>(file.data()) + data_offset;
+	data_size = static_cast<size_t>(offset - data_offset);
+	cooked_levels.clear();
+	return true;
+}
+
+void VCookedTexture::cook(const uint8_t* pixels, uint32_t width, uint32_t height, VTextureKind kind, uint32_t thread_count)
+{
+	if (kind == VTextureKind::NormalMap)
+	{
+		format = VK_FORMAT_BC5_UNORM_BLOCK;
+	}
+	else
+	{
+		bool opaque = true;
+		for (size_t i = 0; i < static_cast<size_t>(width) * height && opaque; i++)
+		{
+			opaque = pixels[4 * i + 3] == 255;
+		}
+		format = opaque ? VK_FORMAT_BC1_RGB_UNORM_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+	}
+
+	this->kind = kind;
+	this->width = width;
+	this->height = height;
+	mip_levels = Utilities::getMipLevelCount(width, height);
+
+	auto chain = Utilities::buildMipChainRgba8(pixels, width, height, mip_levels);
+
+	file = VMappedFile();
+	cooked_levels.clear();
+	size_t level_offset = 0;
+	for (uint32_t level = 0; level < mip_levels; level++)
+	{
+		uint32_t level_width = std::max(1u, width >> level);
+		uint32_t level_height = std::max(1u, height >> level);
+		auto blocks = BlockCompression::compressImage(format, chain.data() + level_offset, level_width, level_height, thread_count);
+		cooked_levels.insert(cooked_levels.end(), blocks.begin(), blocks.end());
+		level_offset += static_cast<size_t>(level_width) * level_height * 4;
+	}
+
+	data = cooked_levels.data();
+	data_size = cooked_levels.size();
+}
+
+bool VCookedTexture::write(const std::string& source_path) const
+{
+	if (!data)
+	{
+		return false;
+	}
+
+	FileHeader header = {};
+	memcpy(header.magic, COOKED_TEXTURE_MAGIC, sizeof(COOKED_TEXTURE_MAGIC));
+	header.version = VERSION;
+	header.kind = static_cast<uint32_t>(kind);
+	header.format = static_cast<uint32_t>(format);
+	header.width = width;
+	header.height = height;
+	header.mip_levels = mip_levels;
+	if (!Utilities::getSourceKey(source_path, header.source_size, header.source_mtime, header.source_hash))
+	{
+		return false;
+	}
+
+	auto data_offset = getDataOffset(mip_levels);
+	std::vector<LevelEntry> levels(mip_levels);
+	auto offset = data_offset;
+	for (uint32_t level = 0; level < mip_levels; level++)
+	{
+		levels[level].offset = offset;
+		levels[level].size = Utilities::getImageLevelSize(format, std::max(1u, width >> level), std::max(1u, height >> level));
+		offset += levels[level].size;
+	}
+
+	return Utilities::writeFileAtomically(getCookedPath(source_path, kind), [&](std::ostream& file)
+	{
+		static const char zeros[DATA_ALIGNMENT] = {};
+		auto table_end = sizeof(FileHeader) + sizeof(LevelEntry) * levels.size();
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(levels.data()), sizeof(LevelEntry) * levels.size());
+		file.write(zeros, static_cast<std::streamsize>(data_offset - table_end));
+		file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(data_size));
+	});
+}
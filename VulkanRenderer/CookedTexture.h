@@ -0,0 +1,80 @@
+#pragma once
+#include "Utilities.h"
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+enum class VTextureKind : uint32_t
+{
+	Color = 0, // BC1, or BC3 when some texel is not opaque
+	NormalMap = 1, // BC5 of the x and y components, z is reconstructed in the shader
+};
+
+/**
+* a texture cooked into block compressed mip levels, stored next to its source as <path>.<kind>.vtex.
+* like the mesh cache it is keyed by the source's size, modification time and content hash, and read through a
+* memory mapping so the blocks are staged without any decoding. the levels are stored back to back, level 0 first
+*/
+class VCookedTexture
+{
+public:
+	// bump whenever the file layout or the encoder changes
+	static const uint32_t VERSION = 2;
+
+	// one file per kind, so an image used both as a color and a normal map keeps both and they are never cooked to the same file
+	static std::string getCookedPath(const std::string& source_path, VTextureKind kind);
+
+	// map the cooked texture of source_path, false on a missing, stale or corrupt file or one cooked as another kind
+	bool load(const std::string& source_path, VTextureKind kind);
+
+	// build the full mip chain of an rgba8 image and encode every level, picking the format from the kind and the content
+	void cook(const uint8_t* pixels, uint32_t width, uint32_t height, VTextureKind kind, uint32_t thread_count = 0);
+
+	// write a cooked texture for source_path, false if it could not be written. textures load without it, so that is not an error
+	bool write(const std::string& source_path) const;
+
+	VkFormat getFormat() const
+	{
+		return format;
+	}
+
+	uint32_t getWidth() const
+	{
+		return width;
+	}
+
+	uint32_t getHeight() const
+	{
+		return height;
+	}
+
+	uint32_t getMipLevels() const
+	{
+		return mip_levels;
+	}
+
+	// blocks of all levels, from the mapping after load or from memory after cook
+	const uint8_t* getData() const
+	{
+		return data;
+	}
+
+	size_t getDataSize() const
+	{
+		return data_size;
+	}
+
+private:
+	VMappedFile file;
+	std::vector<uint8_t> cooked_levels;
+
+	VTextureKind kind = VTextureKind::Color;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t mip_levels = 0;
+	const uint8_t* data = nullptr;
+	size_t data_size = 0;
+};
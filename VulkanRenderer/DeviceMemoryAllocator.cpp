@@ -0,0 +1,241 @@
+#include "DeviceMemoryAllocator.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+VDeviceMemoryAllocator::VDeviceMemoryAllocator(VkDevice device, VkPhysicalDevice physical_device, VkDeviceSize block_size)
+	: device(device)
+	, block_size(block_size)
+{
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+	pools.resize(2 * memory_properties.memoryTypeCount);
+}
+
+VDeviceMemoryAllocator::~VDeviceMemoryAllocator()
+{
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool.blocks)
+		{
+			vkFreeMemory(device, block.memory, nullptr);
+		}
+	}
+}
+
+uint32_t VDeviceMemoryAllocator::getSizeClass(VkDeviceSize size)
+{
+	// floor(log2(size))
+	uint32_t size_class = 0;
+	while (size >>= 1)
+	{
+		size_class++;
+	}
+	return size_class;
+}
+
+void VDeviceMemoryAllocator::addFreeRange(Pool& pool, uint32_t block_index, VkDeviceSize offset, VkDeviceSize size)
+{
+	pool.blocks[block_index].free_ranges[offset] = size;
+	pool.size_classes[getSizeClass(size)].insert({ size, block_index, offset });
+}
+
+void VDeviceMemoryAllocator::removeFreeRange(Pool& pool, uint32_t block_index, VkDeviceSize offset, VkDeviceSize size)
+{
+	pool.blocks[block_index].free_ranges.erase(offset);
+	pool.size_classes[getSizeClass(size)].erase({ size, block_index, offset });
+}
+
+VkDeviceMemory VDeviceMemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memory_type)
+{
+	VkMemoryAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = size;
+	alloc_info.memoryTypeIndex = memory_type;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &alloc_info, nullptr, &memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate device memory!");
+	}
+	return memory;
+}
+
+bool VDeviceMemoryAllocator::tryAllocate(Pool& pool, uint32_t pool_index, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation)
+{
+	// the smallest fitting range in the request's own size class, otherwise the smallest one of any larger class
+	for (auto size_class = getSizeClass(size); size_class < SIZE_CLASS_COUNT; size_class++)
+	{
+		const auto& ranges = pool.size_classes[size_class];
+		for (auto it = ranges.lower_bound({ size, 0, 0 }); it != ranges.end(); ++it)
+		{
+			auto aligned_offset = (it->offset + alignment - 1) / alignment * alignment;
+			if (aligned_offset + size > it->offset + it->size)
+			{
+				continue; // the padding does not leave enough room
+			}
+
+			auto range = *it;
+			removeFreeRange(pool, range.block_index, range.offset, range.size);
+
+			// the padding in front stays with the allocation, the tail goes back to the free lists
+			auto end = aligned_offset + size;
+			if (end < range.offset + range.size)
+			{
+				addFreeRange(pool, range.block_index, end, range.offset + range.size - end);
+			}
+
+			auto& block = pool.blocks[range.block_index];
+			block.used_bytes += end - range.offset;
+			block.allocation_count++;
+
+			allocation.memory = block.memory;
+			allocation.offset = aligned_offset;
+			allocation.range_offset = range.offset;
+			allocation.range_size = end - range.offset;
+			allocation.pool_index = pool_index;
+			allocation.block_index = range.block_index;
+			allocation.dedicated = false;
+			return true;
+		}
+	}
+	return false;
+}
+
+VDeviceMemoryAllocator::Allocation VDeviceMemoryAllocator::allocate(const VkMemoryRequirements& requirements, uint32_t memory_type, bool optimal_tiling)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Allocation allocation;
+	if (requirements.size > block_size / 2)
+	{
+		allocation.memory = allocateDeviceMemory(requirements.size, memory_type);
+		allocation.range_size = requirements.size;
+		allocation.dedicated = true;
+		dedicated_allocation_count++;
+		dedicated_bytes += requirements.size;
+		return allocation;
+	}
+
+	auto pool_index = 2 * memory_type + (optimal_tiling ? 1 : 0);
+	auto& pool = pools[pool_index];
+	auto alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+	if (tryAllocate(pool, pool_index, requirements.size, alignment, allocation))
+	{
+		return allocation;
+	}
+
+	// every block is full, add one. it starts at offset 0 so the request always fits
+	Block block;
+	block.memory = allocateDeviceMemory(block_size, memory_type);
+	pool.blocks.push_back(std::move(block));
+	addFreeRange(pool, static_cast<uint32_t>(pool.blocks.size() - 1), 0, block_size);
+
+	tryAllocate(pool, pool_index, requirements.size, alignment, allocation);
+	return allocation;
+}
+
+void VDeviceMemoryAllocator::free(const Allocation& allocation)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (allocation.dedicated)
+	{
+		vkFreeMemory(device, allocation.memory, nullptr);
+		dedicated_allocation_count--;
+		dedicated_bytes -= allocation.range_size;
+		return;
+	}
+
+	auto& pool = pools[allocation.pool_index];
+	auto& block = pool.blocks[allocation.block_index];
+	block.used_bytes -= allocation.range_size;
+	block.allocation_count--;
+
+	auto offset = allocation.range_offset;
+	auto size = allocation.range_size;
+
+	// merge with the free neighbours on both sides
+	auto next = block.free_ranges.lower_bound(offset);
+	if (next != block.free_ranges.end() && next->first == offset + size)
+	{
+		auto next_size = next->second;
+		removeFreeRange(pool, allocation.block_index, next->first, next_size);
+		size += next_size;
+	}
+	next = block.free_ranges.lower_bound(offset);
+	if (next != block.free_ranges.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset)
+		{
+			auto previous_offset = previous->first;
+			auto previous_size = previous->second;
+			removeFreeRange(pool, allocation.block_index, previous_offset, previous_size);
+			offset = previous_offset;
+			size += previous_size;
+		}
+	}
+
+	// empty blocks are kept for the next allocations, e.g. the resources recreated on a resize
+	addFreeRange(pool, allocation.block_index, offset, size);
+}
+
+VDeviceMemoryAllocator::Stats VDeviceMemoryAllocator::getStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Stats stats;
+	stats.dedicated_allocation_count = dedicated_allocation_count;
+	stats.dedicated_bytes = dedicated_bytes;
+	stats.device_allocation_count = dedicated_allocation_count;
+
+	for (size_t i = 0; i < pools.size(); i++)
+	{
+		const auto& pool = pools[i];
+		if (pool.blocks.empty())
+		{
+			continue;
+		}
+
+		PoolStats pool_stats;
+		pool_stats.memory_type = static_cast<uint32_t>(i / 2);
+		pool_stats.optimal_tiling = (i % 2) == 1;
+		pool_stats.block_count = pool.blocks.size();
+		pool_stats.reserved_bytes = block_size * pool.blocks.size();
+		for (const auto& block : pool.blocks)
+		{
+			pool_stats.allocation_count += block.allocation_count;
+			pool_stats.used_bytes += block.used_bytes;
+			pool_stats.free_range_count += block.free_ranges.size();
+			for (const auto& range : block.free_ranges)
+			{
+				pool_stats.largest_free_range = std::max(pool_stats.largest_free_range, range.second);
+			}
+		}
+
+		stats.device_allocation_count += pool.blocks.size();
+		stats.pools.push_back(pool_stats);
+	}
+
+	return stats;
+}
+
+void VDeviceMemoryAllocator::printStats(std::ostream& stream) const
+{
+	auto stats = getStats();
+	const double mb = 1024.0 * 1024.0;
+
+	stream << "Device memory: " << stats.device_allocation_count << " vkAllocateMemory allocations, "
+		<< stats.dedicated_allocation_count << " dedicated (" << stats.dedicated_bytes / mb << " MB)\n";
+	for (const auto& pool : stats.pools)
+	{
+		stream << "  memory type " << pool.memory_type << (pool.optimal_tiling ? " images: " : " buffers: ")
+			<< pool.allocation_count << " resources in " << pool.block_count << " blocks, "
+			<< pool.used_bytes / mb << " / " << pool.reserved_bytes / mb << " MB used, "
+			<< pool.free_range_count << " free ranges, largest " << pool.largest_free_range / mb << " MB\n";
+	}
+	stream.flush();
+}
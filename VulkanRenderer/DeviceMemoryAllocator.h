@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <vector>
+
+/**
+* carves device memory for buffers and images out of large VkDeviceMemory blocks, one set of blocks per memory type.
+* free ranges are kept in power of two size classes for a quick best fit search and are merged with their neighbours on free.
+* linear resources (buffers) and optimal tiled images never share a block, which keeps them bufferImageGranularity apart
+*/
+class VDeviceMemoryAllocator
+{
+public:
+	struct Allocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE; // the block's memory, or a dedicated one
+		VkDeviceSize offset = 0; // aligned offset to bind at
+
+		// the reserved range including alignment padding, returned on free
+		VkDeviceSize range_offset = 0;
+		VkDeviceSize range_size = 0;
+		uint32_t pool_index = 0;
+		uint32_t block_index = 0;
+		bool dedicated = false;
+	};
+
+	struct PoolStats
+	{
+		uint32_t memory_type = 0;
+		bool optimal_tiling = false;
+		size_t block_count = 0;
+		size_t allocation_count = 0;
+		VkDeviceSize reserved_bytes = 0; // sum of the block sizes
+		VkDeviceSize used_bytes = 0;
+		size_t free_range_count = 0;
+		VkDeviceSize largest_free_range = 0;
+	};
+
+	struct Stats
+	{
+		std::vector<PoolStats> pools; // pools that own at least one block
+		size_t dedicated_allocation_count = 0;
+		VkDeviceSize dedicated_bytes = 0;
+		size_t device_allocation_count = 0; // live vkAllocateMemory allocations, blocks and dedicated ones
+	};
+
+	// resources larger than half a block get a dedicated allocation
+	static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+	VDeviceMemoryAllocator(VkDevice device, VkPhysicalDevice physical_device, VkDeviceSize block_size = DEFAULT_BLOCK_SIZE);
+	~VDeviceMemoryAllocator();
+
+	VDeviceMemoryAllocator(const VDeviceMemoryAllocator&) = delete;
+	VDeviceMemoryAllocator& operator= (const VDeviceMemoryAllocator&) = delete;
+
+	// optimal_tiling is true for VK_IMAGE_TILING_OPTIMAL images, false for buffers and linear images
+	Allocation allocate(const VkMemoryRequirements& requirements, uint32_t memory_type, bool optimal_tiling);
+	void free(const Allocation& allocation);
+
+	Stats getStats() const;
+	void printStats(std::ostream& stream) const;
+
+private:
+	static const uint32_t SIZE_CLASS_COUNT = 64;
+
+	// ordered by size first, so lower_bound in a size class finds the best fit
+	struct FreeRange
+	{
+		VkDeviceSize size;
+		uint32_t block_index;
+		VkDeviceSize offset;
+
+		bool operator<(const FreeRange& other) const
+		{
+			if (size != other.size) return size < other.size;
+			if (block_index != other.block_index) return block_index < other.block_index;
+			return offset < other.offset;
+		}
+	};
+
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize used_bytes = 0;
+		size_t allocation_count = 0;
+		std::map<VkDeviceSize, VkDeviceSize> free_ranges; // offset to size, for merging neighbours
+	};
+
+	struct Pool
+	{
+		std::vector<Block> blocks;
+		std::array<std::set<FreeRange>, SIZE_CLASS_COUNT> size_classes;
+	};
+
+	static uint32_t getSizeClass(VkDeviceSize size);
+	void addFreeRange(Pool& pool, uint32_t block_index, VkDeviceSize offset, VkDeviceSize size);
+	void removeFreeRange(Pool& pool, uint32_t block_index, VkDeviceSize offset, VkDeviceSize size);
+	bool tryAllocate(Pool& pool, uint32_t pool_index, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation);
+	VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memory_type);
+
+	VkDevice device;
+	VkDeviceSize block_size;
+	std::vector<Pool> pools; // two per memory type, [2 * memory_type + optimal_tiling]
+
+	size_t dedicated_allocation_count = 0;
+	VkDeviceSize dedicated_bytes = 0;
+
+	mutable std::mutex mutex;
+};
@@ -0,0 +1,266 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+VGpuProfiler::VGpuProfiler(VkDevice device, VkPhysicalDevice physical_device, uint32_t queue_family_index, uint32_t frame_count
+	, bool pipeline_statistics, size_t history_length)
+	: device(device)
+	, pipeline_statistics(pipeline_statistics)
+	, frame_pending(frame_count, false)
+	, history_length(history_length)
+{
+	uint32_t queue_family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+	std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families.data());
+
+	auto valid_bits = queue_families[queue_family_index].timestampValidBits;
+	if (valid_bits == 0)
+	{
+		return; // timestamps are not supported on this queue family
+	}
+	timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	timestamp_period = properties.limits.timestampPeriod;
+
+	auto raii_query_pool_deleter = [device](auto& obj)
+	{
+		vkDestroyQueryPool(device, obj, nullptr);
+	};
+
+	{
+		VkQueryPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		pool_info.queryCount = 2 * PASS_COUNT * frame_count;
+
+		VkQueryPool pool;
+		if (vkCreateQueryPool(device, &pool_info, nullptr, &pool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create timestamp query pool!");
+		}
+		timestamp_query_pool = VulkanRaii<VkQueryPool>(pool, raii_query_pool_deleter);
+	}
+
+	if (pipeline_statistics)
+	{
+		VkQueryPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		pool_info.queryCount = PASS_COUNT * frame_count;
+		pool_info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT; // STATISTICS_COUNT values per query
+
+		VkQueryPool pool;
+		if (vkCreateQueryPool(device, &pool_info, nullptr, &pool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create pipeline statistics query pool!");
+		}
+		statistics_query_pool = VulkanRaii<VkQueryPool>(pool, raii_query_pool_deleter);
+	}
+
+	enabled = true;
+}
+
+void VGpuProfiler::recordReset(VkCommandBuffer command_buffer, uint32_t frame_index)
+{
+	if (!enabled) return;
+
+	vkCmdResetQueryPool(command_buffer, timestamp_query_pool.get(), 2 * PASS_COUNT * frame_index, 2 * PASS_COUNT);
+	if (pipeline_statistics)
+	{
+		vkCmdResetQueryPool(command_buffer, statistics_query_pool.get(), PASS_COUNT * frame_index, PASS_COUNT);
+	}
+}
+
+void VGpuProfiler::recordBegin(VkCommandBuffer command_buffer, uint32_t frame_index, Pass pass)
+{
+	if (!enabled) return;
+
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool.get(), 2 * (PASS_COUNT * frame_index + pass));
+	if (pipeline_statistics)
+	{
+		vkCmdBeginQuery(command_buffer, statistics_query_pool.get(), PASS_COUNT * frame_index + pass, 0);
+	}
+}
+
+void VGpuProfiler::recordEnd(VkCommandBuffer command_buffer, uint32_t frame_index, Pass pass)
+{
+	if (!enabled) return;
+
+	if (pipeline_statistics)
+	{
+		vkCmdEndQuery(command_buffer, statistics_query_pool.get(), PASS_COUNT * frame_index + pass);
+	}
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool.get(), 2 * (PASS_COUNT * frame_index + pass) + 1);
+}
+
+void VGpuProfiler::frameSubmitted(uint32_t frame_index)
+{
+	frame_pending[frame_index] = enabled;
+}
+
+void VGpuProfiler::collect(uint32_t frame_index)
+{
+	if (!enabled || !frame_pending[frame_index]) return;
+	frame_pending[frame_index] = false;
+
+	// no VK_QUERY_RESULT_WAIT_BIT, a frame whose results are somehow not ready is dropped rather than waited for
+	std::array<uint64_t, 2 * PASS_COUNT> timestamps;
+	auto result = vkGetQueryPoolResults(device, timestamp_query_pool.get(), 2 * PASS_COUNT * frame_index, 2 * PASS_COUNT
+		, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS) return;
+
+	std::array<uint64_t, STATISTICS_COUNT * PASS_COUNT> statistics = {};
+	if (pipeline_statistics)
+	{
+		result = vkGetQueryPoolResults(device, statistics_query_pool.get(), PASS_COUNT * frame_index, PASS_COUNT
+			, sizeof(statistics), statistics.data(), STATISTICS_COUNT * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (result != VK_SUCCESS) return;
+	}
+
+	for (int pass = 0; pass < PASS_COUNT; pass++)
+	{
+		uint64_t ticks = (timestamps[2 * pass + 1] - timestamps[2 * pass]) & timestamp_mask;
+
+		Sample sample;
+		sample.time_ms = static_cast<float>(ticks * timestamp_period / 1000000.0);
+		std::copy_n(statistics.begin() + STATISTICS_COUNT * pass, STATISTICS_COUNT, sample.statistics.begin());
+
+		history[pass].push_back(sample);
+		if (history[pass].size() > history_length)
+		{
+			history[pass].pop_front();
+		}
+	}
+}
+
+VGpuProfiler::PassStats VGpuProfiler::getStats(Pass pass) const
+{
+	return computeStats(std::vector<Sample>(history[pass].begin(), history[pass].end()));
+}
+
+VGpuProfiler::PassStats VGpuProfiler::getFrameStats() const
+{
+	// all passes of a frame are collected together, so the histories line up
+	std::vector<Sample> frame_samples(history[0].size(), Sample{ 0.0f, {} });
+	for (int pass = 0; pass < PASS_COUNT; pass++)
+	{
+		for (size_t i = 0; i < frame_samples.size(); i++)
+		{
+			frame_samples[i].time_ms += history[pass][i].time_ms;
+			for (uint32_t j = 0; j < STATISTICS_COUNT; j++)
+			{
+				frame_samples[i].statistics[j] += history[pass][i].statistics[j];
+			}
+		}
+	}
+	return computeStats(frame_samples);
+}
+
+void VGpuProfiler::clearHistory()
+{
+	for (auto& samples : history)
+	{
+		samples.clear();
+	}
+}
+
+VGpuProfiler::PassStats VGpuProfiler::computeStats(const std::vector<Sample>& samples)
+{
+	PassStats stats;
+	if (samples.empty()) return stats;
+
+	std::vector<double> times;
+	times.reserve(samples.size());
+	for (const auto& sample : samples)
+	{
+		times.push_back(sample.time_ms);
+		stats.vertex_invocations += static_cast<double>(sample.statistics[0]);
+		stats.fragment_invocations += static_cast<double>(sample.statistics[1]);
+		stats.compute_invocations += static_cast<double>(sample.statistics[2]);
+	}
+	auto count = static_cast<double>(samples.size());
+	stats.vertex_invocations /= count;
+	stats.fragment_invocations /= count;
+	stats.compute_invocations /= count;
+	stats.time_ms = VBenchmark::computeStats(std::move(times));
+
+	return stats;
+}
+
+const char* VGpuProfiler::getPassName(Pass pass)
+{
+	switch (pass)
+	{
+	case MESHLET_CULLING: return "meshlet_culling";
+	case DEPTH_PREPASS: return "depth_prepass";
+	case LIGHT_CULLING: return "light_culling";
+	case FORWARD: return "forward";
+	default: return "unknown";
+	}
+}
+
+void VGpuProfiler::writeReport(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open profiler report file " + path);
+	}
+
+	bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+
+	if (json)
+	{
+		file << "{\n\t\"passes\": [\n";
+	}
+	else
+	{
+		file << "pass,samples,average_ms,p50_ms,p95_ms,p99_ms,max_ms,vertex_invocations,fragment_invocations,compute_invocations\n";
+	}
+
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		auto pass = static_cast<Pass>(i);
+		auto stats = getStats(pass);
+
+		if (json)
+		{
+			file << "\t\t{ \"pass\": \"" << getPassName(pass) << "\""
+				<< ", \"samples\": " << stats.time_ms.sample_count
+				<< ", \"average_ms\": " << stats.time_ms.mean
+				<< ", \"p50_ms\": " << stats.time_ms.p50
+				<< ", \"p95_ms\": " << stats.time_ms.p95
+				<< ", \"p99_ms\": " << stats.time_ms.p99
+				<< ", \"max_ms\": " << stats.time_ms.max
+				<< ", \"vertex_invocations\": " << stats.vertex_invocations
+				<< ", \"fragment_invocations\": " << stats.fragment_invocations
+				<< ", \"compute_invocations\": " << stats.compute_invocations
+				<< " }" << (i + 1 < PASS_COUNT ? ",\n" : "\n");
+		}
+		else
+		{
+			file << getPassName(pass) << ","
+				<< stats.time_ms.sample_count << ","
+				<< stats.time_ms.mean << ","
+				<< stats.time_ms.p50 << ","
+				<< stats.time_ms.p95 << ","
+				<< stats.time_ms.p99 << ","
+				<< stats.time_ms.max << ","
+				<< stats.vertex_invocations << ","
+				<< stats.fragment_invocations << ","
+				<< stats.compute_invocations << "\n";
+		}
+	}
+
+	if (json)
+	{
+		file << "\t]\n}\n";
+	}
+}
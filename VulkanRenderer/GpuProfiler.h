@@ -0,0 +1,99 @@
+#pragma once
+#include "Benchmark.h"
+#include "VulkanRaii.h"
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+* gpu time of each render pass from timestamp queries, plus optional pipeline statistics.
+* every frame in flight owns its own queries, which are read back after that frame's fence has been waited on,
+* so results arrive a few frames late and the cpu never blocks on them
+*/
+class VGpuProfiler
+{
+public:
+	enum Pass
+	{
+		MESHLET_CULLING = 0,
+		DEPTH_PREPASS,
+		LIGHT_CULLING,
+		FORWARD,
+		PASS_COUNT
+	};
+
+	// statistics over the rolling window of the last history_length frames
+	struct PassStats
+	{
+		VBenchmark::SampleStats time_ms;
+		// averages per frame, zero unless pipeline statistics are enabled
+		double vertex_invocations = 0.0;
+		double fragment_invocations = 0.0;
+		double compute_invocations = 0.0;
+	};
+
+	VGpuProfiler() = default;
+	VGpuProfiler(VkDevice device, VkPhysicalDevice physical_device, uint32_t queue_family_index, uint32_t frame_count
+		, bool pipeline_statistics, size_t history_length = 512);
+	~VGpuProfiler() = default;
+
+	VGpuProfiler(VGpuProfiler&&) = default;
+	VGpuProfiler& operator= (VGpuProfiler&&) = default;
+	VGpuProfiler(const VGpuProfiler&) = delete;
+	VGpuProfiler& operator= (const VGpuProfiler&) = delete;
+
+	// false if the queue family has no timestamp support, recording and collecting are no-ops then
+	bool isEnabled() const
+	{
+		return enabled;
+	}
+
+	// Called on vulcan command buffer recording
+	// reset has to be recorded every frame before the passes' queries execute, outside of any render pass
+	void recordReset(VkCommandBuffer command_buffer, uint32_t frame_index);
+	void recordBegin(VkCommandBuffer command_buffer, uint32_t frame_index, Pass pass);
+	void recordEnd(VkCommandBuffer command_buffer, uint32_t frame_index, Pass pass);
+
+	// the frame's queries have been submitted and can be collected once its fence is signaled
+	void frameSubmitted(uint32_t frame_index);
+	// read back the frame's results without waiting, call after waiting on the frame's fence
+	void collect(uint32_t frame_index);
+
+	PassStats getStats(Pass pass) const;
+	// gpu time of whole frames as the sum of their passes, idle gaps between the submissions are not included
+	PassStats getFrameStats() const;
+	static const char* getPassName(Pass pass);
+
+	// drop every sample collected so far, e.g. those of warm-up frames
+	void clearHistory();
+
+	// writes json if path ends with .json, csv otherwise
+	void writeReport(const std::string& path) const;
+
+private:
+	// pipeline statistics returned for every query, in the order of the flag bits
+	static const uint32_t STATISTICS_COUNT = 3;
+
+	struct Sample
+	{
+		float time_ms;
+		std::array<uint64_t, STATISTICS_COUNT> statistics;
+	};
+
+	static PassStats computeStats(const std::vector<Sample>& samples);
+
+	VkDevice device = VK_NULL_HANDLE;
+	bool enabled = false;
+	bool pipeline_statistics = false;
+	VulkanRaii<VkQueryPool> timestamp_query_pool; // begin and end of each pass, for each frame
+	VulkanRaii<VkQueryPool> statistics_query_pool; // one query of each pass, for each frame
+	double timestamp_period = 1.0; // nanoseconds per tick
+	uint64_t timestamp_mask = ~0ull;
+	std::vector<bool> frame_pending;
+	size_t history_length = 0;
+	std::array<std::deque<Sample>, PASS_COUNT> history;
+};
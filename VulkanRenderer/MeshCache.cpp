@@ -0,0 +1,257 @@
+#include "MeshCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace
+{
+	const char MESH_CACHE_MAGIC[8] = { 'V', 'M', 'E', 'S', 'H', 'C', 'A', 'C' };
+	const uint64_t DATA_ALIGNMENT = 16;
+
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t position_size;
+		uint32_t attribute_size;
+		uint32_t index_size;
+		uint32_t meshlet_size;
+		uint32_t group_count;
+		uint32_t optimized; // went through optimizeMesh
+		uint64_t source_size;
+		int64_t source_mtime;
+		uint64_t source_hash;
+	};
+
+	// offsets are from the start of the file
+	struct GroupEntry
+	{
+		uint64_t position_offset;
+		uint64_t attribute_offset;
+		uint64_t vertex_count;
+		uint64_t index_offset;
+		uint64_t index_count;
+		uint64_t meshlet_offset;
+		uint64_t meshlet_count;
+		uint64_t albedo_map_path_offset;
+		uint64_t albedo_map_path_size;
+		uint64_t normal_map_path_offset;
+		uint64_t normal_map_path_size;
+		float position_min[3];
+		float position_max[3];
+	};
+
+	uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+	}
+
+	// the range lies within a file of file_size bytes
+	bool inBounds(uint64_t offset, uint64_t count, uint64_t element_size, uint64_t file_size)
+	{
+		return offset <= file_size && count <= (file_size - offset) / element_size;
+	}
+}
+
+std::string VMeshCache::getCachePath(const std::string& source_path)
+{
+	return source_path + ".meshcache";
+}
+
+bool VMeshCache::load(const std::string& source_path, bool optimized)
+{
+	groups.clear();
+	file = VMappedFile();
+
+	auto cache_path = getCachePath(source_path);
+	std::error_code error;
+	if (!std::filesystem::exists(cache_path, error))
+	{
+		return false;
+	}
+
+	// only kept once accepted, so a rejected cache is unmapped on return and can be overwritten
+	VMappedFile mapping;
+	try
+	{
+		mapping = VMappedFile(cache_path);
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
+
+	if (mapping.size() < sizeof(FileHeader))
+	{
+		return false;
+	}
+
+	FileHeader header;
+	memcpy(&header, mapping.data(), sizeof(header));
+	if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0
+		|| header.version != VERSION
+		|| header.position_size != sizeof(PackedPosition)
+		|| header.attribute_size != sizeof(PackedAttributes)
+		|| header.index_size != sizeof(Vertex::index_t)
+		|| header.meshlet_size != sizeof(MeshOptimizer::Meshlet)
+		|| header.optimized != (optimized ? 1u : 0u))
+	{
+		return false;
+	}
+
+	if (!Utilities::isSourceUnchanged(source_path, header.source_size, header.source_mtime, header.source_hash))
+	{
+		return false;
+	}
+
+	if (!inBounds(sizeof(FileHeader), header.group_count, sizeof(GroupEntry), mapping.size()))
+	{
+		return false;
+	}
+
+	std::vector<MeshMaterialGroupView> loaded_groups;
+	loaded_groups.reserve(header.group_count);
+	for (uint32_t i = 0; i < header.group_count; i++)
+	{
+		GroupEntry entry;
+		memcpy(&entry, mapping.data() + sizeof(FileHeader) + i * sizeof(GroupEntry), sizeof(entry));
+
+		if (!inBounds(entry.position_offset, entry.vertex_count, sizeof(PackedPosition), mapping.size())
+			|| !inBounds(entry.attribute_offset, entry.vertex_count, sizeof(PackedAttributes), mapping.size())
+			|| !inBounds(entry.index_offset, entry.index_count, sizeof(Vertex::index_t), mapping.size())
+			|| !inBounds(entry.meshlet_offset, entry.meshlet_count, sizeof(MeshOptimizer::Meshlet), mapping.size())
+			|| !inBounds(entry.albedo_map_path_offset, entry.albedo_map_path_size, 1, mapping.size())
+			|| !inBounds(entry.normal_map_path_offset, entry.normal_map_path_size, 1, mapping.size())
+			|| entry.position_offset % DATA_ALIGNMENT != 0
+			|| entry.attribute_offset % DATA_ALIGNMENT != 0
+			|| entry.index_offset % DATA_ALIGNMENT != 0
+			|| entry.meshlet_offset % DATA_ALIGNMENT != 0)
+		{
+			return false;
+		}
+
+		// the meshlets must stay within the group's indices, the load splits them along the parts' index ranges
+		auto meshlets = reinterpret_cast<const MeshOptimizer::Meshlet*>(mapping.data() + entry.meshlet_offset);
+		for (uint64_t m = 0; m < entry.meshlet_count; m++)
+		{
+			if (meshlets[m].index_count % 3 != 0 || meshlets[m].first_index > entry.index_count
+				|| meshlets[m].index_count > entry.index_count - meshlets[m].first_index)
+			{
+				return false;
+			}
+		}
+
+		// an index past the group's vertices would make the gpu fetch out of bounds
+		auto indices = reinterpret_cast<const Vertex::index_t*>(mapping.data() + entry.index_offset);
+		for (uint64_t index = 0; index < entry.index_count; index++)
+		{
+			if (indices[index] >= entry.vertex_count)
+			{
+				return false;
+			}
+		}
+
+		MeshMaterialGroupView group;
+		group.positions = reinterpret_cast<const PackedPosition*>(mapping.data() + entry.position_offset);
+		group.attributes = reinterpret_cast<const PackedAttributes*>(mapping.data() + entry.attribute_offset);
+		group.vertex_count = static_cast<size_t>(entry.vertex_count);
+		group.position_bounds.min = glm::vec3(entry.position_min[0], entry.position_min[1], entry.position_min[2]);
+		group.position_bounds.max = glm::vec3(entry.position_max[0], entry.position_max[1], entry.position_max[2]);
+		group.vertex_indices = indices;
+		group.index_count = static_cast<size_t>(entry.index_count);
+		group.meshlets = meshlets;
+		group.meshlet_count = static_cast<size_t>(entry.meshlet_count);
+		group.albedo_map_path.assign(mapping.data() + entry.albedo_map_path_offset, static_cast<size_t>(entry.albedo_map_path_size));
+		group.normal_map_path.assign(mapping.data() + entry.normal_map_path_offset, static_cast<size_t>(entry.normal_map_path_size));
+		loaded_groups.push_back(std::move(group));
+	}
+
+	file = std::move(mapping);
+	groups = std::move(loaded_groups);
+	return true;
+}
+
+bool VMeshCache::write(const std::string& source_path, const std::vector<MeshMaterialGroup>& groups, bool optimized)
+{
+	FileHeader header = {};
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+	header.version = VERSION;
+	header.position_size = sizeof(PackedPosition);
+	header.attribute_size = sizeof(PackedAttributes);
+	header.index_size = sizeof(Vertex::index_t);
+	header.meshlet_size = sizeof(MeshOptimizer::Meshlet);
+	header.group_count = static_cast<uint32_t>(groups.size());
+	header.optimized = optimized ? 1 : 0;
+	if (!Utilities::getSourceKey(source_path, header.source_size, header.source_mtime, header.source_hash))
+	{
+		return false;
+	}
+
+	// lay out the strings right after the entries, then the aligned vertex and index arrays
+	std::vector<GroupEntry> entries(groups.size());
+	uint64_t offset = sizeof(FileHeader) + sizeof(GroupEntry) * groups.size();
+	for (size_t i = 0; i < groups.size(); i++)
+	{
+		entries[i].albedo_map_path_offset = offset;
+		entries[i].albedo_map_path_size = groups[i].albedo_map_path.size();
+		offset += groups[i].albedo_map_path.size();
+		entries[i].normal_map_path_offset = offset;
+		entries[i].normal_map_path_size = groups[i].normal_map_path.size();
+		offset += groups[i].normal_map_path.size();
+	}
+	for (size_t i = 0; i < groups.size(); i++)
+	{
+		entries[i].vertex_count = groups[i].packed_positions.size();
+
+		offset = alignUp(offset);
+		entries[i].position_offset = offset;
+		offset += sizeof(PackedPosition) * groups[i].packed_positions.size();
+
+		offset = alignUp(offset);
+		entries[i].attribute_offset = offset;
+		offset += sizeof(PackedAttributes) * groups[i].packed_attributes.size();
+		for (int axis = 0; axis < 3; axis++)
+		{
+			entries[i].position_min[axis] = groups[i].position_bounds.min[axis];
+			entries[i].position_max[axis] = groups[i].position_bounds.max[axis];
+		}
+
+		offset = alignUp(offset);
+		entries[i].index_offset = offset;
+		entries[i].index_count = groups[i].vertex_indices.size();
+		offset += sizeof(Vertex::index_t) * groups[i].vertex_indices.size();
+
+		offset = alignUp(offset);
+		entries[i].meshlet_offset = offset;
+		entries[i].meshlet_count = groups[i].meshlets.size();
+		offset += sizeof(MeshOptimizer::Meshlet) * groups[i].meshlets.size();
+	}
+
+	return Utilities::writeFileAtomically(getCachePath(source_path), [&](std::ostream& file)
+	{
+		auto writeAt = [&file](uint64_t offset, const void* data, size_t size)
+		{
+			// pad up to the aligned offset
+			static const char zeros[DATA_ALIGNMENT] = {};
+			auto position = static_cast<uint64_t>(file.tellp());
+			file.write(zeros, static_cast<std::streamsize>(offset - position));
+			file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+		};
+
+		writeAt(0, &header, sizeof(header));
+		writeAt(sizeof(FileHeader), entries.data(), sizeof(GroupEntry) * entries.size());
+		for (const auto& group : groups)
+		{
+			file.write(group.albedo_map_path.data(), group.albedo_map_path.size());
+			file.write(group.normal_map_path.data(), group.normal_map_path.size());
+		}
+		for (size_t i = 0; i < groups.size(); i++)
+		{
+			writeAt(entries[i].position_offset, groups[i].packed_positions.data(), sizeof(PackedPosition) * groups[i].packed_positions.size());
+			writeAt(entries[i].attribute_offset, groups[i].packed_attributes.data(), sizeof(PackedAttributes) * groups[i].packed_attributes.size());
+			writeAt(entries[i].index_offset, groups[i].vertex_indices.data(), sizeof(Vertex::index_t) * groups[i].vertex_indices.size());
+			writeAt(entries[i].meshlet_offset, groups[i].meshlets.data(), sizeof(MeshOptimizer::Meshlet) * groups[i].meshlets.size());
+		}
+	});
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "Model.h"
+#include "Utilities.h"
+
+#include <string>
+#include <vector>
+
+/**
+* versioned binary copy of the packed MeshMaterialGroups and their meshlets imported from an OBJ file, stored next to it as <path>.meshcache.
+* the cache is keyed by the source's size, modification time and content hash, and is read through a memory mapping
+* so vertex and index data can be copied straight into staging memory without parsing
+*/
+class VMeshCache
+{
+public:
+	// bump whenever the file layout, the packed vertex formats or the import itself changes
+	static const uint32_t VERSION = 5;
+
+	static std::string getCachePath(const std::string& source_path);
+
+	// map the cache of source_path, false on a missing, stale or corrupt cache or one written with the other optimized setting
+	bool load(const std::string& source_path, bool optimized);
+
+	// views into the mapped file, valid for the lifetime of this object
+	const std::vector<MeshMaterialGroupView>& getGroups() const
+	{
+		return groups;
+	}
+
+	// write the cache of source_path from groups that went through packVertices and buildMeshlets, false if it could not be written. The renderer works without a cache so that is not an error
+	static bool write(const std::string& source_path, const std::vector<MeshMaterialGroup>& groups, bool optimized);
+
+private:
+	VMappedFile file;
+	std::vector<MeshMaterialGroupView> groups;
+};
@@ -0,0 +1,492 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+	const uint32_t INVALID_INDEX = ~0u;
+
+	// fifo cache by timestamps: a vertex is cached while fewer than cache_size misses happened since it was loaded
+	class FifoCache
+	{
+	public:
+		FifoCache(size_t vertex_count, uint32_t cache_size)
+			: timestamps(vertex_count, 0)
+			, cache_size(cache_size)
+			, time(cache_size + 1)
+		{
+		}
+
+		// true on a miss
+		bool access(uint32_t vertex)
+		{
+			if (time - timestamps[vertex] > cache_size)
+			{
+				timestamps[vertex] = time++;
+				return true;
+			}
+			return false;
+		}
+
+		void clear()
+		{
+			// jumping ahead by more than the cache size evicts every vertex at once
+			time += cache_size + 1;
+		}
+
+	private:
+		std::vector<uint32_t> timestamps;
+		uint32_t cache_size;
+		uint32_t time;
+	};
+
+	// triangles using each vertex, as offsets into one flat list
+	struct Adjacency
+	{
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+		std::vector<uint32_t> live_counts;
+	};
+
+	Adjacency buildAdjacency(const uint32_t* indices, size_t index_count, size_t vertex_count)
+	{
+		Adjacency adjacency;
+		adjacency.live_counts.assign(vertex_count, 0);
+		for (size_t i = 0; i < index_count; i++)
+		{
+			adjacency.live_counts[indices[i]]++;
+		}
+
+		adjacency.offsets.resize(vertex_count + 1, 0);
+		for (size_t v = 0; v < vertex_count; v++)
+		{
+			adjacency.offsets[v + 1] = adjacency.offsets[v] + adjacency.live_counts[v];
+		}
+
+		adjacency.triangles.resize(index_count);
+		std::vector<uint32_t> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+		for (size_t i = 0; i < index_count; i++)
+		{
+			adjacency.triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+		return adjacency;
+	}
+
+	void checkIndices(const uint32_t* indices, size_t index_count, size_t vertex_count)
+	{
+		if (index_count % 3 != 0)
+		{
+			throw std::invalid_argument("index count is not a multiple of 3!");
+		}
+		for (size_t i = 0; i < index_count; i++)
+		{
+			if (indices[i] >= vertex_count)
+			{
+				throw std::out_of_range("vertex index out of range!");
+			}
+		}
+	}
+
+	// bounding sphere and normal cone of the triangles [first_index, first_index + index_count), after
+	// meshopt_computeClusterBounds of meshoptimizer
+	MeshOptimizer::Meshlet computeMeshletBounds(const uint32_t* indices, uint32_t first_index, uint32_t index_count, const glm::vec3* positions)
+	{
+		MeshOptimizer::Meshlet meshlet = {};
+		meshlet.first_index = first_index;
+		meshlet.index_count = index_count;
+
+		glm::vec3 min = positions[indices[first_index]];
+		glm::vec3 max = min;
+		for (auto i = first_index; i < first_index + index_count; i++)
+		{
+			min = glm::min(min, positions[indices[i]]);
+			max = glm::max(max, positions[indices[i]]);
+		}
+		meshlet.center = (min + max) * 0.5f;
+		for (auto i = first_index; i < first_index + index_count; i++)
+		{
+			meshlet.radius = std::max(meshlet.radius, glm::length(positions[indices[i]] - meshlet.center));
+		}
+
+		// unit normals of the triangles, degenerate ones face nowhere and stay zero
+		std::vector<glm::vec3> normals(index_count / 3, glm::vec3(0.0f));
+		glm::vec3 normal_sum(0.0f);
+		for (uint32_t triangle = 0; triangle < index_count / 3; triangle++)
+		{
+			const auto& a = positions[indices[first_index + 3 * triangle + 0]];
+			const auto& b = positions[indices[first_index + 3 * triangle + 1]];
+			const auto& c = positions[indices[first_index + 3 * triangle + 2]];
+			auto normal = glm::cross(b - a, c - a);
+			float length = glm::length(normal);
+			if (length > 0.0f)
+			{
+				normals[triangle] = normal / length;
+				normal_sum += normals[triangle];
+			}
+		}
+
+		meshlet.cone_apex = meshlet.center;
+		meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.cone_cutoff = 1.0f;
+		float sum_length = glm::length(normal_sum);
+		if (sum_length <= 0.0f)
+		{
+			return meshlet;
+		}
+
+		auto axis = normal_sum / sum_length;
+		float min_dot = 1.0f;
+		for (const auto& normal : normals)
+		{
+			if (normal != glm::vec3(0.0f))
+			{
+				min_dot = std::min(min_dot, glm::dot(normal, axis));
+			}
+		}
+
+		// a cone this wide culls almost nothing, and its apex would be far behind the meshlet
+		if (min_dot <= 0.1f)
+		{
+			return meshlet;
+		}
+
+		// the apex goes back along the axis until every triangle's plane is in front of it
+		float max_t = 0.0f;
+		for (uint32_t triangle = 0; triangle < index_count / 3; triangle++)
+		{
+			const auto& normal = normals[triangle];
+			if (normal != glm::vec3(0.0f))
+			{
+				const auto& a = positions[indices[first_index + 3 * triangle]];
+				max_t = std::max(max_t, glm::dot(meshlet.center - a, normal) / glm::dot(axis, normal));
+			}
+		}
+
+		meshlet.cone_apex = meshlet.center - axis * max_t;
+		meshlet.cone_axis = axis;
+		meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+		return meshlet;
+	}
+}
+
+MeshOptimizer::VertexCacheStats& MeshOptimizer::VertexCacheStats::operator+= (const VertexCacheStats& other)
+{
+	triangle_count += other.triangle_count;
+	vertex_count += other.vertex_count;
+	transformed_count += other.transformed_count;
+	return *this;
+}
+
+MeshOptimizer::VertexCacheStats MeshOptimizer::analyzeVertexCache(const uint32_t* indices, size_t index_count, size_t vertex_count, uint32_t cache_size)
+{
+	checkIndices(indices, index_count, vertex_count);
+
+	VertexCacheStats stats;
+	stats.triangle_count = index_count / 3;
+
+	FifoCache cache(vertex_count, cache_size);
+	std::vector<bool> used(vertex_count, false);
+	for (size_t i = 0; i < index_count; i++)
+	{
+		stats.transformed_count += cache.access(indices[i]) ? 1 : 0;
+		if (!used[indices[i]])
+		{
+			used[indices[i]] = true;
+			stats.vertex_count++;
+		}
+	}
+	return stats;
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeVertexCache(const uint32_t* indices, size_t index_count, size_t vertex_count
+	, uint32_t cache_size, std::vector<uint32_t>* clusters)
+{
+	checkIndices(indices, index_count, vertex_count);
+
+	std::vector<uint32_t> result;
+	result.reserve(index_count);
+	if (clusters)
+	{
+		clusters->clear();
+	}
+	if (index_count == 0)
+	{
+		return result;
+	}
+
+	auto adjacency = buildAdjacency(indices, index_count, vertex_count);
+	auto& live_counts = adjacency.live_counts;
+
+	// the timestamps double as tipsify's cache model, the fan of a vertex is emitted while it is still cached
+	std::vector<uint32_t> timestamps(vertex_count, 0);
+	uint32_t time = cache_size + 1;
+	std::vector<bool> emitted(index_count / 3, false);
+	std::vector<uint32_t> dead_end_stack;
+	std::vector<uint32_t> candidates;
+	size_t input_cursor = 0; // the next vertex to restart at once the dead ends are exhausted
+
+	// the first vertex of the first triangle starts the first cluster
+	uint32_t fan_vertex = indices[0];
+	if (clusters)
+	{
+		clusters->push_back(0);
+	}
+
+	while (fan_vertex != INVALID_INDEX)
+	{
+		candidates.clear();
+		for (auto t = adjacency.offsets[fan_vertex]; t < adjacency.offsets[fan_vertex + 1]; t++)
+		{
+			auto triangle = adjacency.triangles[t];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+			emitted[triangle] = true;
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				auto vertex = indices[3 * triangle + corner];
+				result.push_back(vertex);
+				dead_end_stack.push_back(vertex);
+				candidates.push_back(vertex);
+				live_counts[vertex]--;
+				if (time - timestamps[vertex] > cache_size)
+				{
+					timestamps[vertex] = time++;
+				}
+			}
+		}
+
+		// the candidate that will still be cached after its remaining triangles are emitted, the oldest one first
+		uint32_t next_vertex = INVALID_INDEX;
+		int32_t best_priority = -1;
+		for (auto vertex : candidates)
+		{
+			if (live_counts[vertex] == 0)
+			{
+				continue;
+			}
+			int32_t priority = 0;
+			if (time - timestamps[vertex] + 2 * live_counts[vertex] <= cache_size)
+			{
+				priority = static_cast<int32_t>(time - timestamps[vertex]);
+			}
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				next_vertex = vertex;
+			}
+		}
+
+		// a dead end: back to a recently used vertex that still has triangles, else on through the input
+		while (next_vertex == INVALID_INDEX && !dead_end_stack.empty())
+		{
+			auto vertex = dead_end_stack.back();
+			dead_end_stack.pop_back();
+			if (live_counts[vertex] > 0)
+			{
+				next_vertex = vertex;
+			}
+		}
+		while (next_vertex == INVALID_INDEX && input_cursor < index_count)
+		{
+			auto vertex = indices[input_cursor++];
+			if (live_counts[vertex] > 0)
+			{
+				next_vertex = vertex;
+				if (clusters)
+				{
+					clusters->push_back(static_cast<uint32_t>(result.size() / 3));
+				}
+			}
+		}
+
+		fan_vertex = next_vertex;
+	}
+
+	return result;
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeOverdraw(const uint32_t* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count
+	, const std::vector<uint32_t>& clusters, uint32_t cache_size, float threshold)
+{
+	checkIndices(indices, index_count, vertex_count);
+
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0)
+	{
+		return std::vector<uint32_t>();
+	}
+
+	// split the clusters further wherever the acmr so far is within threshold of the whole cluster's,
+	// smaller clusters sort better and the split costs little cache efficiency
+	std::vector<uint32_t> boundaries;
+	FifoCache cache(vertex_count, cache_size);
+	for (size_t cluster = 0; cluster < clusters.size(); cluster++)
+	{
+		size_t begin = clusters[cluster];
+		size_t end = cluster + 1 < clusters.size() ? clusters[cluster + 1] : triangle_count;
+		if (begin >= end)
+		{
+			continue;
+		}
+
+		cache.clear();
+		size_t cluster_misses = 0;
+		for (size_t i = 3 * begin; i < 3 * end; i++)
+		{
+			cluster_misses += cache.access(indices[i]) ? 1 : 0;
+		}
+		double cluster_threshold = threshold * double(cluster_misses) / double(end - begin);
+
+		boundaries.push_back(static_cast<uint32_t>(begin));
+		cache.clear();
+		size_t running_misses = 0;
+		size_t running_triangles = 0;
+		for (size_t triangle = begin; triangle < end; triangle++)
+		{
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				running_misses += cache.access(indices[3 * triangle + corner]) ? 1 : 0;
+			}
+			running_triangles++;
+
+			if (triangle + 1 < end && double(running_misses) / double(running_triangles) <= cluster_threshold)
+			{
+				boundaries.push_back(static_cast<uint32_t>(triangle + 1));
+				cache.clear();
+				running_misses = 0;
+				running_triangles = 0;
+			}
+		}
+	}
+	if (boundaries.empty())
+	{
+		boundaries.push_back(0);
+	}
+
+	// area weighted centroids and normals
+	glm::dvec3 mesh_centroid(0.0);
+	double mesh_area = 0.0;
+	std::vector<glm::dvec3> centroids(boundaries.size(), glm::dvec3(0.0));
+	std::vector<glm::dvec3> normals(boundaries.size(), glm::dvec3(0.0));
+	for (size_t cluster = 0; cluster < boundaries.size(); cluster++)
+	{
+		size_t begin = boundaries[cluster];
+		size_t end = cluster + 1 < boundaries.size() ? boundaries[cluster + 1] : triangle_count;
+
+		double cluster_area = 0.0;
+		for (size_t triangle = begin; triangle < end; triangle++)
+		{
+			glm::dvec3 a(positions[indices[3 * triangle + 0]]);
+			glm::dvec3 b(positions[indices[3 * triangle + 1]]);
+			glm::dvec3 c(positions[indices[3 * triangle + 2]]);
+			auto normal = glm::cross(b - a, c - a);
+			double area = glm::length(normal);
+
+			centroids[cluster] += (a + b + c) * (area / 3.0);
+			normals[cluster] += normal;
+			cluster_area += area;
+		}
+
+		mesh_centroid += centroids[cluster];
+		mesh_area += cluster_area;
+		if (cluster_area > 0.0)
+		{
+			centroids[cluster] /= cluster_area;
+		}
+	}
+	if (mesh_area > 0.0)
+	{
+		mesh_centroid /= mesh_area;
+	}
+
+	// the clusters whose front faces are furthest out occlude the most, so they are drawn first
+	std::vector<double> sort_keys(boundaries.size());
+	for (size_t cluster = 0; cluster < boundaries.size(); cluster++)
+	{
+		double length = glm::length(normals[cluster]);
+		sort_keys[cluster] = length > 0.0 ? glm::dot(centroids[cluster] - mesh_centroid, normals[cluster] / length) : 0.0;
+	}
+
+	std::vector<uint32_t> order(boundaries.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sort_keys](uint32_t a, uint32_t b)
+	{
+		return sort_keys[a] > sort_keys[b];
+	});
+
+	std::vector<uint32_t> result;
+	result.reserve(index_count);
+	for (auto cluster : order)
+	{
+		size_t begin = boundaries[cluster];
+		size_t end = cluster + 1 < boundaries.size() ? boundaries[cluster + 1] : triangle_count;
+		result.insert(result.end(), indices + 3 * begin, indices + 3 * end);
+	}
+	return result;
+}
+
+std::vector<uint32_t> MeshOptimizer::getVertexFetchRemap(const uint32_t* indices, size_t index_count, size_t vertex_count)
+{
+	checkIndices(indices, index_count, vertex_count);
+
+	std::vector<uint32_t> remap(vertex_count, INVALID_INDEX);
+	uint32_t next = 0;
+	for (size_t i = 0; i < index_count; i++)
+	{
+		if (remap[indices[i]] == INVALID_INDEX)
+		{
+			remap[indices[i]] = next++;
+		}
+	}
+	return remap;
+}
+
+std::vector<MeshOptimizer::Meshlet> MeshOptimizer::buildMeshlets(const uint32_t* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count
+	, size_t max_vertices, size_t max_triangles)
+{
+	checkIndices(indices, index_count, vertex_count);
+
+	std::vector<Meshlet> meshlets;
+
+	// the meshlet a vertex was last added to, so finding the new vertices of a triangle is a lookup
+	std::vector<uint32_t> vertex_meshlets(vertex_count, INVALID_INDEX);
+	size_t first_index = 0;
+	size_t meshlet_vertex_count = 0;
+	for (size_t i = 0; i < index_count; i += 3)
+	{
+		auto meshlet = static_cast<uint32_t>(meshlets.size());
+		size_t new_vertex_count = 0;
+		for (size_t corner = 0; corner < 3; corner++)
+		{
+			new_vertex_count += vertex_meshlets[indices[i + corner]] != meshlet ? 1 : 0;
+		}
+
+		if (i > first_index && (meshlet_vertex_count + new_vertex_count > max_vertices || (i - first_index) / 3 >= max_triangles))
+		{
+			meshlets.push_back(computeMeshletBounds(indices, static_cast<uint32_t>(first_index), static_cast<uint32_t>(i - first_index), positions));
+			meshlet++;
+			first_index = i;
+			meshlet_vertex_count = 0;
+		}
+
+		for (size_t corner = 0; corner < 3; corner++)
+		{
+			if (vertex_meshlets[indices[i + corner]] != meshlet)
+			{
+				vertex_meshlets[indices[i + corner]] = meshlet;
+				meshlet_vertex_count++;
+			}
+		}
+	}
+	if (index_count > first_index)
+	{
+		meshlets.push_back(computeMeshletBounds(indices, static_cast<uint32_t>(first_index), static_cast<uint32_t>(index_count - first_index), positions));
+	}
+	return meshlets;
+}
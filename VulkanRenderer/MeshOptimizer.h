@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+* reordering of indexed triangle lists for the gpu, after "Fast Triangle Reordering for Vertex Locality and Reduced
+* Overdraw" (Sander, Nehab and Barczak 2007): triangles are ordered for a fifo post-transform cache with tipsify, the
+* resulting clusters are sorted so outward facing ones come first, and the vertices are renumbered in first use order
+*/
+namespace MeshOptimizer
+{
+	// transformed vertices of a fifo cache simulation
+	struct VertexCacheStats
+	{
+		size_t triangle_count = 0;
+		size_t vertex_count = 0; // vertices referenced by the indices
+		size_t transformed_count = 0; // cache misses
+
+		// average cache miss ratio, transformed vertices per triangle. 0.5 is the best a regular grid can do
+		double getAcmr() const
+		{
+			return triangle_count > 0 ? double(transformed_count) / triangle_count : 0.0;
+		}
+
+		// average transform to vertex ratio, 1 means every vertex is transformed once
+		double getAtvr() const
+		{
+			return vertex_count > 0 ? double(transformed_count) / vertex_count : 0.0;
+		}
+
+		VertexCacheStats& operator+= (const VertexCacheStats& other);
+	};
+
+	VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t index_count, size_t vertex_count, uint32_t cache_size = 16);
+
+	// triangles reordered for a fifo cache of cache_size entries. clusters receives the first triangle of each run
+	// the algorithm had to restart at a vertex outside of the cache
+	std::vector<uint32_t> optimizeVertexCache(const uint32_t* indices, size_t index_count, size_t vertex_count
+		, uint32_t cache_size = 16, std::vector<uint32_t>* clusters = nullptr);
+
+	// clusters of a vertex cache optimized order split where their cache efficiency allows, with threshold the
+	// acceptable acmr increase, then sorted by how far out they face from the mesh's center
+	std::vector<uint32_t> optimizeOverdraw(const uint32_t* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count
+		, const std::vector<uint32_t>& clusters, uint32_t cache_size = 16, float threshold = 1.05f);
+
+	// new index of every vertex so they are numbered in the order the indices first use them, ~0u for unused ones
+	std::vector<uint32_t> getVertexFetchRemap(const uint32_t* indices, size_t index_count, size_t vertex_count);
+
+	// a run of consecutive triangles culled as a whole. a camera inside the cone, that is with
+	// dot(normalize(cone_apex - camera), cone_axis) > cone_cutoff, sees only back faces. a cutoff of 1 never culls
+	struct Meshlet
+	{
+		uint32_t first_index;
+		uint32_t index_count;
+		glm::vec3 center; // bounding sphere
+		float radius;
+		glm::vec3 cone_apex;
+		float cone_cutoff;
+		glm::vec3 cone_axis;
+	};
+
+	// split the triangle list in its order into meshlets of at most max_vertices unique vertices and max_triangles
+	// triangles, the sizes mesh shader hardware favours. a cache optimized order keeps them compact
+	std::vector<Meshlet> buildMeshlets(const uint32_t* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count
+		, size_t max_vertices = 64, size_t max_triangles = 124);
+}
@@ -7,6 +7,18 @@
 #include <fstream>
 #include "VulkanApplication.h"
 #include "Utilities.h"
+#include "MeshCache.h"
+#include "CookedTexture.h"
+#include "TextureCache.h"
+#include "ObjParser.h"
+#include "VertexDedupTable.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <numeric>
 
 namespace std {
 	// hash function for Vertex
@@ -44,7 +56,98 @@ std::string findFolderName(const std::string& str)
 	return str.substr(0, str.find_last_of("/\\"));
 }
 
+Vertex makeVertex(const ObjMesh& mesh, const ObjCorner& corner)
+{
+	Vertex vertex;
+	vertex.color = {};
+
+	vertex.pos = {
+		mesh.positions[3 * corner.position_index + 0],
+		mesh.positions[3 * corner.position_index + 1],
+		mesh.positions[3 * corner.position_index + 2]
+	};
+
+	vertex.tex_coord = { 0.0f, 1.0f };
+	if (corner.texcoord_index >= 0)
+	{
+		vertex.tex_coord = {
+			mesh.texcoords[2 * corner.texcoord_index + 0],
+			1.0f - mesh.texcoords[2 * corner.texcoord_index + 1]
+		};
+	}
+
+	vertex.normal = {};
+	if (corner.normal_index >= 0)
+	{
+		vertex.normal = {
+			mesh.normals[3 * corner.normal_index + 0],
+			mesh.normals[3 * corner.normal_index + 1],
+			mesh.normals[3 * corner.normal_index + 2]
+		};
+	}
+
+	return vertex;
+}
+
 std::vector<MeshMaterialGroup> loadModel(const std::string& path)
+{
+	auto mesh = parseObjFile(path);
+
+	bool has_vertex_normal = mesh.normals.size() > 0;
+	assert(has_vertex_normal);
+
+	std::vector<MeshMaterialGroup> groups(mesh.materials.size() + 1); // group parts of the same material together, +1 for unknown material
+
+	std::string folder = findFolderName(path) + "/";
+	for (size_t i = 0; i < mesh.materials.size(); i++)
+	{
+		if (mesh.materials[i].diffuse_texname != "")
+		{
+			groups[i + 1].albedo_map_path = folder + mesh.materials[i].diffuse_texname;
+		}
+		if (mesh.materials[i].normal_texname != "")
+		{
+			groups[i + 1].normal_map_path = folder + mesh.materials[i].normal_texname;
+		}
+		else if (mesh.materials[i].bump_texname != "")
+		{
+			// CryEngine sponza scene uses keyword "bump" to store normal
+			groups[i + 1].normal_map_path = folder + mesh.materials[i].bump_texname;
+		}
+	}
+
+	// groups are independent, so each one is deduplicated on its own thread. every group only touches its own vectors
+	// and walks its corners in file order, so the output does not depend on the scheduling.
+	// the largest groups go first so a big one picked up last does not leave the other threads idle
+	std::vector<size_t> group_order(groups.size());
+	std::iota(group_order.begin(), group_order.end(), 0);
+	std::stable_sort(group_order.begin(), group_order.end(), [&mesh](size_t a, size_t b)
+	{
+		return mesh.material_corners[a].size() > mesh.material_corners[b].size();
+	});
+
+	Utilities::parallelFor(group_order.size(), [&](size_t i)
+	{
+		auto group_index = group_order[i];
+		auto& group = groups[group_index];
+		const auto& corners = mesh.material_corners[group_index];
+
+		// meshes typically share each vertex between 4 to 6 corners
+		VVertexDedupTable unique_vertices(corners.size() / 4);
+		group.vertices.reserve(corners.size() / 4);
+		group.vertex_indices.reserve(corners.size());
+
+		for (const auto& corner : corners)
+		{
+			group.vertex_indices.push_back(unique_vertices.insert(makeVertex(mesh, corner), group.vertices));
+		}
+	});
+
+	return groups;
+}
+
+// the single threaded tinyobj import that loadModel replaced, kept as the reference for benchmarkModelImport
+std::vector<MeshMaterialGroup> loadModelTinyObj(const std::string& path)
 {
 
 	tinyobj::attrib_t attrib;
@@ -109,6 +212,7 @@ std::vector<MeshMaterialGroup> loadModel(const std::string& path)
 				const auto& index = shape.mesh.indices[indexOffset + f];
 
 				Vertex vertex;
+				vertex.color = {};
 
 				vertex.pos = {
 					attrib.vertices[3 * index.vertex_index + 0],
@@ -137,110 +241,520 @@ std::vector<MeshMaterialGroup> loadModel(const std::string& path)
 	return groups;
 }
 
+std::vector<IndexRange16> splitIndexRanges16(const Vertex::index_t* indices, size_t index_count)
+{
+	std::vector<IndexRange16> ranges;
+	size_t first_index = 0;
+	uint32_t low = std::numeric_limits<uint32_t>::max();
+	uint32_t high = 0;
+	for (size_t i = 0; i + 2 < index_count; i += 3)
+	{
+		uint32_t triangle_low = std::min({ indices[i], indices[i + 1], indices[i + 2] });
+		uint32_t triangle_high = std::max({ indices[i], indices[i + 1], indices[i + 2] });
+		if (triangle_high - triangle_low > std::numeric_limits<uint16_t>::max())
+		{
+			return {};
+		}
+
+		// start a new range once this triangle's vertices would not fit into the current one
+		if (std::max(high, triangle_high) - std::min(low, triangle_low) > std::numeric_limits<uint16_t>::max())
+		{
+			ranges.push_back({ first_index, i - first_index, low });
+			first_index = i;
+			low = triangle_low;
+			high = triangle_high;
+		}
+		else
+		{
+			low = std::min(low, triangle_low);
+			high = std::max(high, triangle_high);
+		}
+	}
+	if (index_count > first_index)
+	{
+		ranges.push_back({ first_index, index_count - first_index, low });
+	}
+	return ranges;
+}
+
+void optimizeMesh(MeshMaterialGroup& group)
+{
+	auto vertex_count = group.vertices.size();
+	std::vector<uint32_t> clusters;
+	auto indices = MeshOptimizer::optimizeVertexCache(group.vertex_indices.data(), group.vertex_indices.size(), vertex_count, 16, &clusters);
+
+	std::vector<glm::vec3> positions(vertex_count);
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		positions[i] = group.vertices[i].pos;
+	}
+	indices = MeshOptimizer::optimizeOverdraw(indices.data(), indices.size(), positions.data(), vertex_count, clusters);
+
+	// vertices no index refers to are dropped
+	auto remap = MeshOptimizer::getVertexFetchRemap(indices.data(), indices.size(), vertex_count);
+	std::vector<Vertex> vertices(vertex_count - std::count(remap.begin(), remap.end(), ~0u));
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		if (remap[i] != ~0u)
+		{
+			vertices[remap[i]] = group.vertices[i];
+		}
+	}
+	for (auto& index : indices)
+	{
+		index = remap[index];
+	}
+
+	group.vertices = std::move(vertices);
+	group.vertex_indices = std::move(indices);
+}
+
+void packVertices(MeshMaterialGroup& group)
+{
+	PositionBounds bounds;
+	if (!group.vertices.empty())
+	{
+		bounds.min = bounds.max = group.vertices[0].pos;
+	}
+	for (const auto& vertex : group.vertices)
+	{
+		bounds.min = glm::min(bounds.min, vertex.pos);
+		bounds.max = glm::max(bounds.max, vertex.pos);
+	}
+
+	group.position_bounds = bounds;
+	group.packed_positions.resize(group.vertices.size());
+	group.packed_attributes.resize(group.vertices.size());
+	for (size_t i = 0; i < group.vertices.size(); i++)
+	{
+		const auto& vertex = group.vertices[i];
+		group.packed_positions[i] = VertexPacking::packPosition(vertex.pos, bounds);
+		group.packed_attributes[i] = VertexPacking::packAttributes(vertex.normal, vertex.tex_coord);
+	}
+}
+
+void buildMeshlets(MeshMaterialGroup& group)
+{
+	// the quantized positions are what is rasterized, they may lie up to half a step off the imported ones
+	std::vector<glm::vec3> positions(group.packed_positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		positions[i] = VertexPacking::unpackPosition(group.packed_positions[i], group.position_bounds);
+	}
+	group.meshlets = MeshOptimizer::buildMeshlets(group.vertex_indices.data(), group.vertex_indices.size(), positions.data(), positions.size());
+}
+
+void benchmarkModelImport(const std::string& path, int iterations)
+{
+	auto timeImport = [&path, iterations](auto import, std::vector<MeshMaterialGroup>& groups)
+	{
+		double best_seconds = std::numeric_limits<double>::max();
+		for (int i = 0; i < iterations; i++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			groups = import(path);
+			auto end = std::chrono::high_resolution_clock::now();
+			best_seconds = std::min(best_seconds, std::chrono::duration<double>(end - start).count());
+		}
+		return best_seconds;
+	};
+
+	double megabytes = static_cast<double>(std::filesystem::file_size(path)) / (1024.0 * 1024.0);
+
+	std::vector<MeshMaterialGroup> tinyobj_groups, parallel_groups;
+	auto tinyobj_seconds = timeImport(loadModelTinyObj, tinyobj_groups);
+	auto parallel_seconds = timeImport(loadModel, parallel_groups);
+
+	auto sameGroups = [](const std::vector<MeshMaterialGroup>& a, const std::vector<MeshMaterialGroup>& b)
+	{
+		bool identical = a.size() == b.size();
+		for (size_t i = 0; identical && i < a.size(); i++)
+		{
+			identical = a[i].vertices == b[i].vertices
+				&& a[i].vertex_indices == b[i].vertex_indices
+				&& a[i].albedo_map_path == b[i].albedo_map_path
+				&& a[i].normal_map_path == b[i].normal_map_path;
+		}
+		return identical;
+	};
+	bool identical = sameGroups(tinyobj_groups, parallel_groups);
+
+	// models are mostly triangles and convex quads, where any triangulation agrees. concave and self overlapping
+	// polygons, in planes along each axis, check that the ear clipping does too
+	auto polygon_path = (std::filesystem::temp_directory_path() / "import_benchmark_polygons.obj").string();
+	{
+		std::ofstream polygon_file(polygon_path);
+		polygon_file << "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvn 0 0 1\nvn 0 1 0\nvn 1 0 0\n"
+			// an l in z = 0 starting at its reflex corner's neighbour, a fan from there would leave the polygon
+			<< "v 2 1 0\nv 1 1 0\nv 1 2 0\nv 0 2 0\nv 0 0 0\nv 2 0 0\n"
+			<< "f 1/1/1 2/2/1 3/3/1 4/4/1 5/1/1 6/2/1\n"
+			// an arrow in y = 0
+			<< "v 0 0 0\nv 3 0 1\nv 0 0 2\nv 1 0 1\nv 0.5 0 0.2\n"
+			<< "f 7/1/2 8/2/2 9/3/2 10/4/2 11/1/2\n"
+			// a pentagram in x = 0, its edges cross
+			<< "v 0 0 1\nv 0 0.59 -0.81\nv 0 -0.95 0.31\nv 0 0.95 0.31\nv 0 -0.59 -0.81\n"
+			<< "f -5/1/3 -4/2/3 -3/3/3 -2/4/3 -1/1/3\n"
+			// and a convex quad
+			<< "v 4 0 0\nv 5 0 0\nv 5 1 0\nv 4 1 0\n"
+			<< "f -4/1/1 -3/2/1 -2/3/1 -1/4/1\n";
+	}
+	bool polygons_identical = sameGroups(loadModelTinyObj(polygon_path), loadModel(polygon_path));
+	std::filesystem::remove(polygon_path);
+
+	std::cout << "Import of " << path << " (" << megabytes << " MB), best of " << iterations << ":\n"
+		<< "  tinyobj:  " << tinyobj_seconds * 1000.0 << " ms, " << megabytes / tinyobj_seconds << " MB/s\n"
+		<< "  parallel: " << parallel_seconds * 1000.0 << " ms, " << megabytes / parallel_seconds << " MB/s\n"
+		<< "  outputs " << (identical ? "identical" : "DIFFER") << ", polygon test " << (polygons_identical ? "identical" : "DIFFER") << std::endl;
+}
+
+void benchmarkVertexDedup(const std::string& path, int iterations)
+{
+	// the same deduplication through the old unordered_map pattern and through VVertexDedupTable, over corner_count
+	// corners produced by getVertex(i), so the synthetic mesh never has to be held in memory
+	auto run = [iterations](const char* name, size_t corner_count, auto getVertex)
+	{
+		double unordered_map_seconds = std::numeric_limits<double>::max();
+		double flat_table_seconds = std::numeric_limits<double>::max();
+		size_t unordered_map_vertex_count = 0, flat_table_vertex_count = 0;
+
+		for (int i = 0; i < iterations; i++)
+		{
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				std::unordered_map<Vertex, size_t> unique_vertices;
+				std::vector<Vertex> vertices;
+				std::vector<Vertex::index_t> vertex_indices;
+				for (size_t c = 0; c < corner_count; c++)
+				{
+					auto vertex = getVertex(c);
+					if (unique_vertices.count(vertex) == 0)
+					{
+						unique_vertices[vertex] = vertices.size();
+						vertices.push_back(vertex);
+					}
+					vertex_indices.push_back(static_cast<Vertex::index_t>(unique_vertices[vertex]));
+				}
+				auto end = std::chrono::high_resolution_clock::now();
+				unordered_map_seconds = std::min(unordered_map_seconds, std::chrono::duration<double>(end - start).count());
+				unordered_map_vertex_count = vertices.size();
+			}
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				VVertexDedupTable unique_vertices;
+				std::vector<Vertex> vertices;
+				std::vector<Vertex::index_t> vertex_indices;
+				for (size_t c = 0; c < corner_count; c++)
+				{
+					vertex_indices.push_back(unique_vertices.insert(getVertex(c), vertices));
+				}
+				auto end = std::chrono::high_resolution_clock::now();
+				flat_table_seconds = std::min(flat_table_seconds, std::chrono::duration<double>(end - start).count());
+				flat_table_vertex_count = vertices.size();
+			}
+		}
+
+		std::cout << "Vertex deduplication of " << name << ", " << corner_count << " corners, best of " << iterations << ":\n"
+			<< "  unordered_map: " << unordered_map_seconds * 1000.0 << " ms\n"
+			<< "  flat table:    " << flat_table_seconds * 1000.0 << " ms, " << unordered_map_seconds / flat_table_seconds << "x\n"
+			<< "  unique vertices " << (unordered_map_vertex_count == flat_table_vertex_count ? "match" : "DIFFER") << std::endl;
+	};
+
+	auto mesh = parseObjFile(path);
+	std::vector<ObjCorner> corners;
+	for (const auto& material_corners : mesh.material_corners)
+	{
+		corners.insert(corners.end(), material_corners.begin(), material_corners.end());
+	}
+	run(path.c_str(), corners.size(), [&mesh, &corners](size_t c)
+	{
+		return makeVertex(mesh, corners[c]);
+	});
+
+	// 10M triangles as a regular grid of quads, every inner vertex is shared by 6 corners
+	const size_t grid_size = 2237; // quads per side
+	run("a synthetic 10M triangle grid", grid_size * grid_size * 6, [grid_size](size_t c)
+	{
+		static const size_t quad_corners[6][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 0, 1 } };
+		size_t quad = c / 6;
+		size_t x = quad % grid_size + quad_corners[c % 6][0];
+		size_t y = quad / grid_size + quad_corners[c % 6][1];
+
+		Vertex vertex;
+		vertex.pos = { static_cast<float>(x), 0.0f, static_cast<float>(y) };
+		vertex.color = {};
+		vertex.tex_coord = { static_cast<float>(x) / grid_size, static_cast<float>(y) / grid_size };
+		vertex.normal = { 0.0f, 1.0f, 0.0f };
+		return vertex;
+	});
+}
 
 VModel VModel::loadModelFromFile(const VulkanApplication& vulkan_context, const std::string& path, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool,
-	const vk::DescriptorSetLayout& material_descriptor_set_layout)
+	const vk::DescriptorSetLayout& material_descriptor_set_layout, bool optimize_meshes, bool print_stats)
 {
 	VModel model;
 
 	auto device = vulkan_context.getDevice();
 	VUtility vulkan_utility{ vulkan_context };
 
-	//std::vector<util::Vertex> vertices, std::vector<util::Vertex::index_t> vertex_indices;
-	auto groups = loadModel(path);
+	// a cache hit skips the obj parsing and vertex deduplication, the views then point into the mapped cache file
+	VMeshCache mesh_cache;
+	std::vector<MeshMaterialGroup> imported_groups;
+	std::vector<MeshMaterialGroupView> groups;
+	if (mesh_cache.load(path, optimize_meshes))
+	{
+		groups = mesh_cache.getGroups();
+	}
+	else
+	{
+		imported_groups = loadModel(path);
+		if (optimize_meshes)
+		{
+			// the cache keeps the result, so this runs once per source
+			MeshOptimizer::VertexCacheStats before, after;
+			if (print_stats)
+			{
+				for (const auto& group : imported_groups)
+				{
+					before += MeshOptimizer::analyzeVertexCache(group.vertex_indices.data(), group.vertex_indices.size(), group.vertices.size());
+				}
+			}
+			auto start = std::chrono::high_resolution_clock::now();
+			Utilities::parallelFor(imported_groups.size(), [&imported_groups](size_t i)
+			{
+				optimizeMesh(imported_groups[i]);
+			});
+			auto end = std::chrono::high_resolution_clock::now();
+			if (print_stats)
+			{
+				for (const auto& group : imported_groups)
+				{
+					after += MeshOptimizer::analyzeVertexCache(group.vertex_indices.data(), group.vertex_indices.size(), group.vertices.size());
+				}
+				std::cout << "Mesh optimization: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms, "
+					<< "fifo 16 acmr " << before.getAcmr() << " -> " << after.getAcmr()
+					<< ", atvr " << before.getAtvr() << " -> " << after.getAtvr() << std::endl;
+			}
+		}
+		Utilities::parallelFor(imported_groups.size(), [&imported_groups](size_t i)
+		{
+			packVertices(imported_groups[i]);
+			buildMeshlets(imported_groups[i]);
+		});
+		if (!VMeshCache::write(path, imported_groups, optimize_meshes))
+		{
+			std::cerr << "Failed to write mesh cache " << VMeshCache::getCachePath(path) << std::endl;
+		}
+		for (const auto& group : imported_groups)
+		{
+			groups.emplace_back(group);
+		}
+	}
+
+	// where each group's streams go in the model buffer. sections are 4 byte aligned for 32 bit indices
+	struct GroupLayout
+	{
+		vk::DeviceSize position_offset;
+		vk::DeviceSize attribute_offset;
+		vk::IndexType index_type;
+		std::vector<IndexRange16> index_ranges; // a single range of the whole group for 32 bit indices
+		std::vector<vk::DeviceSize> index_offsets;
+	};
+	std::vector<GroupLayout> layouts(groups.size());
 	vk::DeviceSize buffer_size = 0;
-	for (const auto& group : groups)
+	auto appendSection = [&buffer_size](vk::DeviceSize size)
+	{
+		auto offset = (buffer_size + 3) / 4 * 4;
+		buffer_size = offset + size;
+		return offset;
+	};
+	size_t index_bytes_32 = 0;
+	for (size_t g = 0; g < groups.size(); g++)
 	{
-		if (group.vertex_indices.size() <= 0)
+		const auto& group = groups[g];
+		auto& layout = layouts[g];
+		if (group.index_count <= 0)
 		{
 			continue;
 		}
-		vk::DeviceSize vertex_section_size = sizeof(group.vertices[0]) * group.vertices.size();
-		vk::DeviceSize index_section_size = sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
-		buffer_size += vertex_section_size;
-		buffer_size += index_section_size;
+		layout.position_offset = appendSection(sizeof(PackedPosition) * group.vertex_count);
+		layout.attribute_offset = appendSection(sizeof(PackedAttributes) * group.vertex_count);
+
+		layout.index_ranges = splitIndexRanges16(group.vertex_indices, group.index_count);
+		layout.index_type = layout.index_ranges.empty() ? vk::IndexType::eUint32 : vk::IndexType::eUint16;
+		if (layout.index_ranges.empty())
+		{
+			layout.index_ranges.push_back({ 0, group.index_count, 0 });
+		}
+		for (const auto& range : layout.index_ranges)
+		{
+			auto index_size = layout.index_type == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+			layout.index_offsets.push_back(appendSection(index_size * range.index_count));
+		}
+		index_bytes_32 += sizeof(uint32_t) * group.index_count;
 	}
 
 	std::tie(model.buffer, model.buffer_memory) = vulkan_utility.createBuffer(buffer_size
 		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+		| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT // meshlet culling reads the indices
 		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	vk::DeviceSize current_offset = 0;
+	// which image view of which part a texture is loaded for
+	struct TextureTarget
+	{
+		size_t part_index;
+		vk::ImageView VMeshPart::* image_view;
+	};
+	std::vector<std::string> texture_paths;
+	std::vector<VTextureKind> texture_kinds;
+	std::vector<TextureTarget> texture_targets;
+
+	// the parts a group was split into share its material, only the first one of each group creates it
+	std::vector<size_t> material_part_indices;
+	std::vector<size_t> material_of_part;
+	size_t index_bytes = 0;
 
-	for (const auto& group : groups)
+	std::vector<GpuMeshlet> gpu_meshlets;
+	std::vector<MeshletDrawCommand> draw_commands;
+
+	for (size_t g = 0; g < groups.size(); g++)
 	{
-		if (group.vertex_indices.size() <= 0)
+		const auto& group = groups[g];
+		const auto& layout = layouts[g];
+		if (group.index_count <= 0)
 		{
 			continue;
 		}
 
-		vk::DeviceSize vertex_section_size = sizeof(group.vertices[0]) * group.vertices.size();
-		vk::DeviceSize index_section_size = sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
+		vk::DeviceSize position_section_size = sizeof(PackedPosition) * group.vertex_count;
+		vk::DeviceSize vertex_section_size = sizeof(PackedAttributes) * group.vertex_count;
 
-		VBufferSection vertex_buffer_section = { model.buffer.get(), current_offset, vertex_section_size };
-		// copy vertex data
-		{
-			auto staging_buffer_size = vertex_section_size;
-			auto host_data = group.vertices.data();
-
-			VulkanRaii<VkBuffer> staging_buffer;
-			VulkanRaii<VkDeviceMemory> staging_buffer_memory;
-			std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-				, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-				, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-			);
+		// staged straight from the group, which may point into the mapped mesh cache
+		VBufferSection position_buffer_section = { model.buffer.get(), layout.position_offset, position_section_size };
+		vulkan_utility.enqueueBufferUpload(model.buffer.get(), layout.position_offset, group.positions, position_section_size);
 
-			void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-			memcpy(data, host_data, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-			device.unmapMemory(staging_buffer_memory.get());
+		VBufferSection vertex_buffer_section = { model.buffer.get(), layout.attribute_offset, vertex_section_size };
+		vulkan_utility.enqueueBufferUpload(model.buffer.get(), layout.attribute_offset, group.attributes, vertex_section_size);
 
-			vulkan_utility.copyBuffer(staging_buffer.get(), model.buffer.get(), staging_buffer_size, 0, current_offset);
+		auto material_part_index = model.mesh_parts.size();
+		material_part_indices.push_back(material_part_index);
+		for (size_t r = 0; r < layout.index_ranges.size(); r++)
+		{
+			const auto& range = layout.index_ranges[r];
+			const auto* indices = group.vertex_indices + range.first_index;
+			auto index_size = layout.index_type == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t);
 
-			current_offset += staging_buffer_size;
-		}
+			VBufferSection index_buffer_section;
+			if (layout.index_type == vk::IndexType::eUint16)
+			{
+				// staging copies the data right away, so the narrowed indices only live for the upload call
+				std::vector<uint16_t> indices_16(range.index_count);
+				for (size_t i = 0; i < range.index_count; i++)
+				{
+					indices_16[i] = static_cast<uint16_t>(indices[i] - range.base_vertex);
+				}
+				index_buffer_section = { model.buffer.get(), layout.index_offsets[r], sizeof(uint16_t) * range.index_count };
+				vulkan_utility.enqueueBufferUpload(model.buffer.get(), layout.index_offsets[r], indices_16.data(), index_buffer_section.size);
+			}
+			else
+			{
+				index_buffer_section = { model.buffer.get(), layout.index_offsets[r], sizeof(uint32_t) * range.index_count };
+				vulkan_utility.enqueueBufferUpload(model.buffer.get(), layout.index_offsets[r], indices, index_buffer_section.size);
+			}
+			index_bytes += static_cast<size_t>(index_buffer_section.size);
 
-		VBufferSection index_buffer_section = { model.buffer.get(), current_offset, index_section_size };
-		// copy index data
-		{
-			auto staging_buffer_size = index_section_size;
-			auto host_data = group.vertex_indices.data();
-
-			VulkanRaii<VkBuffer> staging_buffer;
-			VulkanRaii<VkDeviceMemory> staging_buffer_memory;
-			std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-				, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-				, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-			);
+			VMeshPart part = { position_buffer_section, vertex_buffer_section, index_buffer_section, range.index_count, group.position_bounds };
+			part.index_type = layout.index_type;
+			part.vertex_offset = static_cast<int32_t>(range.base_vertex);
 
-			void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-			memcpy(data, host_data, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-			device.unmapMemory(staging_buffer_memory.get());
+			// the group's meshlets clipped to this range, one crossing into the next range is culled in both with the same bounds
+			size_t meshlet_piece_count = 0;
+			for (size_t m = 0; m < group.meshlet_count; m++)
+			{
+				const auto& meshlet = group.meshlets[m];
+				auto begin = std::max<size_t>(meshlet.first_index, range.first_index);
+				auto end = std::min<size_t>(meshlet.first_index + meshlet.index_count, range.first_index + range.index_count);
+				if (begin >= end)
+				{
+					continue;
+				}
+
+				GpuMeshlet gpu_meshlet = {};
+				gpu_meshlet.sphere = glm::vec4(meshlet.center, meshlet.radius);
+				gpu_meshlet.cone_apex = glm::vec4(meshlet.cone_apex, meshlet.cone_cutoff);
+				gpu_meshlet.cone_axis = glm::vec4(meshlet.cone_axis, 0.0f);
+				gpu_meshlet.first_index = static_cast<uint32_t>(layout.index_offsets[r] / index_size + (begin - range.first_index));
+				gpu_meshlet.index_count = static_cast<uint32_t>(end - begin);
+				gpu_meshlet.part_index = static_cast<uint32_t>(model.mesh_parts.size());
+				gpu_meshlets.push_back(gpu_meshlet);
+				meshlet_piece_count++;
+			}
 
-			vulkan_utility.copyBuffer(staging_buffer.get(), model.buffer.get(), staging_buffer_size, 0, current_offset);
+			auto culled_index_count = range.index_count + (layout.index_type == vk::IndexType::eUint16 ? 3 * meshlet_piece_count : 0);
+			part.culled_index_offset = model.culled_index_buffer_size;
+			model.culled_index_buffer_size += (index_size * culled_index_count + 3) / 4 * 4;
 
-			current_offset += staging_buffer_size;
-		}
+			MeshletDrawCommand draw_command = {};
+			draw_command.command.instanceCount = 1;
+			draw_command.command.vertexOffset = part.vertex_offset;
+			draw_command.culled_index_word = static_cast<uint32_t>(part.culled_index_offset / 4);
+			draw_command.index_16_bit = layout.index_type == vk::IndexType::eUint16 ? 1 : 0;
+			draw_commands.push_back(draw_command);
 
-		VMeshPart part = { vertex_buffer_section, index_buffer_section, group.vertex_indices.size() };
+			model.mesh_parts.push_back(part);
+			material_of_part.push_back(material_part_indices.size() - 1);
+		}
 
 		if (!group.albedo_map_path.empty())
 		{
-			model.images.emplace_back();
-			model.image_memories.emplace_back();
-			model.imageviews.emplace_back();
-			std::tie(model.images.back(), model.image_memories.back(), model.imageviews.back()) = vulkan_utility.loadImageFromFile(group.albedo_map_path);
-			part.albedo_map = model.imageviews.back().get();
+			texture_paths.push_back(group.albedo_map_path);
+			texture_kinds.push_back(VTextureKind::Color);
+			texture_targets.push_back({ material_part_index, &VMeshPart::albedo_map });
 		}
 		if (!group.normal_map_path.empty())
 		{
-			model.images.emplace_back();
-			model.image_memories.emplace_back();
-			model.imageviews.emplace_back();
-			std::tie(model.images.back(), model.image_memories.back(), model.imageviews.back()) = vulkan_utility.loadImageFromFile(group.normal_map_path);
-			part.normal_map = model.imageviews.back().get();
+			texture_paths.push_back(group.normal_map_path);
+			texture_kinds.push_back(VTextureKind::NormalMap);
+			texture_targets.push_back({ material_part_index, &VMeshPart::normal_map });
 		}
+	}
+	if (print_stats)
+	{
+		std::cout << "Index buffers: " << model.mesh_parts.size() << " parts from " << material_part_indices.size() << " groups, "
+			<< index_bytes / 1024 << " KB instead of " << index_bytes_32 / 1024 << " KB with 32 bit indices" << std::endl;
+	}
+
+	// meshlet bounds for the culling shader, and the draw commands every frame starts from
+	model.meshlet_count = gpu_meshlets.size();
+	if (!model.mesh_parts.empty())
+	{
+		vk::DeviceSize meshlets_size = sizeof(GpuMeshlet) * gpu_meshlets.size();
+		vk::DeviceSize draw_commands_size = sizeof(MeshletDrawCommand) * draw_commands.size();
+		std::tie(model.meshlet_buffer, model.meshlet_buffer_memory) = vulkan_utility.createBuffer(meshlets_size + draw_commands_size
+			, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		model.meshlet_section = { model.meshlet_buffer.get(), 0, meshlets_size };
+		model.draw_command_section = { model.meshlet_buffer.get(), meshlets_size, draw_commands_size };
+		vulkan_utility.enqueueBufferUpload(model.meshlet_buffer.get(), 0, gpu_meshlets.data(), meshlets_size);
+		vulkan_utility.enqueueBufferUpload(model.meshlet_buffer.get(), meshlets_size, draw_commands.data(), draw_commands_size);
+	}
+	if (print_stats)
+	{
+		size_t triangle_count = index_bytes_32 / sizeof(uint32_t) / 3;
+		std::cout << "Meshlets: " << model.meshlet_count << ", " << (model.meshlet_count > 0 ? double(triangle_count) / model.meshlet_count : 0.0)
+			<< " triangles each on average" << std::endl;
+	}
+
+	// the geometry copies run while the textures are decoded, on the transfer queue where there is one
+	vulkan_utility.submitUploadsAsync();
 
-		model.mesh_parts.push_back(part);
+	// materials sharing a file or identical content get one texture. the ones not loaded yet are decoded together,
+	// overlapping with their staging
+	model.textures = vulkan_context.getTextureCache()->acquire(vulkan_utility, texture_paths, texture_kinds);
+	for (size_t i = 0; i < model.textures.size(); i++)
+	{
+		auto& target = texture_targets[i];
+		model.mesh_parts[target.part_index].*target.image_view = model.textures[i]->image_view.get();
 	}
 
 	auto createMaterialDescriptorSet = [&vulkan_utility, &device, &texture_sampler, &descriptor_pool, &material_descriptor_set_layout, &uniform_buffer_memory = model.uniform_buffer_memory.get()](
@@ -323,19 +837,7 @@ VModel VModel::loadModelFromFile(const VulkanApplication& vulkan_context, const
 
 		mesh_part.material_descriptor_set = descriptor_set;
 
-		vk::DeviceSize staging_buffer_size = uniform_buffer_section.size;
-		VulkanRaii<VkBuffer> staging_buffer;
-		VulkanRaii<VkDeviceMemory> staging_buffer_memory;
-		std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		);
-
-		void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-		memcpy(data, &ubo, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-		device.unmapMemory(staging_buffer_memory.get());
-
-		vulkan_utility.copyBuffer(staging_buffer.get(), uniform_buffer_info.buffer, staging_buffer_size, 0, uniform_buffer_info.offset);
+		vulkan_utility.enqueueBufferUpload(uniform_buffer_info.buffer, uniform_buffer_info.offset, &ubo, uniform_buffer_section.size);
 
 	};
 
@@ -343,17 +845,29 @@ VModel VModel::loadModelFromFile(const VulkanApplication& vulkan_context, const
 	auto min_alignment = vulkan_context.getPhysicalDeviceProperties().limits.minUniformBufferOffsetAlignment;
 	vk::DeviceSize alignment_offset = ((sizeof(MaterialUbo) - 1) / min_alignment + 1) * min_alignment;
 
-	vk::DeviceSize uniform_buffer_size = alignment_offset * model.mesh_parts.size();
+	vk::DeviceSize uniform_buffer_size = alignment_offset * material_part_indices.size();
 	std::tie(model.uniform_buffer, model.uniform_buffer_memory) = vulkan_utility.createBuffer(uniform_buffer_size
 		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
 		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 	vk::DeviceSize uniform_buffer_total_offset = 0;
-	for (auto& part : model.mesh_parts)
+	for (auto part_index : material_part_indices)
 	{
-		createMaterialDescriptorSet(part, VBufferSection(model.uniform_buffer.get(), uniform_buffer_total_offset, sizeof(MaterialUbo)));
+		createMaterialDescriptorSet(model.mesh_parts[part_index], VBufferSection(model.uniform_buffer.get(), uniform_buffer_total_offset, sizeof(MaterialUbo)));
 		uniform_buffer_total_offset += alignment_offset;
 	}
+	for (size_t i = 0; i < model.mesh_parts.size(); i++)
+	{
+		auto& part = model.mesh_parts[i];
+		const auto& material_part = model.mesh_parts[material_part_indices[material_of_part[i]]];
+		part.material_uniform_buffer_section = material_part.material_uniform_buffer_section;
+		part.material_descriptor_set = material_part.material_descriptor_set;
+		part.albedo_map = material_part.albedo_map;
+		part.normal_map = material_part.normal_map;
+	}
+
+	// textures and material ubos, the model is complete once this returns
+	vulkan_utility.submitUploads();
 
 	return model;
 }
\ No newline at end of file
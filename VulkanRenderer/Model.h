@@ -2,13 +2,17 @@
 
 
 #include "VulkanRaii.h"
+#include "VertexFormat.h"
+#include "MeshOptimizer.h"
 #include <vulkan/vulkan.hpp>
+#include <memory>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
 
 
 class VulkanApplication;
+struct VTexture;
 
 struct VBufferSection
 {
@@ -27,10 +31,15 @@ struct VBufferSection
 
 struct VMeshPart
 {
-	VBufferSection vertex_buffer_section = {};
+	VBufferSection position_buffer_section = {}; // PackedPosition, the only stream of the depth pre-pass
+	VBufferSection vertex_buffer_section = {}; // PackedAttributes
 	VBufferSection index_buffer_section = {};
 	VBufferSection material_uniform_buffer_section = {};
 	size_t index_count = 0;
+	PositionBounds position_bounds = {}; // the packed positions are relative to it
+	vk::IndexType index_type = vk::IndexType::eUint32;
+	int32_t vertex_offset = 0; // added to every index, lets 16 bit indices address the vertices of large groups
+	vk::DeviceSize culled_index_offset = 0; // the part's range of a frame's culled index buffer, see MeshletDrawCommand
 	vk::DescriptorSet material_descriptor_set = {};  // TODO: I still need a per-instance descriptor set
 
 
@@ -40,10 +49,13 @@ struct VMeshPart
 
 
 
-	VMeshPart(const VBufferSection& vertex_buffer_section, const VBufferSection& index_buffer_section, size_t index_count)
-		: vertex_buffer_section(vertex_buffer_section)
+	VMeshPart(const VBufferSection& position_buffer_section, const VBufferSection& vertex_buffer_section, const VBufferSection& index_buffer_section
+		, size_t index_count, const PositionBounds& position_bounds)
+		: position_buffer_section(position_buffer_section)
+		, vertex_buffer_section(vertex_buffer_section)
 		, index_buffer_section(index_buffer_section)
 		, index_count(index_count)
+		, position_bounds(position_bounds)
 	{}
 };
 
@@ -91,12 +103,97 @@ struct MeshMaterialGroup // grouped by material
 	std::vector<Vertex> vertices = {};
 	std::vector<Vertex::index_t> vertex_indices = {};
 
+	// the vertices in the gpu streams, filled by packVertices
+	std::vector<PackedPosition> packed_positions = {};
+	std::vector<PackedAttributes> packed_attributes = {};
+	PositionBounds position_bounds = {};
+	std::vector<MeshOptimizer::Meshlet> meshlets = {}; // filled by buildMeshlets
+
 	std::string albedo_map_path = "";
 	std::string normal_map_path = "";
 };
 
+// a group whose packed vertex and index data live elsewhere, e.g. in a packed MeshMaterialGroup or a mapped mesh cache
+struct MeshMaterialGroupView
+{
+	const PackedPosition* positions = nullptr;
+	const PackedAttributes* attributes = nullptr;
+	size_t vertex_count = 0;
+	PositionBounds position_bounds = {};
+	const Vertex::index_t* vertex_indices = nullptr;
+	size_t index_count = 0;
+	const MeshOptimizer::Meshlet* meshlets = nullptr;
+	size_t meshlet_count = 0;
+
+	std::string albedo_map_path = "";
+	std::string normal_map_path = "";
+
+	MeshMaterialGroupView() = default;
+
+	explicit MeshMaterialGroupView(const MeshMaterialGroup& group)
+		: positions(group.packed_positions.data())
+		, attributes(group.packed_attributes.data())
+		, vertex_count(group.packed_positions.size())
+		, position_bounds(group.position_bounds)
+		, vertex_indices(group.vertex_indices.data())
+		, index_count(group.vertex_indices.size())
+		, meshlets(group.meshlets.data())
+		, meshlet_count(group.meshlets.size())
+		, albedo_map_path(group.albedo_map_path)
+		, normal_map_path(group.normal_map_path)
+	{}
+};
+
 std::vector<char> readFile(const std::string& filename);
 
+// import an obj file into one group per material, group 0 collects the faces without a known material
+std::vector<MeshMaterialGroup> loadModel(const std::string& path);
+std::vector<MeshMaterialGroup> loadModelTinyObj(const std::string& path);
+// triangles drawn with 16 bit indices, relative to base_vertex
+struct IndexRange16
+{
+	size_t first_index;
+	size_t index_count;
+	uint32_t base_vertex;
+};
+
+// split a triangle list into ranges whose vertices each lie within 65536 of each other. one range covers small groups
+// entirely, vertices in first use order (see optimizeMesh) keep the others few. empty if a single triangle spans further
+std::vector<IndexRange16> splitIndexRanges16(const Vertex::index_t* indices, size_t index_count);
+// reorder the triangles for the post-transform vertex cache and for overdraw, then the vertices into first use order
+void optimizeMesh(MeshMaterialGroup& group);
+// bounds of the group's vertices and the vertices packed within them
+void packVertices(MeshMaterialGroup& group);
+// meshlets of the group's triangles in index order, bounded by the packed positions as the vertex shaders unpack them
+void buildMeshlets(MeshMaterialGroup& group);
+// time both importers on path and check that they agree, printed to stdout
+void benchmarkModelImport(const std::string& path, int iterations);
+// time vertex deduplication through std::unordered_map and VVertexDedupTable on path and on a synthetic mesh
+void benchmarkVertexDedup(const std::string& path, int iterations);
+
+// a meshlet as the culling compute shader reads it, in object space
+struct GpuMeshlet
+{
+	glm::vec4 sphere; // center, radius
+	glm::vec4 cone_apex; // w is the cone's cutoff
+	glm::vec4 cone_axis;
+	uint32_t first_index; // in the model buffer, counted in indices of the part's index type
+	uint32_t index_count;
+	uint32_t part_index;
+	uint32_t padding;
+};
+
+// the indirect draw of a mesh part's indices that survive meshlet culling, the shader counts them in indexCount.
+// they go to the part's range of the culled index buffer, in the part's index type, with an odd triangle count of a
+// meshlet padded by a degenerate triangle so 16 bit indices fill whole words
+struct MeshletDrawCommand
+{
+	VkDrawIndexedIndirectCommand command;
+	uint32_t culled_index_word; // culled_index_offset / 4
+	uint32_t index_16_bit;
+	uint32_t padding;
+};
+
 class VModel
 {
 public:
@@ -110,9 +207,38 @@ public:
 		return mesh_parts;
 	}
 
+	// positions, attributes and indices of all parts, the culling shader reads the indices as storage buffer
+	vk::Buffer getBuffer() const
+	{
+		return buffer.get();
+	}
+
+	// GpuMeshlets of all parts
+	const VBufferSection& getMeshletSection() const
+	{
+		return meshlet_section;
+	}
+
+	size_t getMeshletCount() const
+	{
+		return meshlet_count;
+	}
+
+	// a MeshletDrawCommand per part with no indices yet, copied over a frame's commands before culling
+	const VBufferSection& getDrawCommandSection() const
+	{
+		return draw_command_section;
+	}
+
+	// room for every part's culled indices, including the padding triangles
+	vk::DeviceSize getCulledIndexBufferSize() const
+	{
+		return culled_index_buffer_size;
+	}
+
 	static VModel loadModelFromFile(const VulkanApplication& vulkanapp, const std::string& path
 		, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool,
-		const vk::DescriptorSetLayout& material_descriptor_set_layout);
+		const vk::DescriptorSetLayout& material_descriptor_set_layout, bool optimize_meshes = true, bool print_stats = false);
 
 	VModel(const VModel&) = delete;
 	VModel& operator= (const VModel&) = delete;
@@ -120,11 +246,15 @@ public:
 private:
 	VulkanRaii<VkBuffer> buffer;
 	VulkanRaii<VkDeviceMemory> buffer_memory;
-	std::vector<VulkanRaii<VkImage>> images;
-	std::vector<VulkanRaii<VkImageView>> imageviews;
-	std::vector<VulkanRaii<VkDeviceMemory>> image_memories;
+	std::vector<std::shared_ptr<VTexture>> textures; // shared with other models through the texture cache
 	VulkanRaii<VkBuffer> uniform_buffer;
 	VulkanRaii<VkDeviceMemory> uniform_buffer_memory;
+	VulkanRaii<VkBuffer> meshlet_buffer; // the meshlets, then the draw commands
+	VulkanRaii<VkDeviceMemory> meshlet_buffer_memory;
+	VBufferSection meshlet_section = {};
+	VBufferSection draw_command_section = {};
+	size_t meshlet_count = 0;
+	vk::DeviceSize culled_index_buffer_size = 0;
 
 	std::vector<VMeshPart> mesh_parts;
 
@@ -0,0 +1,567 @@
+#include "ObjParser.h"
+#include "Utilities.h"
+
+#include <tiny_obj_loader.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+	// smaller files are not worth the thread start up
+	const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+	struct MaterialRun
+	{
+		size_t first_corner;
+		bool inherited; // continues the material of the previous chunk, no usemtl seen yet
+		std::string material_name;
+	};
+
+	// a face of more than three corners, triangulated once the positions of every chunk are known
+	struct ObjPolygon
+	{
+		size_t first_corner;
+		size_t corner_count;
+	};
+
+	// everything a worker parsed from one chunk, indices are still relative to the chunk where obj used negative indices
+	struct ObjChunk
+	{
+		std::vector<float> positions;
+		std::vector<float> texcoords;
+		std::vector<float> normals;
+		std::vector<ObjCorner> corners; // triangles, and the corners of polygons as they are in the file
+		std::vector<ObjPolygon> polygons;
+		std::vector<MaterialRun> runs;
+		std::vector<std::string> material_libraries;
+
+		// corners with a negative obj index, which has to be offset by the records of the previous chunks
+		std::vector<size_t> relative_position_corners;
+		std::vector<size_t> relative_texcoord_corners;
+		std::vector<size_t> relative_normal_corners;
+	};
+
+	inline bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	inline bool isLineEnd(char c)
+	{
+		return c == '\n' || c == '\r';
+	}
+
+	inline const char* skipSpace(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p)) p++;
+		return p;
+	}
+
+	inline const char* skipToken(const char* p, const char* end)
+	{
+		while (p < end && !isSpace(*p) && !isLineEnd(*p)) p++;
+		return p;
+	}
+
+	// missing or malformed values read as 0 like in tinyobj
+	inline const char* parseFloat(const char* p, const char* end, float& value)
+	{
+		p = skipSpace(p, end);
+		if (p < end && *p == '+') p++; // from_chars does not take an explicit plus sign
+		value = 0.0f;
+		auto result = std::from_chars(p, end, value);
+		return result.ec == std::errc() ? result.ptr : skipToken(p, end);
+	}
+
+	inline const char* parseInt(const char* p, const char* end, int& value)
+	{
+		value = 0;
+		auto result = std::from_chars(p, end, value);
+		return result.ec == std::errc() ? result.ptr : p;
+	}
+
+	// one v, v/vt, v//vn or v/vt/vn token. obj indices are 1 based, negative ones count back from the last record
+	const char* parseCorner(const char* p, const char* end, ObjChunk& chunk, ObjCorner& corner
+		, bool& relative_position, bool& relative_texcoord, bool& relative_normal)
+	{
+		auto fixIndex = [](int index, size_t chunk_count, bool& relative)
+		{
+			relative = index < 0;
+			return index > 0 ? index - 1 : static_cast<int32_t>(chunk_count) + index;
+		};
+
+		int index = 0;
+		p = parseInt(p, end, index);
+		if (index == 0)
+		{
+			throw std::runtime_error("Malformed face in obj file");
+		}
+		corner.position_index = fixIndex(index, chunk.positions.size() / 3, relative_position);
+		corner.texcoord_index = -1;
+		corner.normal_index = -1;
+		relative_texcoord = false;
+		relative_normal = false;
+
+		if (p < end && *p == '/')
+		{
+			p++;
+			if (p < end && *p != '/')
+			{
+				p = parseInt(p, end, index);
+				corner.texcoord_index = index == 0 ? -1 : fixIndex(index, chunk.texcoords.size() / 2, relative_texcoord);
+			}
+			if (p < end && *p == '/')
+			{
+				p++;
+				p = parseInt(p, end, index);
+				corner.normal_index = index == 0 ? -1 : fixIndex(index, chunk.normals.size() / 3, relative_normal);
+			}
+		}
+		return skipToken(p, end);
+	}
+
+	void parseFace(const char* p, const char* end, ObjChunk& chunk)
+	{
+		auto first_corner = chunk.corners.size();
+		while (true)
+		{
+			p = skipSpace(p, end);
+			if (p >= end || isLineEnd(*p))
+			{
+				break;
+			}
+
+			ObjCorner corner;
+			bool relative[3];
+			p = parseCorner(p, end, chunk, corner, relative[0], relative[1], relative[2]);
+			if (relative[0]) chunk.relative_position_corners.push_back(chunk.corners.size());
+			if (relative[1]) chunk.relative_texcoord_corners.push_back(chunk.corners.size());
+			if (relative[2]) chunk.relative_normal_corners.push_back(chunk.corners.size());
+			chunk.corners.push_back(corner);
+		}
+
+		auto corner_count = chunk.corners.size() - first_corner;
+		if (corner_count < 3)
+		{
+			// points and lines written as faces are dropped like in tinyobj
+			chunk.corners.resize(first_corner);
+			for (auto* relative_corners : { &chunk.relative_position_corners, &chunk.relative_texcoord_corners, &chunk.relative_normal_corners })
+			{
+				while (!relative_corners->empty() && relative_corners->back() >= first_corner)
+				{
+					relative_corners->pop_back();
+				}
+			}
+		}
+		else if (corner_count > 3)
+		{
+			chunk.polygons.push_back({ first_corner, corner_count });
+		}
+	}
+
+	// point in triangle by crossings, W. Randolph Franklin's pnpoly as tinyobj uses it
+	bool insideTriangle(const float* xs, const float* ys, float x, float y)
+	{
+		bool inside = false;
+		for (size_t i = 0, j = 2; i < 3; j = i++)
+		{
+			if (((ys[i] > y) != (ys[j] > y)) && (x < (xs[j] - xs[i]) * (y - ys[i]) / (ys[j] - ys[i]) + xs[i]))
+			{
+				inside = !inside;
+			}
+		}
+		return inside;
+	}
+
+	// ear clipping as tinyobj does it, step for step and in float, so every polygon gives the same triangles. the
+	// polygon is projected onto the two axes of its first non degenerate corner's normal, and the first corner
+	// from the current guess that is convex and whose triangle holds no other corner is cut off. what is left
+	// once no ear can be found is dropped, like in tinyobj
+	void triangulatePolygon(const ObjCorner* polygon, size_t corner_count, const std::vector<float>& positions
+		, std::vector<ObjCorner>& remaining, std::vector<ObjCorner>& triangles)
+	{
+		auto position = [&positions](const ObjCorner& corner)
+		{
+			return positions.data() + 3 * static_cast<size_t>(corner.position_index);
+		};
+
+		size_t axes[2] = { 1, 2 };
+		for (size_t k = 0; k < corner_count; k++)
+		{
+			auto v0 = position(polygon[k]);
+			auto v1 = position(polygon[(k + 1) % corner_count]);
+			auto v2 = position(polygon[(k + 2) % corner_count]);
+			float e0x = v1[0] - v0[0], e0y = v1[1] - v0[1], e0z = v1[2] - v0[2];
+			float e1x = v2[0] - v1[0], e1y = v2[1] - v1[1], e1z = v2[2] - v1[2];
+			float cx = std::fabs(e0y * e1z - e0z * e1y);
+			float cy = std::fabs(e0z * e1x - e0x * e1z);
+			float cz = std::fabs(e0x * e1y - e0y * e1x);
+			const float epsilon = std::numeric_limits<float>::epsilon();
+			if (cx > epsilon || cy > epsilon || cz > epsilon)
+			{
+				if (!(cx > cy && cx > cz))
+				{
+					axes[0] = 0;
+					if (cz > cx && cz > cy) axes[1] = 1;
+				}
+				break;
+			}
+		}
+
+		// signed area in the projection, its sign tells convex corners from reflex ones
+		float area = 0.0f;
+		for (size_t k = 0; k < corner_count; k++)
+		{
+			auto v0 = position(polygon[k]);
+			auto v1 = position(polygon[(k + 1) % corner_count]);
+			area += (v0[axes[0]] * v1[axes[1]] - v0[axes[1]] * v1[axes[0]]) * 0.5f;
+		}
+
+		remaining.assign(polygon, polygon + corner_count);
+		size_t guess = 0;
+		// attempts left without cutting an ear before giving up
+		size_t remaining_iterations = corner_count;
+		size_t previous_remaining_count = corner_count;
+
+		while (remaining.size() > 3 && remaining_iterations > 0)
+		{
+			auto count = remaining.size();
+			if (guess >= count)
+			{
+				guess -= count;
+			}
+
+			if (previous_remaining_count != count)
+			{
+				previous_remaining_count = count;
+				remaining_iterations = count;
+			}
+			else
+			{
+				remaining_iterations--;
+			}
+
+			ObjCorner ear[3];
+			float xs[3], ys[3];
+			for (size_t k = 0; k < 3; k++)
+			{
+				ear[k] = remaining[(guess + k) % count];
+				xs[k] = position(ear[k])[axes[0]];
+				ys[k] = position(ear[k])[axes[1]];
+			}
+			float e0x = xs[1] - xs[0], e0y = ys[1] - ys[0];
+			float e1x = xs[2] - xs[1], e1y = ys[2] - ys[1];
+			float cross = e0x * e1y - e0y * e1x;
+			if (cross * area < 0.0f)
+			{
+				guess++;
+				continue;
+			}
+
+			bool overlap = false;
+			for (size_t other = 3; other < count && !overlap; other++)
+			{
+				auto v = position(remaining[(guess + other) % count]);
+				overlap = insideTriangle(xs, ys, v[axes[0]], v[axes[1]]);
+			}
+			if (overlap)
+			{
+				guess++;
+				continue;
+			}
+
+			triangles.insert(triangles.end(), ear, ear + 3);
+			remaining.erase(remaining.begin() + (guess + 1) % count);
+		}
+
+		if (remaining.size() == 3)
+		{
+			triangles.insert(triangles.end(), remaining.begin(), remaining.end());
+		}
+	}
+
+	// replace the polygons of a chunk by their triangles, moving the runs along
+	void triangulateChunk(ObjChunk& chunk, const std::vector<float>& positions)
+	{
+		if (chunk.polygons.empty())
+		{
+			return;
+		}
+
+		std::vector<ObjCorner> corners;
+		corners.reserve(chunk.corners.size());
+		std::vector<ObjCorner> remaining;
+
+		size_t next = 0; // first corner not moved yet
+		auto run = chunk.runs.begin();
+		auto moveUntil = [&](size_t end)
+		{
+			corners.insert(corners.end(), chunk.corners.begin() + next, chunk.corners.begin() + end);
+			next = end;
+			for (; run != chunk.runs.end() && run->first_corner <= end; ++run)
+			{
+				run->first_corner = corners.size() - (end - run->first_corner);
+			}
+		};
+
+		for (const auto& polygon : chunk.polygons)
+		{
+			moveUntil(polygon.first_corner);
+			triangulatePolygon(chunk.corners.data() + polygon.first_corner, polygon.corner_count, positions, remaining, corners);
+			next = polygon.first_corner + polygon.corner_count;
+		}
+		moveUntil(chunk.corners.size());
+
+		chunk.corners = std::move(corners);
+		chunk.polygons.clear();
+	}
+
+	void parseChunk(const char* begin, const char* end, ObjChunk& chunk)
+	{
+		chunk.runs.push_back({ 0, true, "" });
+
+		// rough guess from sponza sized files, avoids most of the regrowth
+		auto size = static_cast<size_t>(end - begin);
+		chunk.positions.reserve(size / 40);
+		chunk.corners.reserve(size / 40);
+
+		auto p = begin;
+		while (p < end)
+		{
+			auto line_end = std::find(p, end, '\n');
+			p = skipSpace(p, line_end);
+
+			if (line_end - p >= 2)
+			{
+				if (p[0] == 'v' && isSpace(p[1]))
+				{
+					float x, y, z;
+					auto q = parseFloat(p + 2, line_end, x);
+					q = parseFloat(q, line_end, y);
+					parseFloat(q, line_end, z);
+					chunk.positions.insert(chunk.positions.end(), { x, y, z });
+				}
+				else if (p[0] == 'v' && p[1] == 't' && line_end - p >= 3 && isSpace(p[2]))
+				{
+					float u, v;
+					auto q = parseFloat(p + 3, line_end, u);
+					parseFloat(q, line_end, v);
+					chunk.texcoords.insert(chunk.texcoords.end(), { u, v });
+				}
+				else if (p[0] == 'v' && p[1] == 'n' && line_end - p >= 3 && isSpace(p[2]))
+				{
+					float x, y, z;
+					auto q = parseFloat(p + 3, line_end, x);
+					q = parseFloat(q, line_end, y);
+					parseFloat(q, line_end, z);
+					chunk.normals.insert(chunk.normals.end(), { x, y, z });
+				}
+				else if (p[0] == 'f' && isSpace(p[1]))
+				{
+					parseFace(p + 2, line_end, chunk);
+				}
+				else if (line_end - p >= 7 && std::equal(p, p + 6, "usemtl") && isSpace(p[6]))
+				{
+					auto name_begin = skipSpace(p + 7, line_end);
+					auto name_end = skipToken(name_begin, line_end);
+					chunk.runs.push_back({ chunk.corners.size(), false, std::string(name_begin, name_end) });
+				}
+				else if (line_end - p >= 7 && std::equal(p, p + 6, "mtllib") && isSpace(p[6]))
+				{
+					auto q = skipSpace(p + 7, line_end);
+					while (q < line_end && !isLineEnd(*q))
+					{
+						auto name_end = skipToken(q, line_end);
+						chunk.material_libraries.emplace_back(q, name_end);
+						q = skipSpace(name_end, line_end);
+					}
+				}
+				// anything else (comments, o, g, s, l, p) does not contribute to the mesh
+			}
+
+			p = line_end + (line_end < end ? 1 : 0);
+		}
+	}
+
+	std::string findFolder(const std::string& path)
+	{
+		auto separator = path.find_last_of("/\\");
+		return separator == std::string::npos ? "" : path.substr(0, separator + 1);
+	}
+
+	// the first library that opens wins, like in tinyobj
+	std::vector<ObjMaterial> loadMaterials(const std::string& folder, const std::vector<std::string>& libraries
+		, std::map<std::string, int>& material_map)
+	{
+		std::vector<ObjMaterial> materials;
+		for (const auto& library : libraries)
+		{
+			std::ifstream file(folder + library);
+			if (!file.is_open())
+			{
+				continue;
+			}
+
+			std::vector<tinyobj::material_t> mtl_materials;
+			std::string warn, err;
+			tinyobj::LoadMtl(&material_map, &mtl_materials, &file, &warn, &err);
+
+			for (const auto& material : mtl_materials)
+			{
+				materials.push_back({ material.name, material.diffuse_texname, material.normal_texname, material.bump_texname });
+			}
+			break;
+		}
+		return materials;
+	}
+}
+
+ObjMesh parseObjFile(const std::string& path, uint32_t thread_count)
+{
+	VMappedFile file(path);
+	const char* data = file.data();
+	size_t size = file.size();
+
+	if (thread_count == 0)
+	{
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+	size_t chunk_count = std::max<size_t>(1, std::min<size_t>(thread_count, size / MIN_CHUNK_SIZE));
+
+	// split at line boundaries
+	std::vector<size_t> chunk_begins(chunk_count + 1, size);
+	chunk_begins[0] = 0;
+	for (size_t i = 1; i < chunk_count; i++)
+	{
+		auto guess = std::max(size * i / chunk_count, chunk_begins[i - 1]);
+		auto line_end = std::find(data + guess, data + size, '\n');
+		chunk_begins[i] = std::min(size, static_cast<size_t>(line_end - data) + 1);
+	}
+
+	std::vector<ObjChunk> chunks(chunk_count);
+	Utilities::parallelFor(chunk_count, [&](size_t i)
+	{
+		parseChunk(data + chunk_begins[i], data + chunk_begins[i + 1], chunks[i]);
+	}, thread_count);
+
+	ObjMesh mesh;
+
+	// record counts before each chunk, used to resolve negative indices
+	std::vector<size_t> position_bases(chunk_count), texcoord_bases(chunk_count), normal_bases(chunk_count);
+	size_t position_count = 0, texcoord_count = 0, normal_count = 0;
+	for (size_t i = 0; i < chunk_count; i++)
+	{
+		position_bases[i] = position_count;
+		texcoord_bases[i] = texcoord_count;
+		normal_bases[i] = normal_count;
+		position_count += chunks[i].positions.size() / 3;
+		texcoord_count += chunks[i].texcoords.size() / 2;
+		normal_count += chunks[i].normals.size() / 3;
+	}
+
+	std::vector<std::string> material_libraries;
+	for (const auto& chunk : chunks)
+	{
+		material_libraries.insert(material_libraries.end(), chunk.material_libraries.begin(), chunk.material_libraries.end());
+	}
+	std::map<std::string, int> material_map;
+	mesh.materials = loadMaterials(findFolder(path), material_libraries, material_map);
+
+	mesh.positions.resize(position_count * 3);
+	mesh.texcoords.resize(texcoord_count * 2);
+	mesh.normals.resize(normal_count * 3);
+
+	// every chunk writes to its own ranges, so the merge runs in parallel as well
+	Utilities::parallelFor(chunk_count, [&](size_t i)
+	{
+		auto& chunk = chunks[i];
+
+		std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + position_bases[i] * 3);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), mesh.texcoords.begin() + texcoord_bases[i] * 2);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), mesh.normals.begin() + normal_bases[i] * 3);
+
+		for (auto corner : chunk.relative_position_corners)
+		{
+			chunk.corners[corner].position_index += static_cast<int32_t>(position_bases[i]);
+		}
+		for (auto corner : chunk.relative_texcoord_corners)
+		{
+			chunk.corners[corner].texcoord_index += static_cast<int32_t>(texcoord_bases[i]);
+		}
+		for (auto corner : chunk.relative_normal_corners)
+		{
+			chunk.corners[corner].normal_index += static_cast<int32_t>(normal_bases[i]);
+		}
+
+		for (const auto& corner : chunk.corners)
+		{
+			if (corner.position_index < 0 || static_cast<size_t>(corner.position_index) >= position_count
+				|| corner.texcoord_index >= static_cast<int64_t>(texcoord_count)
+				|| corner.normal_index >= static_cast<int64_t>(normal_count))
+			{
+				throw std::runtime_error("Face index out of range in " + path);
+			}
+		}
+	}, thread_count);
+
+	// polygons can use positions of any chunk, so they are only triangulated once all are merged
+	Utilities::parallelFor(chunk_count, [&](size_t i)
+	{
+		triangulateChunk(chunks[i], mesh.positions);
+	}, thread_count);
+
+	// resolve the material of every run in file order, and where each chunk's runs go in the merged streams
+	struct RunTarget
+	{
+		size_t group;
+		size_t offset;
+	};
+	std::vector<std::vector<RunTarget>> run_targets(chunk_count);
+	std::vector<size_t> group_sizes(mesh.materials.size() + 1, 0);
+	int current_material = -1;
+	for (size_t i = 0; i < chunk_count; i++)
+	{
+		const auto& runs = chunks[i].runs;
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			if (!runs[r].inherited)
+			{
+				auto material = material_map.find(runs[r].material_name);
+				current_material = material == material_map.end() ? -1 : material->second;
+			}
+
+			auto run_end = r + 1 < runs.size() ? runs[r + 1].first_corner : chunks[i].corners.size();
+			auto group = static_cast<size_t>(current_material + 1);
+			run_targets[i].push_back({ group, group_sizes[group] });
+			group_sizes[group] += run_end - runs[r].first_corner;
+		}
+	}
+
+	mesh.material_corners.resize(group_sizes.size());
+	for (size_t group = 0; group < group_sizes.size(); group++)
+	{
+		mesh.material_corners[group].resize(group_sizes[group]);
+	}
+
+	Utilities::parallelFor(chunk_count, [&](size_t i)
+	{
+		const auto& chunk = chunks[i];
+		const auto& runs = chunk.runs;
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			auto run_begin = chunk.corners.begin() + runs[r].first_corner;
+			auto run_end = r + 1 < runs.size() ? chunk.corners.begin() + runs[r + 1].first_corner : chunk.corners.end();
+			const auto& target = run_targets[i][r];
+			std::copy(run_begin, run_end, mesh.material_corners[target.group].begin() + target.offset);
+		}
+	}, thread_count);
+
+	return mesh;
+}
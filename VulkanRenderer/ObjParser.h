@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 0 based attribute indices of one face corner, -1 if the face has no such attribute
+struct ObjCorner
+{
+	int32_t position_index;
+	int32_t texcoord_index;
+	int32_t normal_index;
+};
+
+struct ObjMaterial
+{
+	std::string name;
+	std::string diffuse_texname;
+	std::string normal_texname;
+	std::string bump_texname;
+};
+
+struct ObjMesh
+{
+	std::vector<float> positions; // xyz
+	std::vector<float> texcoords; // uv
+	std::vector<float> normals; // xyz
+	std::vector<ObjMaterial> materials; // in the order of the mtl file, like tinyobj
+
+	// triangulated faces of each material in file order, [material_id + 1] with 0 for faces without a known material
+	std::vector<std::vector<ObjCorner>> material_corners;
+};
+
+/**
+* parse an obj file on thread_count threads, 0 for one per core.
+* the file is memory mapped and split into chunks at line boundaries, each chunk is parsed on its own thread,
+* and the per chunk face streams are then merged per material in file order.
+* polygons are ear clipped with tinyobj's algorithm once all positions are known, so the triangles come out the same
+* and in the same order as tinyobj::LoadObj produces them, concave polygons included
+*/
+ObjMesh parseObjFile(const std::string& path, uint32_t thread_count = 0);
@@ -10,4 +10,23 @@ Scene::Scene()
 	light_num = 1000;
 	camera_position = glm::vec3{ 12.7101822f, 1.87933588f, -0.0333303586f };
 	camera_rotation = glm::quat{ 0.717312694f, -0.00208670134f, 0.696745396f, 0.00202676491f };
+	frames_in_flight = 2;
+	cluster_depth_slices = 0;
+	gpu_profiler = false;
+	gpu_profiler_output = "gpu_profile.csv";
+	headless = false;
+	headless_frame_count = 1000;
+	benchmark = false;
+	benchmark_camera_path = "";
+	benchmark_timestep = 1.0f / 60.0f;
+	benchmark_warmup_frames = 120;
+	benchmark_measured_frames = 1000;
+	benchmark_seed = 1;
+	benchmark_report = "benchmark.json";
+	import_benchmark_iterations = 0;
+	texture_mipmaps = true;
+	texture_compression = true;
+	mesh_optimization = true;
+	model_stats = false;
+	meshlet_culling = false;
 }
\ No newline at end of file
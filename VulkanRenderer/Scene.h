@@ -37,4 +37,23 @@ public:
 	int light_num;
 	glm::vec3 camera_position;
 	glm::quat camera_rotation;
+	int frames_in_flight;
+	int cluster_depth_slices; // 0 for 2D tiled light culling, otherwise the number of exponential depth slices per tile
+	bool gpu_profiler; // time the render passes with gpu queries
+	std::string gpu_profiler_output; // report written on exit, .json or .csv
+	bool headless; // render offscreen without a window or VK_KHR_surface
+	int headless_frame_count; // frames rendered before a headless run exits
+	bool benchmark; // scripted camera and fixed timestep instead of input and wall clock, writes a frame time report
+	std::string benchmark_camera_path; // camera keyframes, empty keeps the scene's camera still
+	float benchmark_timestep;
+	int benchmark_warmup_frames;
+	int benchmark_measured_frames;
+	unsigned int benchmark_seed; // for the light placement
+	std::string benchmark_report;
+	int import_benchmark_iterations; // 0 to skip, otherwise time the obj importers on model_file before loading it
+	bool texture_mipmaps; // full mip chains for the model's textures, off to compare the forward pass against level 0 only
+	bool texture_compression; // BC1/BC3/BC5 textures cooked next to their sources, rgba8 when off or unsupported
+	bool mesh_optimization; // reorder triangles and vertices for the vertex cache and overdraw at import, off to compare obj order
+	bool model_stats; // print statistics of the model's import and buffers while loading it
+	bool meshlet_culling; // cull meshlets against the frustum and their normal cones before the depth pre-pass, off draws every triangle
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
-glslangValidator.exe -V forwardplus.vert -o ../../content/forwardplus_vert.spv
-glslangValidator.exe -V forwardplus.frag -o ../../content/forwardplus_frag.spv
-glslangValidator.exe -V light_culling.comp.glsl -o ../../content/light_culling_comp.spv -S comp
-glslangValidator.exe -V depth.vert -o ../../content/depth_vert.spv
+glslangValidator.exe -V forwardplus.vert -o forwardplus_vert.spv
+glslangValidator.exe -V forwardplus.frag -o forwardplus_frag.spv
+glslangValidator.exe -V light_culling.comp.glsl -o light_culling_comp.spv -S comp
+glslangValidator.exe -V depth.vert -o depth_vert.spv
+glslangValidator.exe -V meshlet_culling.comp.glsl -o meshlet_culling_comp.spv -S comp
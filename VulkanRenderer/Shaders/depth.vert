@@ -14,10 +14,16 @@ layout(std140, set = 1, binding = 0) uniform CameraUbo
     vec3 cam_pos;
 } camera;
 
+// scales the unorm position back into the mesh part's bounds
+layout(push_constant) uniform VertexPushConstantObject
+{
+    vec4 position_offset;
+    vec4 position_scale;
+} vertex_push_constants;
+
 layout(location = 0) in vec3 in_position;
-// layout(location = 1) in vec3 in_color;
+// layout(location = 1) in vec2 in_normal;
 // layout(location = 2) in vec2 in_tex_coord;
-// layout(location = 3) in vec3 in_normal;
 
 out gl_PerVertex
 {
@@ -30,5 +36,6 @@ void main()
     //todo: calculate them in cpu...
     mat4 mvp = camera.projview * transform.model;
 
-    gl_Position = mvp * vec4(in_position, 1.0);
+    vec3 position = vertex_push_constants.position_offset.xyz + in_position * vertex_push_constants.position_scale.xyz;
+    gl_Position = mvp * vec4(position, 1.0);
 }
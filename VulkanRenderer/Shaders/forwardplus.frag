@@ -3,22 +3,26 @@
 
 const int TILE_SIZE = 16;
 
+// must match the light culling shader, 0 for 2D tiled lookup
+layout(constant_id = 0) const int CLUSTER_DEPTH_SLICES = 0;
+
 struct PointLight {
 	vec3 pos;
 	float radius;
 	vec3 intensity;
 };
 
-#define MAX_POINT_LIGHT_PER_TILE 1023
-struct LightVisiblity
+// every tile (or cluster) owns light_indices[offset, offset + count)
+struct TileLightRange
 {
+	uint offset;
 	uint count;
-	uint lightindices[MAX_POINT_LIGHT_PER_TILE];
 };
 
+// after the vertex stage's VertexPushConstantObject
 layout(push_constant) uniform PushConstantObject
 {
-	ivec2 viewport_size;
+	layout(offset = 32) ivec2 viewport_size;
 	ivec2 tile_nums;
     int debugview_index;
 } push_constants;
@@ -41,7 +45,15 @@ layout(std140, set = 1, binding = 0) uniform readonly CameraUbo
 
 layout(std430, set = 2, binding = 0) buffer readonly TileLightVisiblities
 {
-    LightVisiblity light_visiblities[];
+    uint light_index_count;
+    uint light_index_capacity;
+    uvec2 padding;
+    TileLightRange tile_ranges[];
+};
+
+layout(std430, set = 2, binding = 2) buffer readonly LightIndexList
+{
+    uint light_indices[];
 };
 
 layout(std140, set = 2, binding = 1) uniform readonly PointLights 
@@ -61,7 +73,6 @@ layout(std140, set = 4, binding = 0) uniform MaterialUbo
 layout(set = 4, binding = 1) uniform sampler2D albedo_sampler;
 layout(set = 4, binding = 2) uniform sampler2D normal_sampler;
 
-layout(location = 0) in vec3 frag_color;
 layout(location = 1) in vec2 frag_tex_coord;
 layout(location = 2) in vec3 frag_normal;
 layout(location = 3) in vec3 frag_pos_world;
@@ -70,9 +81,12 @@ layout(location = 0) out vec4 out_color;
 
 layout(early_fragment_tests) in; // for early depth test
 
-vec3 applyNormalMap(vec3 geomnor, vec3 normap)
+vec3 applyNormalMap(vec3 geomnor, vec2 normap_xy)
 {
-    normap = normap * 2.0 - 1.0;
+    // only x and y are stored (BC5), z is positive in tangent space
+    vec3 normap;
+    normap.xy = normap_xy * 2.0 - 1.0;
+    normap.z = sqrt(max(0.0, 1.0 - dot(normap.xy, normap.xy)));
     vec3 up = normalize(vec3(0.001, 1, 0.001));
     vec3 surftan = normalize(cross(geomnor, up));
     vec3 surfbinor = cross(geomnor, surftan);
@@ -95,7 +109,7 @@ void main()
     vec3 normal;
     if (material.has_normal_map > 0)
     {
-        normal = applyNormalMap(frag_normal, texture(normal_sampler, frag_tex_coord).rgb);
+        normal = applyNormalMap(frag_normal, texture(normal_sampler, frag_tex_coord).rg);
     }
     else
     {
@@ -103,6 +117,16 @@ void main()
     }
     ivec2 tile_id = ivec2(gl_FragCoord.xy / TILE_SIZE);
     uint tile_index = tile_id.y * push_constants.tile_nums.x + tile_id.x;
+    if (CLUSTER_DEPTH_SLICES > 0)
+    {
+        // linear view depth of the fragment picks the exponential depth slice
+        float z_near = camera.proj[3][2] / camera.proj[2][2];
+        float z_far = camera.proj[3][2] / (camera.proj[2][2] + 1.0);
+        float view_depth = z_near * z_far / (z_far - gl_FragCoord.z * (z_far - z_near));
+        int slice = clamp(int(log(view_depth / z_near) / log(z_far / z_near) * CLUSTER_DEPTH_SLICES), 0, CLUSTER_DEPTH_SLICES - 1);
+        tile_index += slice * push_constants.tile_nums.x * push_constants.tile_nums.y;
+    }
+    TileLightRange tile_range = tile_ranges[tile_index];
 
     // debug view
     if (push_constants.debugview_index > 1)
@@ -110,7 +134,7 @@ void main()
         if (push_constants.debugview_index == 2)
         {
 			//heat map debug view
-			float intensity = float(light_visiblities[tile_index].count) / 64;
+			float intensity = float(tile_range.count) / 64;
             out_color = vec4(vec3(intensity), 1.0) ; //light culling debug
 			//out_color = vec4(vec3(intensity * 0.62, intensity * 0.13, intensity * 0.94), 1.0) ; //light culling debug
 			//float minimum = 0.0;
@@ -137,10 +161,9 @@ void main()
 
 
     vec3 illuminance = vec3(0.0);
-    uint tile_light_num = light_visiblities[tile_index].count;
-    for (int i = 0; i < tile_light_num; i++)
+    for (uint i = tile_range.offset; i < tile_range.offset + tile_range.count; i++)
 	{
-        PointLight light = pointlights[light_visiblities[tile_index].lightindices[i]];
+        PointLight light = pointlights[light_indices[i]];
 		vec3 light_dir = normalize(light.pos - frag_pos_world);
         float lambertian = max(dot(light_dir, normal), 0.0);
 
@@ -165,7 +188,7 @@ void main()
     //heat map with render debug view
     if (push_constants.debugview_index == 1)
     {
-        float intensity = float(light_visiblities[tile_index].count) / (64 / 2.0);
+        float intensity = float(tile_range.count) / (64 / 2.0);
         out_color = vec4(vec3(intensity, intensity * 0.5, intensity * 0.5) + illuminance * 0.25, 1.0) ; //light culling debug
         return;
     }
@@ -174,7 +197,7 @@ void main()
     out_color = vec4(illuminance, 1.0);
 
     //out_color = vec4(0.0, 0.0, 0.0, 1.0);
-    //out_color[light_visiblities[tile_index].count] = 1.0;
+    //out_color[tile_range.count] = 1.0;
     //out_color = vec4(illuminance, 1.0);
     //out_color = vec4(abs(normal), 1.0);
     //out_color = vec4(abs(texture(normal_sampler, frag_tex_coord).rgb), 1.0); // normal map debug view
@@ -14,12 +14,17 @@ layout(std140, set = 1, binding = 0) uniform CameraUbo
     vec3 cam_pos;
 } camera;
 
+// scales the unorm position back into the mesh part's bounds
+layout(push_constant) uniform VertexPushConstantObject
+{
+    vec4 position_offset;
+    vec4 position_scale;
+} vertex_push_constants;
+
 layout(location = 0) in vec3 in_position;
-layout(location = 1) in vec3 in_color;
+layout(location = 1) in vec2 in_normal; // octahedral
 layout(location = 2) in vec2 in_tex_coord;
-layout(location = 3) in vec3 in_normal;
 
-layout(location = 0) out vec3 frag_color;
 layout(location = 1) out vec2 frag_tex_coord;
 layout(location = 2) out vec3 frag_normal;
 layout(location = 3) out vec3 frag_pos_world;
@@ -29,17 +34,26 @@ out gl_PerVertex
     vec4 gl_Position;
 };
 
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-normal.z, 0.0);
+    normal.x += normal.x >= 0.0 ? -fold : fold;
+    normal.y += normal.y >= 0.0 ? -fold : fold;
+    return normalize(normal);
+}
+
 void main()
 {
-    
+    vec3 position = vertex_push_constants.position_offset.xyz + in_position * vertex_push_constants.position_scale.xyz;
+
     mat4 invtransmodel =  transpose(inverse(transform.model));
     mat4 mvp = camera.projview * transform.model;
 
-    gl_Position = mvp * vec4(in_position, 1.0);
-    frag_color = in_color;
+    gl_Position = mvp * vec4(position, 1.0);
     frag_tex_coord = in_tex_coord;
 
     // TODO: do everything view or projection space
-    frag_normal = normalize((invtransmodel * vec4(in_normal, 0.0)).xyz);
-    frag_pos_world = vec3(transform.model * vec4(in_position, 1.0));
+    frag_normal = normalize((invtransmodel * vec4(decodeOctahedral(in_normal), 0.0)).xyz);
+    frag_pos_world = vec3(transform.model * vec4(position, 1.0));
 }
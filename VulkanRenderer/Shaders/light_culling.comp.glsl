@@ -4,17 +4,21 @@
 
 const int TILE_SIZE = 16;
 
+// 0 for 2D tiled culling, otherwise every tile is split into this many exponential depth slices (clusters)
+// and one workgroup culls one cluster, gl_WorkGroupID.z being the slice
+layout(constant_id = 0) const int CLUSTER_DEPTH_SLICES = 0;
+
 struct PointLight {
 	vec3 pos;
 	float radius;
 	vec3 intensity;
 };
 
-#define MAX_POINT_LIGHT_PER_TILE 1023
-struct LightVisiblity
+// every tile (or cluster) owns light_indices[offset, offset + count)
+struct TileLightRange
 {
+	uint offset;
 	uint count;
-	uint lightindices[MAX_POINT_LIGHT_PER_TILE];
 };
 
 layout(push_constant) uniform PushConstantObject
@@ -23,9 +27,17 @@ layout(push_constant) uniform PushConstantObject
 	ivec2 tile_nums;
 } push_constants;
 
-layout(std430, set = 0, binding = 0) buffer writeonly TileLightVisiblities
+layout(std430, set = 0, binding = 0) buffer TileLightVisiblities
 {
-    LightVisiblity light_visiblities[];
+	uint light_index_count; // indices requested by all tiles this frame, may exceed the capacity
+	uint light_index_capacity;
+	uvec2 padding;
+	TileLightRange tile_ranges[];
+};
+
+layout(std430, set = 0, binding = 2) buffer writeonly LightIndexList
+{
+	uint light_indices[];
 };
 
 layout(std140, set = 0, binding = 1) uniform  PointLights
@@ -44,148 +56,153 @@ layout(std140, set = 1, binding = 0) uniform  CameraUbo
 
 layout(set = 2, binding = 0) uniform sampler2D depth_sampler;
 
-// vulkan ndc, minDepth = 0.0, maxDepth = 1.0
-const vec2 ndc_upper_left = vec2(-1.0, -1.0);
-const float ndc_near_plane = 0.0;
-const float ndc_far_plane = 1.0;
+// view space side planes of every tile, built on the cpu whenever the projection or the tile grid changes
+struct TileFrustum
+{
+	vec4 planes[4]; // xyz inward normal, all planes pass through the camera
+};
 
-struct ViewFrustum
+layout(std430, set = 0, binding = 3) buffer readonly TileFrustums
 {
-	vec4 planes[6];
-	vec3 points[8]; // 0-3 near 4-7 far
+	TileFrustum tile_frustums[];
 };
 
 layout(local_size_x = 32) in;
 
-shared ViewFrustum frustum;
+// lights of this tile are gathered here first, then copied into the reserved range of the global list
+#define SHARED_LIGHT_LIST_SIZE 1024
+shared uint tile_light_list[SHARED_LIGHT_LIST_SIZE];
+
+shared vec4 tile_planes[4];
 shared uint light_count_for_tile;
+shared uint light_offset_for_tile;
+shared uint stored_light_count_for_tile;
+shared uint light_write_cursor;
 shared float min_depth;
 shared float max_depth;
-
-// Construct view frustum
-ViewFrustum createFrustum(ivec2 tile_id)
+// depth bounds of the tile as view space distances in front of the camera
+shared float min_view_depth;
+shared float max_view_depth;
+// depth is in [0, 1] so the bit patterns of the floats sort like the floats, which allows integer atomics
+shared uint min_depth_bits;
+shared uint max_depth_bits;
+shared bool cluster_empty;
+
+// view space distance in front of the camera of a point at ndc depth
+float depthToViewDistance(float depth)
 {
+	return camera.proj[3][2] / (depth + camera.proj[2][2]);
+}
 
-	mat4 inv_projview = inverse(camera.projview);
-
-	vec2 ndc_size_per_tile = 2.0 * vec2(TILE_SIZE, TILE_SIZE) / push_constants.viewport_size;
-
-	vec2 ndc_pts[4];  // corners of tile in ndc
-	ndc_pts[0] = ndc_upper_left + tile_id * ndc_size_per_tile;  // upper left
-	ndc_pts[1] = vec2(ndc_pts[0].x + ndc_size_per_tile.x, ndc_pts[0].y); // upper right
-	ndc_pts[2] = ndc_pts[0] + ndc_size_per_tile;
-	ndc_pts[3] = vec2(ndc_pts[0].x, ndc_pts[0].y + ndc_size_per_tile.y); // lower left
-
-	ViewFrustum frustum;
+// view space distances bounding an exponential depth slice between the camera's near and far plane
+vec2 clusterSliceViewRange(uint slice)
+{
+	float z_near = depthToViewDistance(0.0);
+	float z_far = depthToViewDistance(1.0);
+	return z_near * pow(vec2(z_far / z_near), vec2(slice, slice + 1) / CLUSTER_DEPTH_SLICES);
+}
 
-	vec4 temp;
-	for (int i = 0; i < 4; i++)
+// sphere test against the tile's side planes and depth bounds, light_pos is in view space
+bool isCollided(vec3 light_pos, float radius)
+{
+	float light_depth = -light_pos.z; // camera looks down -z
+	if (light_depth + radius < min_view_depth || light_depth - radius > max_view_depth)
 	{
-		temp = inv_projview * vec4(ndc_pts[i], min_depth, 1.0);
-		frustum.points[i] = temp.xyz / temp.w;
-		temp = inv_projview * vec4(ndc_pts[i], max_depth, 1.0);
-		frustum.points[i + 4] = temp.xyz / temp.w;
+		return false;
 	}
 
-	vec3 temp_normal;
 	for (int i = 0; i < 4; i++)
 	{
-		//Cax+Cby+Ccz+Cd = 0, planes[i] = (Ca, Cb, Cc, Cd)
-		// temp_normal: normal without normalization
-		temp_normal = cross(frustum.points[i] - camera.cam_pos, frustum.points[i + 1] - camera.cam_pos);
-		temp_normal = normalize(temp_normal);
-		frustum.planes[i] = vec4(temp_normal, - dot(temp_normal, frustum.points[i]));
-	}
-	// near plane
-	{
-		temp_normal = cross(frustum.points[1] - frustum.points[0], frustum.points[3] - frustum.points[0]);
-		temp_normal = normalize(temp_normal);
-		frustum.planes[4] = vec4(temp_normal, - dot(temp_normal, frustum.points[0]));
-	}
-	// far plane
-	{
-		temp_normal = cross(frustum.points[7] - frustum.points[4], frustum.points[5] - frustum.points[4]);
-		temp_normal = normalize(temp_normal);
-		frustum.planes[5] = vec4(temp_normal, - dot(temp_normal, frustum.points[4]));
-	}
-
-	return frustum;
-}
-
-bool isCollided(PointLight light, ViewFrustum frustum)
-{
-	bool result = true;
-
-    // Step1: sphere-plane test
-	for (int i = 0; i < 6; i++)
-	{
-		if (dot(light.pos, frustum.planes[i].xyz) + frustum.planes[i].w  < - light.radius )
+		if (dot(light_pos, tile_planes[i].xyz) < - radius)
 		{
-			result = false;
-			break;
+			return false;
 		}
 	}
 
-    if (!result)
-    {
-        return false;
-    }
-
-    // Step2: bbox corner test (to reduce false positive)
-    vec3 light_bbox_max = light.pos + vec3(light.radius);
-    vec3 light_bbox_min = light.pos - vec3(light.radius);
-    int probe;
-    probe=0; for( int i=0; i<8; i++ ) probe += ((frustum.points[i].x > light_bbox_max.x)?1:0); if( probe==8 ) return false;
-    probe=0; for( int i=0; i<8; i++ ) probe += ((frustum.points[i].x < light_bbox_min.x)?1:0); if( probe==8 ) return false;
-    probe=0; for( int i=0; i<8; i++ ) probe += ((frustum.points[i].y > light_bbox_max.y)?1:0); if( probe==8 ) return false;
-    probe=0; for( int i=0; i<8; i++ ) probe += ((frustum.points[i].y < light_bbox_min.y)?1:0); if( probe==8 ) return false;
-    probe=0; for( int i=0; i<8; i++ ) probe += ((frustum.points[i].z > light_bbox_max.z)?1:0); if( probe==8 ) return false;
-    probe=0; for( int i=0; i<8; i++ ) probe += ((frustum.points[i].z < light_bbox_min.z)?1:0); if( probe==8 ) return false;
-
 	return true;
 }
 
 void main()
 {
 	ivec2 tile_id = ivec2(gl_WorkGroupID.xy);
-	uint tile_index = tile_id.y * push_constants.tile_nums.x + tile_id.x;
+	// clusters of one slice are laid out like the tiles, slice after slice
+	uint tile_index = (gl_WorkGroupID.z * push_constants.tile_nums.y + tile_id.y) * push_constants.tile_nums.x + tile_id.x;
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		min_depth_bits = floatBitsToUint(1.0);
+		max_depth_bits = floatBitsToUint(0.0);
+		light_count_for_tile = 0;
+		cluster_empty = false;
+	}
+
+	barrier();
 
-	// TODO: depth culling???
+	// every invocation reduces TILE_SIZE * TILE_SIZE / gl_WorkGroupSize.x samples, neighbouring invocations read neighbouring texels
+	float local_min_depth = 1.0;
+	float local_max_depth = 0.0;
+	for (uint i = gl_LocalInvocationIndex; i < TILE_SIZE * TILE_SIZE; i += gl_WorkGroupSize.x)
+	{
+		ivec2 texel = TILE_SIZE * tile_id + ivec2(i % TILE_SIZE, i / TILE_SIZE);
+		texel = min(texel, push_constants.viewport_size - 1); // tiles on the right and bottom edges may be partial
+		float pre_depth = texelFetch(depth_sampler, texel, 0).x;
+		local_min_depth = min(local_min_depth, pre_depth);
+		local_max_depth = max(local_max_depth, pre_depth);
+	}
+	atomicMin(min_depth_bits, floatBitsToUint(local_min_depth));
+	atomicMax(max_depth_bits, floatBitsToUint(local_max_depth));
+
+	barrier();
 
 	if (gl_LocalInvocationIndex == 0)
 	{
-		min_depth = 1.0;
-		max_depth = 0.0;
+		min_depth = uintBitsToFloat(min_depth_bits);
+		max_depth = uintBitsToFloat(max_depth_bits);
 
-		for (int y = 0; y < TILE_SIZE; y++)
+		if (min_depth >= max_depth)
 		{
-			for (int x = 0; x < TILE_SIZE; x++)
-			{
-				vec2 sample_loc = (vec2(TILE_SIZE, TILE_SIZE) * tile_id + vec2(x, y) ) / push_constants.viewport_size;
-				float pre_depth = texture(depth_sampler, sample_loc).x;
-				min_depth = min(min_depth, pre_depth);
-				max_depth = max(max_depth, pre_depth); //TODO: parallize this
-			}
+			min_depth = max_depth;
 		}
 
-		if (min_depth >= max_depth)
+		min_view_depth = depthToViewDistance(min_depth);
+		max_view_depth = depthToViewDistance(max_depth);
+
+		if (CLUSTER_DEPTH_SLICES > 0)
 		{
-			min_depth = max_depth;
+			// tighten the cluster to the geometry of its tile, a slice that holds no geometry needs no lights
+			vec2 slice_range = clusterSliceViewRange(gl_WorkGroupID.z);
+			cluster_empty = max_view_depth < slice_range.x || min_view_depth > slice_range.y;
+			min_view_depth = max(min_view_depth, slice_range.x);
+			max_view_depth = min(max_view_depth, slice_range.y);
 		}
+	}
 
-		frustum = createFrustum(tile_id);
-		light_count_for_tile = 0;
+	if (gl_LocalInvocationIndex < 4)
+	{
+		tile_planes[gl_LocalInvocationIndex] = tile_frustums[tile_id.y * push_constants.tile_nums.x + tile_id.x].planes[gl_LocalInvocationIndex];
 	}
 
 	barrier();
 
-	for (uint i = gl_LocalInvocationIndex; i < light_num && light_count_for_tile < MAX_POINT_LIGHT_PER_TILE; i += gl_WorkGroupSize.x)
+	if (cluster_empty)
 	{
-		if (isCollided(pointlights[i], frustum))
+		if (gl_LocalInvocationIndex == 0)
+		{
+			tile_ranges[tile_index] = TileLightRange(0, 0);
+		}
+		return;
+	}
+
+	for (uint i = gl_LocalInvocationIndex; i < light_num; i += gl_WorkGroupSize.x)
+	{
+		vec3 light_pos = (camera.view * vec4(pointlights[i].pos, 1.0)).xyz;
+		if (isCollided(light_pos, pointlights[i].radius))
 		{
 			uint slot = atomicAdd(light_count_for_tile, 1);
-			if (slot >= MAX_POINT_LIGHT_PER_TILE) {break;}
-			light_visiblities[tile_index].lightindices[slot] = i;
+			if (slot < SHARED_LIGHT_LIST_SIZE)
+			{
+				tile_light_list[slot] = i;
+			}
 		}
 	}
 
@@ -193,6 +210,38 @@ void main()
 
 	if (gl_LocalInvocationIndex == 0)
 	{
-		light_visiblities[tile_index].count = min(MAX_POINT_LIGHT_PER_TILE, light_count_for_tile);
+		// reserve a contiguous range of the packed list, whatever does not fit is dropped and the cpu grows the list
+		light_offset_for_tile = atomicAdd(light_index_count, light_count_for_tile);
+		uint available = light_index_capacity > light_offset_for_tile ? light_index_capacity - light_offset_for_tile : 0;
+		stored_light_count_for_tile = min(light_count_for_tile, available);
+		light_write_cursor = 0;
+
+		tile_ranges[tile_index] = TileLightRange(light_offset_for_tile, stored_light_count_for_tile);
+	}
+
+	barrier();
+
+	if (light_count_for_tile <= SHARED_LIGHT_LIST_SIZE)
+	{
+		for (uint i = gl_LocalInvocationIndex; i < stored_light_count_for_tile; i += gl_WorkGroupSize.x)
+		{
+			light_indices[light_offset_for_tile + i] = tile_light_list[i];
+		}
+	}
+	else
+	{
+		// too many lights for shared memory, cull again and write straight into the global list
+		for (uint i = gl_LocalInvocationIndex; i < light_num; i += gl_WorkGroupSize.x)
+		{
+			vec3 light_pos = (camera.view * vec4(pointlights[i].pos, 1.0)).xyz;
+			if (isCollided(light_pos, pointlights[i].radius))
+			{
+				uint slot = atomicAdd(light_write_cursor, 1);
+				if (slot < stored_light_count_for_tile)
+				{
+					light_indices[light_offset_for_tile + slot] = i;
+				}
+			}
+		}
 	}
 }
@@ -0,0 +1,159 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// one workgroup per meshlet: the first invocation tests its bounding sphere against the view frustum and its normal
+// cone against the camera, then the indices of a visible meshlet are copied into its part's range of the culled index
+// buffer and counted in the part's indirect draw. the test runs in object space, the planes and the camera are
+// brought into it rather than every meshlet out of it
+
+struct Meshlet
+{
+	vec4 sphere; // center, radius
+	vec4 cone_apex; // w is the cone's cutoff, 1 never culls
+	vec4 cone_axis;
+	uint first_index; // in source_indices, counted in indices of the part's index type
+	uint index_count;
+	uint part_index;
+	uint padding;
+};
+
+// VkDrawIndexedIndirectCommand, then where the part's culled indices go
+struct DrawCommand
+{
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+	uint culled_index_word;
+	uint index_16_bit;
+	uint padding;
+};
+
+layout(push_constant) uniform PushConstantObject
+{
+	uint meshlet_count;
+} push_constants;
+
+layout(std140, set = 0, binding = 0) uniform SceneObjectUbo
+{
+	mat4 model;
+} transform;
+
+layout(std430, set = 0, binding = 1) buffer readonly Meshlets
+{
+	Meshlet meshlets[];
+};
+
+// the model buffer, two 16 bit indices share a word
+layout(std430, set = 0, binding = 2) buffer readonly SourceIndices
+{
+	uint source_indices[];
+};
+
+layout(std430, set = 0, binding = 3) buffer writeonly CulledIndices
+{
+	uint culled_indices[];
+};
+
+layout(std430, set = 0, binding = 4) buffer DrawCommands
+{
+	DrawCommand draw_commands[];
+};
+
+layout(std140, set = 1, binding = 0) uniform CameraUbo
+{
+	mat4 view;
+	mat4 proj;
+	mat4 projview;
+	vec3 cam_pos;
+} camera;
+
+layout(local_size_x = 64) in;
+
+shared bool meshlet_visible;
+shared uint culled_index_offset; // of the meshlet within its part's range, in indices
+
+uint readIndex(uint index, bool index_16_bit)
+{
+	if (!index_16_bit)
+	{
+		return source_indices[index];
+	}
+	uint word = source_indices[index >> 1u];
+	return (index & 1u) != 0u ? word >> 16u : word & 0xffffu;
+}
+
+bool isVisible(Meshlet meshlet)
+{
+	// the rows of projview * model combine into the clip planes in object space, with x and y in [-w, w] and z in [0, w]
+	mat4 rows = transpose(camera.projview * transform.model);
+	vec4 planes[6] = vec4[](rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2], rows[3] - rows[2]);
+	for (int i = 0; i < 6; i++)
+	{
+		if (dot(planes[i].xyz, meshlet.sphere.xyz) + planes[i].w < -meshlet.sphere.w * length(planes[i].xyz))
+		{
+			return false;
+		}
+	}
+
+	// a camera inside the cone only sees back faces
+	vec3 camera_position = (inverse(transform.model) * vec4(camera.cam_pos, 1.0)).xyz;
+	return !(dot(normalize(meshlet.cone_apex.xyz - camera_position), meshlet.cone_axis.xyz) > meshlet.cone_apex.w);
+}
+
+void main()
+{
+	// the meshlets wrap into a second dimension when there are more than a dispatch allows in one
+	uint meshlet_index = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+	if (meshlet_index >= push_constants.meshlet_count)
+	{
+		return;
+	}
+
+	Meshlet meshlet = meshlets[meshlet_index];
+	bool index_16_bit = draw_commands[meshlet.part_index].index_16_bit != 0u;
+
+	// 16 bit indices are written in pairs, so an odd triangle count gets a degenerate triangle repeating the last index
+	uint culled_index_count = meshlet.index_count;
+	if (index_16_bit && (meshlet.index_count & 1u) != 0u)
+	{
+		culled_index_count += 3u;
+	}
+
+	if (gl_LocalInvocationIndex == 0u)
+	{
+		meshlet_visible = isVisible(meshlet);
+		if (meshlet_visible)
+		{
+			culled_index_offset = atomicAdd(draw_commands[meshlet.part_index].index_count, culled_index_count);
+		}
+	}
+
+	barrier();
+
+	if (!meshlet_visible)
+	{
+		return;
+	}
+
+	uint first_word = draw_commands[meshlet.part_index].culled_index_word;
+	if (index_16_bit)
+	{
+		first_word += culled_index_offset / 2u;
+		for (uint i = gl_LocalInvocationIndex; i < culled_index_count / 2u; i += gl_WorkGroupSize.x)
+		{
+			uint low = readIndex(meshlet.first_index + min(2u * i, meshlet.index_count - 1u), true);
+			uint high = readIndex(meshlet.first_index + min(2u * i + 1u, meshlet.index_count - 1u), true);
+			culled_indices[first_word + i] = low | (high << 16u);
+		}
+	}
+	else
+	{
+		first_word += culled_index_offset;
+		for (uint i = gl_LocalInvocationIndex; i < culled_index_count; i += gl_WorkGroupSize.x)
+		{
+			culled_indices[first_word + i] = readIndex(meshlet.first_index + i, false);
+		}
+	}
+}
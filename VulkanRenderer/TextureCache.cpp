@@ -0,0 +1,174 @@
+#include "TextureCache.h"
+#include "Utilities.h"
+
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+
+namespace
+{
+	// the same file reached through different relative paths shares a key, without touching the disk
+	std::string normalizePath(const std::string& path)
+	{
+		return std::filesystem::path(path).lexically_normal().generic_string();
+	}
+}
+
+VTextureCache::VTextureCache(bool mip_mapped, bool compressed)
+	: mip_mapped(mip_mapped)
+	, compressed(compressed)
+{
+}
+
+std::vector<std::shared_ptr<VTexture>> VTextureCache::acquire(VUtility& utility, const std::vector<std::string>& paths, const std::vector<VTextureKind>& kinds)
+{
+	if (paths.size() != kinds.size())
+	{
+		throw std::invalid_argument("a texture kind is needed for every path!");
+	}
+	removeExpired();
+	stats.requested += paths.size();
+
+	std::vector<std::shared_ptr<VTexture>> textures(paths.size());
+
+	// paths already loaded, by this or an earlier model. a path repeated within the batch is only looked at
+	// the first time and shares that request's texture
+	std::vector<std::pair<std::string, VTextureKind>> path_keys(paths.size());
+	std::vector<size_t> misses;
+	std::map<std::pair<std::string, VTextureKind>, size_t> batch_misses;
+	std::vector<std::pair<size_t, size_t>> repeats; // a request and the first one of its path
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		path_keys[i] = { normalizePath(paths[i]), kinds[i] };
+		auto cached = textures_by_path.find(path_keys[i]);
+		if (cached != textures_by_path.end() && (textures[i] = cached->second.lock()))
+		{
+			stats.path_hits++;
+			continue;
+		}
+
+		auto batch_miss = batch_misses.emplace(path_keys[i], i);
+		if (batch_miss.second)
+		{
+			misses.push_back(i);
+		}
+		else
+		{
+			repeats.push_back({ i, batch_miss.first->second });
+			stats.path_hits++;
+		}
+	}
+
+	// hashing only reads the files, which is far cheaper than decoding them. a file that cannot be read is
+	// left to the loader to report
+	std::vector<uint64_t> hashes(misses.size());
+	std::vector<char> hashed(misses.size(), 0);
+	Utilities::parallelFor(misses.size(), [&](size_t j)
+	{
+		try
+		{
+			VMappedFile source(paths[misses[j]]);
+			hashes[j] = Utilities::hashBytes(source.data(), source.size());
+			hashed[j] = 1;
+		}
+		catch (const std::runtime_error&)
+		{
+		}
+	});
+
+	// identical content, cached or repeated within this batch, is loaded once
+	std::map<std::pair<uint64_t, VTextureKind>, size_t> batch_loads;
+	std::vector<std::string> load_paths;
+	std::vector<VTextureKind> load_kinds;
+	std::vector<size_t> load_of_miss(misses.size());
+	for (size_t j = 0; j < misses.size(); j++)
+	{
+		auto i = misses[j];
+		std::pair<uint64_t, VTextureKind> content_key = { hashes[j], kinds[i] };
+		if (hashed[j])
+		{
+			auto cached = textures_by_content.find(content_key);
+			if (cached != textures_by_content.end() && (textures[i] = cached->second.lock()))
+			{
+				textures_by_path[path_keys[i]] = textures[i];
+				stats.content_hits++;
+				continue;
+			}
+
+			auto batch_load = batch_loads.find(content_key);
+			if (batch_load != batch_loads.end())
+			{
+				load_of_miss[j] = batch_load->second;
+				stats.content_hits++;
+				continue;
+			}
+			batch_loads[content_key] = load_paths.size();
+		}
+
+		load_of_miss[j] = load_paths.size();
+		load_paths.push_back(paths[i]);
+		load_kinds.push_back(kinds[i]);
+	}
+
+	auto images = utility.loadImagesFromFiles(load_paths, load_kinds, mip_mapped, compressed);
+	std::vector<std::shared_ptr<VTexture>> loaded(images.size());
+	for (size_t k = 0; k < images.size(); k++)
+	{
+		loaded[k] = std::make_shared<VTexture>();
+		loaded[k]->image = std::move(std::get<0>(images[k]));
+		loaded[k]->image_memory = std::move(std::get<1>(images[k]));
+		loaded[k]->image_view = std::move(std::get<2>(images[k]));
+	}
+	stats.loaded += loaded.size();
+
+	for (size_t j = 0; j < misses.size(); j++)
+	{
+		auto i = misses[j];
+		if (textures[i])
+		{
+			continue;
+		}
+		textures[i] = loaded[load_of_miss[j]];
+		textures_by_path[path_keys[i]] = textures[i];
+		if (hashed[j])
+		{
+			textures_by_content[{ hashes[j], kinds[i] }] = textures[i];
+		}
+	}
+	for (const auto& repeat : repeats)
+	{
+		textures[repeat.first] = textures[repeat.second];
+	}
+
+	return textures;
+}
+
+size_t VTextureCache::getTextureCount() const
+{
+	size_t count = 0;
+	for (const auto& entry : textures_by_content)
+	{
+		count += entry.second.expired() ? 0 : 1;
+	}
+	return count;
+}
+
+void VTextureCache::printStats(std::ostream& stream) const
+{
+	stream << "Textures: " << stats.requested << " requested, " << stats.path_hits << " shared by path, "
+		<< stats.content_hits << " shared by content, " << stats.loaded << " loaded, "
+		<< getTextureCount() << " alive" << std::endl;
+}
+
+void VTextureCache::removeExpired()
+{
+	for (auto it = textures_by_path.begin(); it != textures_by_path.end();)
+	{
+		it = it->second.expired() ? textures_by_path.erase(it) : std::next(it);
+	}
+	for (auto it = textures_by_content.begin(); it != textures_by_content.end();)
+	{
+		it = it->second.expired() ? textures_by_content.erase(it) : std::next(it);
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "VulkanRaii.h"
+#include "CookedTexture.h"
+
+#include <vulkan/vulkan.h>
+
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class VUtility;
+
+// an uploaded texture, shared by every material that samples it
+struct VTexture
+{
+	VulkanRaii<VkImage> image;
+	VulkanRaii<VkDeviceMemory> image_memory;
+	VulkanRaii<VkImageView> image_view;
+};
+
+/**
+* textures by source path and by content hash, so a file referenced by several materials, or copies of the same file,
+* are uploaded once. handles are reference counted and the cache only keeps weak references, a texture is released
+* with the last model using it. the same file loaded as another kind is a different texture
+*/
+class VTextureCache
+{
+public:
+	struct Stats
+	{
+		size_t requested = 0;
+		size_t path_hits = 0;
+		size_t content_hits = 0;
+		size_t loaded = 0;
+	};
+
+	// the settings every texture of the cache is loaded with
+	VTextureCache(bool mip_mapped, bool compressed);
+
+	// a texture for each path, in order. the ones not in the cache are loaded as one batch through utility,
+	// whose uploads still have to be submitted before the textures are used
+	std::vector<std::shared_ptr<VTexture>> acquire(VUtility& utility, const std::vector<std::string>& paths, const std::vector<VTextureKind>& kinds);
+
+	// totals since the cache was created
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	size_t getTextureCount() const; // textures still alive
+	void printStats(std::ostream& stream) const;
+
+private:
+	void removeExpired();
+
+	bool mip_mapped;
+	bool compressed;
+
+	std::map<std::pair<std::string, VTextureKind>, std::weak_ptr<VTexture>> textures_by_path;
+	std::map<std::pair<uint64_t, VTextureKind>, std::weak_ptr<VTexture>> textures_by_content;
+	Stats stats;
+};
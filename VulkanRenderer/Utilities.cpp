@@ -1,43 +1,341 @@
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "Utilities.h"
 
 #include "VulkanApplication.h"
 #include "Model.h"
+#include "DeviceMemoryAllocator.h"
+#include "BlockCompression.h"
+#include "CookedTexture.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-VkVertexInputBindingDescription Utilities::getVertexBindingDesciption()
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
+uint64_t Utilities::hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	// 8 bytes per step, multiply-rotate mixing in the spirit of xxhash/wyhash
+	const uint64_t prime_a = 0x9e3779b185ebca87ull;
+	const uint64_t prime_b = 0xc2b2ae3d27d4eb4full;
+	auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+
+	auto bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed ^ (size * prime_a);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = rotl(hash ^ (word * prime_b), 31) * prime_a;
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, bytes + i, size - i);
+	hash = rotl(hash ^ (tail * prime_b), 31) * prime_a;
+
+	// final avalanche
+	hash ^= hash >> 33;
+	hash *= prime_b;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+int64_t Utilities::getFileModificationTime(const std::string& path)
+{
+	std::error_code error;
+	auto time = std::filesystem::last_write_time(path, error);
+	return error ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+}
+
+bool Utilities::getSourceKey(const std::string& path, uint64_t& size, int64_t& mtime, uint64_t& hash)
 {
-	VkVertexInputBindingDescription binding_description = {};
-	binding_description.binding = 0; // index of the binding, defined in vertex shader
-	binding_description.stride = sizeof(Vertex);
-	binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // move to next data engty after each vertex
-	return binding_description;
+	mtime = getFileModificationTime(path);
+	try
+	{
+		VMappedFile source(path);
+		size = source.size();
+		hash = hashBytes(source.data(), source.size());
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
+	return true;
 }
 
-std::array<VkVertexInputAttributeDescription, 4> Utilities::getVertexAttributeDescriptions()
+bool Utilities::isSourceUnchanged(const std::string& path, uint64_t size, int64_t mtime, uint64_t hash)
 {
-	std::array<VkVertexInputAttributeDescription, 4> attr_descriptions = {};
-	attr_descriptions[0].binding = 0;
-	attr_descriptions[0].location = 0;
-	attr_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attr_descriptions[0].offset = offsetof(Vertex, pos); //bytes of a member since beginning of struct
-	attr_descriptions[1].binding = 0;
-	attr_descriptions[1].location = 1;
-	attr_descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attr_descriptions[1].offset = offsetof(Vertex, color); //bytes of a member since beginning of struct
-	attr_descriptions[2].binding = 0;
-	attr_descriptions[2].location = 2;
-	attr_descriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	attr_descriptions[2].offset = offsetof(Vertex, tex_coord);
-	// normal
-	attr_descriptions[3].binding = 0;
-	attr_descriptions[3].location = 3;
-	attr_descriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attr_descriptions[3].offset = offsetof(Vertex, normal);
+	std::error_code error;
+	auto source_size = std::filesystem::file_size(path, error);
+	if (error || source_size != size)
+	{
+		return false;
+	}
+	if (getFileModificationTime(path) == mtime)
+	{
+		return true;
+	}
 
-	return attr_descriptions;
+	try
+	{
+		VMappedFile source(path);
+		return hashBytes(source.data(), source.size()) == hash;
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
 }
 
+bool Utilities::writeFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& write_contents)
+{
+	auto temp_path = path + ".tmp";
+	std::error_code error;
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		write_contents(file);
+		if (!file.good())
+		{
+			file.close();
+			std::filesystem::remove(temp_path, error);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temp_path, path, error);
+	if (error)
+	{
+		std::filesystem::remove(temp_path, error);
+		return false;
+	}
+	return true;
+}
+
+uint32_t Utilities::getMipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t mip_levels = 1;
+	for (auto size = std::max(width, height); size > 1; size >>= 1)
+	{
+		mip_levels++;
+	}
+	return mip_levels;
+}
+
+VkDeviceSize Utilities::getImageLevelSize(VkFormat format, uint32_t width, uint32_t height)
+{
+	if (format == VK_FORMAT_R8G8B8A8_UNORM)
+	{
+		return static_cast<VkDeviceSize>(width) * height * 4;
+	}
+	VkDeviceSize block_count = static_cast<VkDeviceSize>((width + 3) / 4) * ((height + 3) / 4);
+	return block_count * BlockCompression::getBlockSize(format);
+}
+
+void Utilities::downsampleRgba8(const uint8_t* src, uint32_t src_width, uint32_t src_height, uint8_t* dst)
+{
+	uint32_t dst_width = std::max(1u, src_width / 2);
+	uint32_t dst_height = std::max(1u, src_height / 2);
+
+	// source texels a destination texel covers along one axis. an odd last row or column is folded into the last
+	// texel so the level stays aligned with the one above it, a size of 1 stays 1
+	auto getSpan = [](uint32_t i, uint32_t dst_size, uint32_t src_size)
+	{
+		if (src_size == 1) return 1u;
+		return (i + 1 == dst_size && src_size % 2 == 1) ? 3u : 2u;
+	};
+	// destination columns whose 2x2 source texels are all inside the image
+	uint32_t even_width = src_width % 2 == 1 ? dst_width - 1 : dst_width;
+
+	for (uint32_t y = 0; y < dst_height; y++)
+	{
+		uint32_t row_count = getSpan(y, dst_height, src_height);
+		const uint8_t* rows[3];
+		for (uint32_t r = 0; r < row_count; r++)
+		{
+			rows[r] = src + static_cast<size_t>(2 * y + r) * src_width * 4;
+		}
+		uint8_t* dst_row = dst + static_cast<size_t>(y) * dst_width * 4;
+
+		uint32_t x = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		// two destination texels from four source texels of each row, summed in 16 bits
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rounding = _mm_set1_epi16(2);
+		for (; row_count == 2 && x + 2 <= even_width; x += 2)
+		{
+			__m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[0] + 8 * x));
+			__m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[1] + 8 * x));
+
+			// texels 0 and 1, then 2 and 3, with their rows added
+			__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+			__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+			low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+			high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+
+			__m128i sum = _mm_unpacklo_epi64(low, high);
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(dst_row + 4 * x), _mm_packus_epi16(sum, zero));
+		}
+#endif
+		for (; x < dst_width; x++)
+		{
+			uint32_t column_count = getSpan(x, dst_width, src_width);
+			uint32_t texel_count = row_count * column_count;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				uint32_t sum = 0;
+				for (uint32_t r = 0; r < row_count; r++)
+				{
+					for (uint32_t i = 0; i < column_count; i++)
+					{
+						sum += rows[r][4 * (2 * x + i) + c];
+					}
+				}
+				dst_row[4 * x + c] = static_cast<uint8_t>((sum + texel_count / 2) / texel_count);
+			}
+		}
+	}
+}
+
+std::vector<uint8_t> Utilities::buildMipChainRgba8(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t mip_levels)
+{
+	size_t chain_size = 0;
+	for (uint32_t level = 0; level < mip_levels; level++)
+	{
+		chain_size += static_cast<size_t>(std::max(1u, width >> level)) * std::max(1u, height >> level) * 4;
+	}
+
+	std::vector<uint8_t> chain(chain_size);
+	memcpy(chain.data(), pixels, static_cast<size_t>(width) * height * 4);
+
+	size_t offset = 0;
+	for (uint32_t level = 1; level < mip_levels; level++)
+	{
+		uint32_t level_width = std::max(1u, width >> (level - 1));
+		uint32_t level_height = std::max(1u, height >> (level - 1));
+		size_t level_size = static_cast<size_t>(level_width) * level_height * 4;
+		downsampleRgba8(chain.data() + offset, level_width, level_height, chain.data() + offset + level_size);
+		offset += level_size;
+	}
+	return chain;
+}
+
+VMappedFile::VMappedFile(const std::string& path)
+{
+#ifdef _WIN32
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+	{
+		file_handle = nullptr;
+		throw std::runtime_error("Failed to open file " + path);
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file_handle, &size);
+	file_size = static_cast<size_t>(size.QuadPart);
+	if (file_size == 0)
+	{
+		return; // empty files cannot be mapped
+	}
+
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle != nullptr)
+	{
+		mapped = static_cast<const char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+	}
+#else
+	file_descriptor = open(path.c_str(), O_RDONLY);
+	if (file_descriptor < 0)
+	{
+		throw std::runtime_error("Failed to open file " + path);
+	}
+
+	struct stat file_stat;
+	fstat(file_descriptor, &file_stat);
+	file_size = static_cast<size_t>(file_stat.st_size);
+	if (file_size == 0)
+	{
+		return; // empty files cannot be mapped
+	}
+
+	void* address = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+	if (address != MAP_FAILED)
+	{
+		mapped = static_cast<const char*>(address);
+	}
+#endif
+
+	if (mapped == nullptr)
+	{
+		close();
+		throw std::runtime_error("Failed to map file " + path);
+	}
+}
+
+VMappedFile::~VMappedFile()
+{
+	close();
+}
+
+VMappedFile::VMappedFile(VMappedFile&& other)
+{
+	*this = std::move(other);
+}
+
+VMappedFile& VMappedFile::operator= (VMappedFile&& other)
+{
+	std::swap(mapped, other.mapped);
+	std::swap(file_size, other.file_size);
+#ifdef _WIN32
+	std::swap(file_handle, other.file_handle);
+	std::swap(mapping_handle, other.mapping_handle);
+#else
+	std::swap(file_descriptor, other.file_descriptor);
+#endif
+	return *this;
+}
+
+void VMappedFile::close()
+{
+#ifdef _WIN32
+	if (mapped) UnmapViewOfFile(mapped);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle) CloseHandle(file_handle);
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+#else
+	if (mapped) munmap(const_cast<char*>(mapped), file_size);
+	if (file_descriptor >= 0) ::close(file_descriptor);
+	file_descriptor = -1;
+#endif
+	mapped = nullptr;
+	file_size = 0;
+}
 
 uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties, VkPhysicalDevice physical_device)
 {
@@ -67,8 +365,19 @@ VUtility::VUtility(const VulkanApplication& context)
 	, present_queue(context.getPresentQueue())
 	, graphics_queue_command_pool(context.getGraphicsCommandPool())
 	, compute_queue_command_pool(context.getComputeCommandPool())
+	, transfer_queue(context.getTransferQueue())
+	, transfer_queue_command_pool(context.getTransferCommandPool())
+	, graphics_family(context.getQueueFamilyIndices().graphics_family)
+	, transfer_family(context.getQueueFamilyIndices().transfer_family)
+	, memory_allocator(context.getMemoryAllocator())
 {}
 
+VUtility::~VUtility()
+{
+	discardUploads();
+	waitUploads();
+}
+
 VkSurfaceFormatKHR VUtility::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& available_formats)
 {
 	// When free to choose format
@@ -181,22 +490,12 @@ std::tuple<VulkanRaii<VkBuffer>, VulkanRaii<VkDeviceMemory>> VUtility::createBuf
 	VkMemoryRequirements memory_req;
 	vkGetBufferMemoryRequirements(graphics_device, buffer, &memory_req);
 
-	VkMemoryAllocateInfo memory_alloc_info = {};
-	memory_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memory_alloc_info.allocationSize = memory_req.size;
-	memory_alloc_info.memoryTypeIndex = findMemoryType(memory_req.memoryTypeBits
-		, property_bits
-		, physical_device);
-
-	VkDeviceMemory buffer_memory;
-	auto memory_result = vkAllocateMemory(graphics_device, &memory_alloc_info, nullptr, &buffer_memory);
-	if (memory_result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate buffer memory!");
-	}
+	VulkanRaii<VkDeviceMemory> buffer_memory;
+	VkDeviceSize memory_offset;
+	std::tie(buffer_memory, memory_offset) = allocateMemory(memory_req, property_bits, false);
 
 	// bind buffer with memory
-	auto bind_result = vkBindBufferMemory(graphics_device, buffer, buffer_memory, 0);
+	auto bind_result = vkBindBufferMemory(graphics_device, buffer, buffer_memory.get(), memory_offset);
 	if (bind_result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to bind buffer memory!");
@@ -207,13 +506,7 @@ std::tuple<VulkanRaii<VkBuffer>, VulkanRaii<VkDeviceMemory>> VUtility::createBuf
 		device.destroyBuffer(obj);
 	};
 
-	auto raii_memory_deleter = [device = this->device](auto& obj)
-	{
-		device.freeMemory(obj);
-	};
-
-	return std::make_tuple(VulkanRaii<VkBuffer>(buffer, raii_buffer_deleter)
-		, VulkanRaii<VkDeviceMemory>(buffer_memory, raii_memory_deleter));
+	return std::make_tuple(VulkanRaii<VkBuffer>(buffer, raii_buffer_deleter), std::move(buffer_memory));
 }
 
 void VUtility::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size, VkDeviceSize src_offset, VkDeviceSize dst_offset)
@@ -227,7 +520,7 @@ void VUtility::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize
 
 std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>> VUtility::createImage(uint32_t image_width, uint32_t image_height
 	, VkFormat format, VkImageTiling tiling
-	, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties)
+	, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties, uint32_t mip_levels)
 {
 	VkImageCreateInfo image_info = {};
 	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -235,7 +528,7 @@ std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>> VUtility::createImag
 	image_info.extent.width = image_width;
 	image_info.extent.height = image_height;
 	image_info.extent.depth = 1;
-	image_info.mipLevels = 1;
+	image_info.mipLevels = mip_levels;
 	image_info.arrayLayers = 1;
 
 	image_info.format = format; //VK_FORMAT_R8G8B8A8_UNORM;
@@ -259,32 +552,53 @@ std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>> VUtility::createImag
 	VkMemoryRequirements memory_req;
 	vkGetImageMemoryRequirements(graphics_device, vkimage, &memory_req);
 
-	VkMemoryAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = memory_req.size;
-	alloc_info.memoryTypeIndex = findMemoryType(memory_req.memoryTypeBits
-		, memory_properties
+	VulkanRaii<VkDeviceMemory> memory;
+	VkDeviceSize memory_offset;
+	std::tie(memory, memory_offset) = allocateMemory(memory_req, memory_properties, tiling == VK_IMAGE_TILING_OPTIMAL);
+
+	vkBindImageMemory(graphics_device, vkimage, memory.get(), memory_offset);
+
+	auto raii_image_deleter = [device = this->device](auto& obj)
+	{
+		device.destroyImage(obj);
+	};
+
+	return std::make_tuple(VulkanRaii<VkImage>(vkimage, raii_image_deleter), std::move(memory));
+}
+
+std::tuple<VulkanRaii<VkDeviceMemory>, VkDeviceSize> VUtility::allocateMemory(const VkMemoryRequirements& memory_req, VkMemoryPropertyFlags property_bits, bool optimal_tiling)
+{
+	auto memory_type = findMemoryType(memory_req.memoryTypeBits
+		, property_bits
 		, physical_device);
 
-	VkDeviceMemory memory;
-	if (vkAllocateMemory(graphics_device, &alloc_info, nullptr, &memory) != VK_SUCCESS)
+	if (memory_allocator && !(property_bits & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
 	{
-		throw std::runtime_error("failed to allocate image memory!");
+		auto allocation = memory_allocator->allocate(memory_req, memory_type, optimal_tiling);
+		auto raii_allocation_deleter = [allocator = memory_allocator, allocation](auto&)
+		{
+			allocator->free(allocation);
+		};
+		return std::make_tuple(VulkanRaii<VkDeviceMemory>(allocation.memory, raii_allocation_deleter), allocation.offset);
 	}
 
-	vkBindImageMemory(graphics_device, vkimage, memory, 0);
+	VkMemoryAllocateInfo memory_alloc_info = {};
+	memory_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memory_alloc_info.allocationSize = memory_req.size;
+	memory_alloc_info.memoryTypeIndex = memory_type;
 
-	auto raii_image_deleter = [device = this->device](auto& obj)
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(graphics_device, &memory_alloc_info, nullptr, &memory) != VK_SUCCESS)
 	{
-		device.destroyImage(obj);
-	};
+		throw std::runtime_error("Failed to allocate device memory!");
+	}
 
 	auto raii_memory_deleter = [device = this->device](auto& obj)
 	{
 		device.freeMemory(obj);
 	};
 
-	return std::make_tuple(VulkanRaii<VkImage>(vkimage, raii_image_deleter), VulkanRaii<VkDeviceMemory>(memory, raii_memory_deleter));
+	return std::make_tuple(VulkanRaii<VkDeviceMemory>(memory, raii_memory_deleter), VkDeviceSize(0));
 }
 
 void VUtility::copyImage(VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height)
@@ -306,7 +620,7 @@ void VUtility::transitImageLayout(VkImage image, VkImageLayout old_layout, VkIma
 
 }
 
-void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view)
+void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view, uint32_t mip_levels)
 {
 	VkImageViewCreateInfo viewInfo = {};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -322,7 +636,7 @@ void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlag
 
 	viewInfo.subresourceRange.aspectMask = aspect_mask;
 	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.levelCount = mip_levels;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -333,77 +647,575 @@ void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlag
 }
 
 
-VulkanRaii<VkImageView> VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask)
+VulkanRaii<VkImageView> VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, uint32_t mip_levels)
 {
 	VkImageView img_view;
-	createImageView(image, format, aspect_mask, &img_view);
+	createImageView(image, format, aspect_mask, &img_view, mip_levels);
 	return VulkanRaii<VkImageView>(img_view, [device = this->device](auto& obj) {device.destroyImageView(obj); });
 }
 
 std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>, VulkanRaii<VkImageView>> VUtility::loadImageFromFile(std::string path)
 {
-	// TODO: maybe move to vulkan_util or a VulkanDevice class
+	auto images = loadImagesFromFiles({ path }, { VTextureKind::Color }, true, false);
+	submitUploads();
+	return std::move(images[0]);
+}
+
+bool VUtility::supportsSampledFormat(VkFormat format)
+{
+	VkFormatProperties format_properties;
+	vkGetPhysicalDeviceFormatProperties(physical_device, format, &format_properties);
+	const VkFormatFeatureFlags sampled_features = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (format_properties.optimalTilingFeatures & sampled_features) == sampled_features;
+}
+
+std::vector<std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>, VulkanRaii<VkImageView>>> VUtility::loadImagesFromFiles(const std::vector<std::string>& paths
+	, const std::vector<VTextureKind>& kinds, bool mip_mapped, bool compressed)
+{
+	struct PixelsDeleter
+	{
+		void operator()(stbi_uc* pixels) const
+		{
+			stbi_image_free(pixels);
+		}
+	};
+	using Pixels = std::unique_ptr<stbi_uc, PixelsDeleter>;
+	struct DecodedImage
+	{
+		size_t index;
+		VkFormat format;
+		uint32_t width;
+		uint32_t height;
+		const void* data; // null when the file could not be loaded
+		VkDeviceSize size;
+		uint32_t mip_levels; // levels in data, or 1 with a chain still to be blitted
+
+		// whichever holds data
+		Pixels pixels;
+		std::vector<uint8_t> mip_chain; // a chain built on the cpu
+		VCookedTexture cooked_texture;
+	};
+
+	// blitting the chain needs linear filtering of the format, otherwise the decoding threads box filter it
+	VkFormatProperties format_properties;
+	vkGetPhysicalDeviceFormatProperties(physical_device, VK_FORMAT_R8G8B8A8_UNORM, &format_properties);
+	const VkFormatFeatureFlags blit_features = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+		| VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	bool blit_mip_levels = mip_mapped && (format_properties.optimalTilingFeatures & blit_features) == blit_features;
+	bool build_mip_levels = mip_mapped && !blit_mip_levels;
+
+	// block compression needs the device feature, all formats come with it. without it textures stay rgba8
+	bool block_compressed = compressed && context->getEnabledFeatures().textureCompressionBC == VK_TRUE
+		&& supportsSampledFormat(VK_FORMAT_BC1_RGB_UNORM_BLOCK)
+		&& supportsSampledFormat(VK_FORMAT_BC3_UNORM_BLOCK)
+		&& supportsSampledFormat(VK_FORMAT_BC5_UNORM_BLOCK);
+
+	std::mutex mutex;
+	std::condition_variable decoded_condition;
+	std::deque<DecodedImage> decoded_images;
+
+	// decoding runs on the other cores, declared after the queue so it is joined before the queue goes away on an exception
+	auto decoder = std::async(std::launch::async, [&paths, &kinds, &mutex, &decoded_condition, &decoded_images
+		, build_mip_levels, block_compressed]()
+	{
+		auto thread_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+		Utilities::parallelFor(paths.size(), [&](size_t i)
+		{
+			DecodedImage decoded = {};
+			decoded.index = i;
+
+			// a cooked texture is staged straight from its mapping, otherwise the source is decoded and cooked once.
+			// images are spread over the threads already, so each one is encoded on a single thread
+			if (block_compressed && decoded.cooked_texture.load(paths[i], kinds[i]))
+			{
+				decoded.format = decoded.cooked_texture.getFormat();
+			}
+
+			if (decoded.format == VK_FORMAT_UNDEFINED)
+			{
+				int width = 0, height = 0, channels = 0;
+				decoded.pixels = Pixels(stbi_load(paths[i].c_str(), &width, &height, &channels, STBI_rgb_alpha));
+				decoded.width = static_cast<uint32_t>(width);
+				decoded.height = static_cast<uint32_t>(height);
+			}
+
+			if (decoded.pixels && block_compressed)
+			{
+				decoded.cooked_texture.cook(decoded.pixels.get(), decoded.width, decoded.height, kinds[i], 1);
+				if (!decoded.cooked_texture.write(paths[i]))
+				{
+					std::cerr << "Failed to write cooked texture " << VCookedTexture::getCookedPath(paths[i], kinds[i]) << std::endl;
+				}
+				decoded.pixels.reset();
+				decoded.format = decoded.cooked_texture.getFormat();
+			}
+
+			if (decoded.cooked_texture.getData())
+			{
+				decoded.width = decoded.cooked_texture.getWidth();
+				decoded.height = decoded.cooked_texture.getHeight();
+				decoded.data = decoded.cooked_texture.getData();
+				decoded.size = decoded.cooked_texture.getDataSize();
+				decoded.mip_levels = decoded.cooked_texture.getMipLevels();
+			}
+			else if (decoded.pixels && build_mip_levels)
+			{
+				decoded.format = VK_FORMAT_R8G8B8A8_UNORM;
+				decoded.mip_levels = Utilities::getMipLevelCount(decoded.width, decoded.height);
+				decoded.mip_chain = Utilities::buildMipChainRgba8(decoded.pixels.get(), decoded.width, decoded.height, decoded.mip_levels);
+				decoded.pixels.reset();
+				decoded.data = decoded.mip_chain.data();
+				decoded.size = decoded.mip_chain.size();
+			}
+			else if (decoded.pixels)
+			{
+				decoded.format = VK_FORMAT_R8G8B8A8_UNORM;
+				decoded.mip_levels = 1;
+				decoded.data = decoded.pixels.get();
+				decoded.size = Utilities::getImageLevelSize(decoded.format, decoded.width, decoded.height);
+			}
+
+			// failures are queued as well, the upload stage is waiting for every index
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				decoded_images.push_back(std::move(decoded));
+			}
+			decoded_condition.notify_one();
+		}, thread_count);
+	});
+
+	std::vector<std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>, VulkanRaii<VkImageView>>> images(paths.size());
+
+	// on a failure the copies enqueued so far go too, the images they write to are destroyed with images
+	try
+	{
+		for (size_t staged = 0; staged < paths.size(); staged++)
+		{
+			DecodedImage decoded;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				decoded_condition.wait(lock, [&decoded_images]() { return !decoded_images.empty(); });
+				decoded = std::move(decoded_images.front());
+				decoded_images.pop_front();
+			}
+
+			if (!decoded.data)
+			{
+				throw std::runtime_error("Failed to load image" + paths[decoded.index]);
+			}
+
+			// the cooked and cpu built chains hold every level, only rgba8 level 0 is left to blit
+			bool generate_mip_levels = mip_mapped && blit_mip_levels && decoded.format == VK_FORMAT_R8G8B8A8_UNORM && decoded.mip_levels == 1;
+			uint32_t mip_levels = !mip_mapped ? 1
+				: generate_mip_levels ? Utilities::getMipLevelCount(decoded.width, decoded.height)
+				: decoded.mip_levels;
+			VkDeviceSize upload_size = mip_levels < decoded.mip_levels
+				? Utilities::getImageLevelSize(decoded.format, decoded.width, decoded.height)
+				: decoded.size;
+
+			VulkanRaii<VkImage> image;
+			VulkanRaii<VkDeviceMemory> image_memory;
+			std::tie(image, image_memory) = createImage(
+				decoded.width, decoded.height
+				, decoded.format
+				, VK_IMAGE_TILING_OPTIMAL
+				, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+				, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+				, mip_levels
+			);
+
+			// staging overlaps with decoding the remaining images, the decoded data is released right after
+			enqueueImageUpload(image.get(), decoded.format, decoded.width, decoded.height, decoded.data, upload_size, mip_levels, generate_mip_levels);
+			auto image_view = createImageView(image.get(), decoded.format, VK_IMAGE_ASPECT_COLOR_BIT, mip_levels);
+			images[decoded.index] = std::make_tuple(std::move(image), std::move(image_memory), std::move(image_view));
+			decoded = DecodedImage();
+		}
+	}
+	catch (...)
+	{
+		discardUploads();
+		throw;
+	}
+
+	decoder.get();
+
+	return images;
+}
+
+std::tuple<VkBuffer, VkDeviceSize> VUtility::stageUpload(const void* data, VkDeviceSize size)
+{
+	const VkDeviceSize alignment = 16; // covers the texel size and the multiple of 4 required for buffer to image copies
+
+	auto createBlock = [this](VkDeviceSize capacity)
+	{
+		StagingBlock block;
+		block.capacity = capacity;
+		std::tie(block.buffer, block.memory) = createBuffer(capacity
+			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
+			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		// mapped for the lifetime of the block
+		void* mapped;
+		if (vkMapMemory(graphics_device, block.memory.get(), 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to map staging memory!");
+		}
+		block.mapped = static_cast<char*>(mapped);
+		return block;
+	};
+
+	StagingBlock* block = nullptr;
+	VkDeviceSize offset = 0;
+	if (size > STAGING_BLOCK_SIZE)
+	{
+		// a dedicated block, kept in front of the current one so the space left there is still used
+		staging_blocks.insert(staging_blocks.end() - (staging_blocks.empty() ? 0 : 1), createBlock(size));
+		block = &staging_blocks[staging_blocks.size() - (staging_blocks.size() > 1 ? 2 : 1)];
+	}
+	else
+	{
+		if (!staging_blocks.empty())
+		{
+			offset = (staging_blocks.back().head + alignment - 1) / alignment * alignment;
+		}
+		if (staging_blocks.empty() || offset + size > staging_blocks.back().capacity)
+		{
+			staging_blocks.push_back(createBlock(STAGING_BLOCK_SIZE));
+			offset = 0;
+		}
+		block = &staging_blocks.back();
+	}
+
+	memcpy(block->mapped + offset, data, static_cast<size_t>(size));
+	block->head = offset + size;
+
+	return std::make_tuple(block->buffer.get(), offset);
+}
 
-	// load image file
-	int tex_width, tex_height, tex_channels;
+void VUtility::enqueueBufferUpload(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, VkDeviceSize size)
+{
+	VkBuffer src_buffer;
+	VkDeviceSize src_offset;
+	std::tie(src_buffer, src_offset) = stageUpload(data, size);
+
+	VkBufferCopy region = {};
+	region.srcOffset = src_offset;
+	region.dstOffset = dst_offset;
+	region.size = size;
+	pending_buffer_copies.push_back({ src_buffer, dst_buffer, region });
+}
 
-	stbi_uc* pixels = stbi_load(path.c_str()
-		, &tex_width, &tex_height
-		, &tex_channels
-		, STBI_rgb_alpha);
+void VUtility::enqueueImageUpload(VkImage dst_image, VkFormat format, uint32_t width, uint32_t height, const void* data, VkDeviceSize size
+	, uint32_t mip_levels, bool generate_mip_levels)
+{
+	VkBuffer src_buffer;
+	VkDeviceSize src_offset;
+	std::tie(src_buffer, src_offset) = stageUpload(data, size);
 
-	VkDeviceSize image_size = tex_width * tex_height * 4;
-	if (!pixels)
+	PendingImageCopy copy = { src_buffer, dst_image, {}, width, height, mip_levels, generate_mip_levels };
+	uint32_t uploaded_levels = generate_mip_levels ? 1 : mip_levels;
+	for (uint32_t level = 0; level < uploaded_levels; level++)
 	{
-		throw std::runtime_error("Failed to load image" + path);
+		uint32_t level_width = std::max(1u, width >> level);
+		uint32_t level_height = std::max(1u, height >> level);
+
+		VkBufferImageCopy region = {};
+		region.bufferOffset = src_offset;
+		region.bufferRowLength = 0; // tightly packed texels or blocks
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { level_width, level_height, 1 };
+		copy.regions.push_back(region);
+
+		src_offset += Utilities::getImageLevelSize(format, level_width, level_height);
 	}
+	pending_image_copies.push_back(std::move(copy));
+}
 
-	// create staging image memory
-	VulkanRaii<VkImage> staging_image;
-	VulkanRaii<VkDeviceMemory> staging_image_memory;
-	std::tie(staging_image, staging_image_memory) = createImage(
-		tex_width, tex_height
-		, VK_FORMAT_R8G8B8A8_UNORM
-		, VK_IMAGE_TILING_LINEAR
-		, VK_IMAGE_USAGE_TRANSFER_SRC_BIT
-		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	);
+void VUtility::submitUploads()
+{
+	submitUploadsAsync();
+	waitUploads();
+}
 
-	// copy image to staging memory
-	void* data;
-	vkMapMemory(graphics_device, staging_image_memory.get(), 0, image_size, 0, &data);
-	memcpy(data, pixels, (size_t)image_size);
-	vkUnmapMemory(graphics_device, staging_image_memory.get());
-
-	// free image in memory
-	stbi_image_free(pixels);
-
-	VulkanRaii<VkImage> image;
-	VulkanRaii<VkDeviceMemory> image_memory;
-	// create texture image
-	std::tie(image, image_memory) = createImage(
-		tex_width, tex_height
-		, VK_FORMAT_R8G8B8A8_UNORM
-		, VK_IMAGE_TILING_OPTIMAL
-		, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-	);
+void VUtility::submitUploadsAsync()
+{
+	waitUploads();
 
-	// TODO: doing the steps asynchronously by using a single command buffer
-	auto command_buffer = beginSingleTimeCommands();
+	if (pending_buffer_copies.empty() && pending_image_copies.empty())
+	{
+		staging_blocks.clear();
+		return;
+	}
 
-	recordTransitImageLayout(command_buffer, staging_image.get(), VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	recordTransitImageLayout(command_buffer, image.get(), VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	recordCopyImage(command_buffer, staging_image.get(), image.get(), tex_width, tex_height);
-	recordTransitImageLayout(command_buffer, image.get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// with a dedicated transfer family the resources change hands, a release on the transfer queue
+	// and a matching acquire on the graphics queue
+	bool dedicated_transfer = transfer_family >= 0;
+	uint32_t src_family = dedicated_transfer ? static_cast<uint32_t>(transfer_family) : VK_QUEUE_FAMILY_IGNORED;
+	uint32_t dst_family = dedicated_transfer ? static_cast<uint32_t>(graphics_family) : VK_QUEUE_FAMILY_IGNORED;
 
-	endSingleTimeCommands(command_buffer);
+	auto beginCommands = [this](VkCommandPool pool)
+	{
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandPool = pool;
+		alloc_info.commandBufferCount = 1;
+
+		VkCommandBuffer command_buffer;
+		vkAllocateCommandBuffers(graphics_device, &alloc_info, &command_buffer);
+
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(command_buffer, &begin_info);
+
+		return command_buffer;
+	};
+
+	auto imageBarrier = [](const PendingImageCopy& copy, VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags src_access, VkAccessFlags dst_access
+		, uint32_t src_family, uint32_t dst_family)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = old_layout;
+		barrier.newLayout = new_layout;
+		barrier.srcAccessMask = src_access;
+		barrier.dstAccessMask = dst_access;
+		barrier.srcQueueFamilyIndex = src_family;
+		barrier.dstQueueFamilyIndex = dst_family;
+		barrier.image = copy.dst_image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = copy.mip_levels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		return barrier;
+	};
+
+	auto bufferBarrier = [](const PendingBufferCopy& copy, VkAccessFlags src_access, VkAccessFlags dst_access, uint32_t src_family, uint32_t dst_family)
+	{
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = src_access;
+		barrier.dstAccessMask = dst_access;
+		barrier.srcQueueFamilyIndex = src_family;
+		barrier.dstQueueFamilyIndex = dst_family;
+		barrier.buffer = copy.dst_buffer;
+		barrier.offset = copy.region.dstOffset;
+		barrier.size = copy.region.size;
+		return barrier;
+	};
 
+	const VkAccessFlags graphics_read_access = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+		| VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	const VkPipelineStageFlags graphics_read_stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+		| VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	// images whose mip chain is blitted stay in TRANSFER_DST_OPTIMAL until the blits on the graphics queue
+	const VkAccessFlags mip_generation_access = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
 
-	// Create image view
-	auto image_view = createImageView(image.get(), VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+	auto recordPendingMipGeneration = [this](VkCommandBuffer command_buffer)
+	{
+		for (const auto& copy : pending_image_copies)
+		{
+			if (copy.generate_mip_levels)
+			{
+				recordGenerateMipLevels(command_buffer, copy.dst_image, copy.width, copy.height, copy.mip_levels);
+			}
+		}
+	};
 
-	return std::make_tuple(std::move(image), std::move(image_memory), std::move(image_view));
+	auto transfer_command_buffer = beginCommands(dedicated_transfer ? transfer_queue_command_pool : graphics_queue_command_pool);
+
+	// one barrier for all images before the copies and one after
+	std::vector<VkImageMemoryBarrier> image_barriers;
+	image_barriers.reserve(pending_image_copies.size());
+	for (const auto& copy : pending_image_copies)
+	{
+		image_barriers.push_back(imageBarrier(copy, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+			, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED));
+	}
+	if (!image_barriers.empty())
+	{
+		vkCmdPipelineBarrier(transfer_command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0
+			, 0, nullptr, 0, nullptr, static_cast<uint32_t>(image_barriers.size()), image_barriers.data());
+	}
+
+	for (const auto& copy : pending_buffer_copies)
+	{
+		vkCmdCopyBuffer(transfer_command_buffer, copy.src_buffer, copy.dst_buffer, 1, &copy.region);
+	}
+	for (const auto& copy : pending_image_copies)
+	{
+		vkCmdCopyBufferToImage(transfer_command_buffer, copy.src_buffer, copy.dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+			, static_cast<uint32_t>(copy.regions.size()), copy.regions.data());
+	}
+
+	// after the copies: either plain barriers to the graphics reads, or the release half of the ownership transfer,
+	// whose destination access is ignored and only takes effect with the acquire below
+	auto recordPostCopyBarriers = [&](VkCommandBuffer command_buffer, VkAccessFlags src_access, VkAccessFlags dst_access
+		, VkPipelineStageFlags src_stages, VkPipelineStageFlags dst_stages)
+	{
+		image_barriers.clear();
+		for (const auto& copy : pending_image_copies)
+		{
+			if (copy.generate_mip_levels)
+			{
+				image_barriers.push_back(imageBarrier(copy, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+					, src_access, dst_access ? mip_generation_access : 0, src_family, dst_family));
+			}
+			else
+			{
+				image_barriers.push_back(imageBarrier(copy, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+					, src_access, dst_access, src_family, dst_family));
+			}
+		}
+
+		std::vector<VkBufferMemoryBarrier> buffer_barriers;
+		VkMemoryBarrier memory_barrier = {};
+		memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memory_barrier.srcAccessMask = src_access;
+		memory_barrier.dstAccessMask = dst_access;
+		if (dedicated_transfer)
+		{
+			// exclusive buffers need the ownership transfer per range, a global memory barrier does not do that
+			buffer_barriers.reserve(pending_buffer_copies.size());
+			for (const auto& copy : pending_buffer_copies)
+			{
+				buffer_barriers.push_back(bufferBarrier(copy, src_access, dst_access, src_family, dst_family));
+			}
+		}
+
+		vkCmdPipelineBarrier(command_buffer, src_stages, dst_stages, 0
+			, dedicated_transfer ? 0 : 1, &memory_barrier
+			, static_cast<uint32_t>(buffer_barriers.size()), buffer_barriers.data()
+			, static_cast<uint32_t>(image_barriers.size()), image_barriers.data());
+	};
+
+	if (dedicated_transfer)
+	{
+		recordPostCopyBarriers(transfer_command_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, 0
+			, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	}
+	else
+	{
+		recordPostCopyBarriers(transfer_command_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, graphics_read_access
+			, VK_PIPELINE_STAGE_TRANSFER_BIT, graphics_read_stages);
+		recordPendingMipGeneration(transfer_command_buffer);
+	}
+	vkEndCommandBuffer(transfer_command_buffer);
+	in_flight_upload.transfer_command_buffer = transfer_command_buffer;
+
+	VkFenceCreateInfo fence_info = {};
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	if (vkCreateFence(graphics_device, &fence_info, nullptr, &in_flight_upload.fence) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create upload fence!");
+	}
+
+	VkResult submit_result;
+	if (dedicated_transfer)
+	{
+		// the acquire half, identical layouts and queue families with the source access ignored. its source stages
+		// are the stages the semaphore wait blocks, so the two chain and the layout transitions happen after the
+		// release. they include the transfer stage of the mip blits recorded behind it
+		auto acquire_command_buffer = beginCommands(graphics_queue_command_pool);
+		recordPostCopyBarriers(acquire_command_buffer, 0, graphics_read_access
+			, graphics_read_stages, graphics_read_stages);
+		recordPendingMipGeneration(acquire_command_buffer); // blits need the graphics queue
+		vkEndCommandBuffer(acquire_command_buffer);
+		in_flight_upload.acquire_command_buffer = acquire_command_buffer;
+
+		VkSemaphoreCreateInfo semaphore_info = {};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		if (vkCreateSemaphore(graphics_device, &semaphore_info, nullptr, &in_flight_upload.semaphore) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create upload semaphore!");
+		}
+
+		VkSubmitInfo transfer_submit_info = {};
+		transfer_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		transfer_submit_info.commandBufferCount = 1;
+		transfer_submit_info.pCommandBuffers = &transfer_command_buffer;
+		transfer_submit_info.signalSemaphoreCount = 1;
+		transfer_submit_info.pSignalSemaphores = &in_flight_upload.semaphore;
+		submit_result = vkQueueSubmit(transfer_queue, 1, &transfer_submit_info, VK_NULL_HANDLE);
+
+		if (submit_result == VK_SUCCESS)
+		{
+			VkPipelineStageFlags wait_stage = graphics_read_stages;
+			VkSubmitInfo acquire_submit_info = {};
+			acquire_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			acquire_submit_info.waitSemaphoreCount = 1;
+			acquire_submit_info.pWaitSemaphores = &in_flight_upload.semaphore;
+			acquire_submit_info.pWaitDstStageMask = &wait_stage;
+			acquire_submit_info.commandBufferCount = 1;
+			acquire_submit_info.pCommandBuffers = &acquire_command_buffer;
+			submit_result = vkQueueSubmit(graphics_queue, 1, &acquire_submit_info, in_flight_upload.fence);
+		}
+	}
+	else
+	{
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &transfer_command_buffer;
+		submit_result = vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_upload.fence);
+	}
+
+	pending_buffer_copies.clear();
+	pending_image_copies.clear();
+	in_flight_upload.staging_blocks = std::move(staging_blocks);
+	staging_blocks.clear();
+
+	if (submit_result != VK_SUCCESS)
+	{
+		// nothing will signal the fence, make sure the queues are done before the staging memory goes away
+		vkDeviceWaitIdle(graphics_device);
+		vkDestroyFence(graphics_device, in_flight_upload.fence, nullptr);
+		in_flight_upload.fence = VK_NULL_HANDLE;
+		waitUploads();
+		throw std::runtime_error("Failed to submit uploads!");
+	}
+}
+
+void VUtility::discardUploads()
+{
+	pending_buffer_copies.clear();
+	pending_image_copies.clear();
+	staging_blocks.clear();
+}
+
+bool VUtility::isUploadComplete()
+{
+	return in_flight_upload.fence == VK_NULL_HANDLE || vkGetFenceStatus(graphics_device, in_flight_upload.fence) == VK_SUCCESS;
+}
+
+void VUtility::waitUploads()
+{
+	if (in_flight_upload.fence != VK_NULL_HANDLE)
+	{
+		vkWaitForFences(graphics_device, 1, &in_flight_upload.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		vkDestroyFence(graphics_device, in_flight_upload.fence, nullptr);
+	}
+	if (in_flight_upload.semaphore != VK_NULL_HANDLE)
+	{
+		vkDestroySemaphore(graphics_device, in_flight_upload.semaphore, nullptr);
+	}
+	if (in_flight_upload.transfer_command_buffer != VK_NULL_HANDLE)
+	{
+		auto pool = transfer_family >= 0 ? transfer_queue_command_pool : graphics_queue_command_pool;
+		vkFreeCommandBuffers(graphics_device, pool, 1, &in_flight_upload.transfer_command_buffer);
+	}
+	if (in_flight_upload.acquire_command_buffer != VK_NULL_HANDLE)
+	{
+		vkFreeCommandBuffers(graphics_device, graphics_queue_command_pool, 1, &in_flight_upload.acquire_command_buffer);
+	}
+	in_flight_upload = InFlightUpload();
 }
 
 // create a temperorary command buffer for one-time use
@@ -557,4 +1369,106 @@ void VUtility::recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage
 		, 0, nullptr
 		, 1, &barrier
 	);
-}
\ No newline at end of file
+}
+
+void VUtility::recordGenerateMipLevels(VkCommandBuffer command_buffer, VkImage image, uint32_t width, uint32_t height, uint32_t mip_levels)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	const VkPipelineStageFlags shader_stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+	int32_t level_width = static_cast<int32_t>(width);
+	int32_t level_height = static_cast<int32_t>(height);
+	for (uint32_t level = 1; level < mip_levels; level++)
+	{
+		// the level above becomes the blit source
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0
+			, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		int32_t next_width = std::max(1, level_width / 2);
+		int32_t next_height = std::max(1, level_height / 2);
+
+		VkImageBlit blit = {};
+		blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { level_width, level_height, 1 };
+		blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { next_width, next_height, 1 };
+		vkCmdBlitImage(command_buffer
+			, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+			, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+			, 1, &blit, VK_FILTER_LINEAR);
+
+		// done with the level above
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, shader_stages, 0
+			, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		level_width = next_width;
+		level_height = next_height;
+	}
+
+	// the last level was only written
+	barrier.subresourceRange.baseMipLevel = mip_levels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, shader_stages, 0
+		, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+VUploadRing::VUploadRing(VUtility& utility, VkDevice device, VkDeviceSize frame_capacity, uint32_t frame_count)
+	: frame_capacity(frame_capacity)
+{
+	std::tie(buffer, buffer_memory) = utility.createBuffer(frame_capacity * frame_count
+		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
+		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	// mapped once for the lifetime of the buffer
+	void* data;
+	if (vkMapMemory(device, buffer_memory.get(), 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to map upload ring memory!");
+	}
+	mapped = static_cast<char*>(data);
+}
+
+void VUploadRing::beginFrame(uint32_t frame_index)
+{
+	frame_begin = frame_capacity * frame_index;
+	head = frame_begin;
+}
+
+VUploadRing::Allocation VUploadRing::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+	if (offset + size > frame_begin + frame_capacity)
+	{
+		throw std::runtime_error("Upload ring is out of space for this frame!");
+	}
+	head = offset + size;
+
+	Allocation allocation;
+	allocation.buffer = buffer.get();
+	allocation.offset = offset;
+	allocation.data = mapped + offset;
+	return allocation;
+}
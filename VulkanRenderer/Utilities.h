@@ -4,18 +4,114 @@
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan.hpp>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <ostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace Utilities
 {
-	VkVertexInputBindingDescription getVertexBindingDesciption();
+	// fast non-cryptographic 64 bit hash for content keys of cached data
+	uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
 
-	std::array<VkVertexInputAttributeDescription, 4> getVertexAttributeDescriptions();
+	// last write time in the file system's own units, 0 if it cannot be read. for telling whether a cache is stale
+	int64_t getFileModificationTime(const std::string& path);
+	// size, modification time and content hash that key a cache on its source file, false if the source cannot be read
+	bool getSourceKey(const std::string& path, uint64_t& size, int64_t& mtime, uint64_t& hash);
+	// the source still matches a key from getSourceKey. size and modification time are checked first so an unchanged source
+	// is never read, a touched but otherwise identical source (e.g. a fresh checkout) still matches through its hash
+	bool isSourceUnchanged(const std::string& path, uint64_t size, int64_t mtime, uint64_t hash);
+	// write a file through a temporary one renamed over it, so a crash never leaves a truncated file behind. false on any failure
+	bool writeFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& write_contents);
 
+	// levels of a full mip chain, down to 1x1
+	uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+	// bytes of one tightly packed level of an rgba8 or a block compressed image
+	VkDeviceSize getImageLevelSize(VkFormat format, uint32_t width, uint32_t height);
+	// 2x2 box filter of an rgba8 image into one of half the size, rounded down and at least 1.
+	// a last odd row or column is averaged into the last texel, which then covers 3 source texels along that axis
+	void downsampleRgba8(const uint8_t* src, uint32_t src_width, uint32_t src_height, uint8_t* dst);
+	// the image followed by mip_levels - 1 downsampled levels, each tightly packed
+	std::vector<uint8_t> buildMipChainRgba8(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t mip_levels);
+
+	// run func(i) for every i in [0, count) on up to thread_count threads (0 for one per core), in no particular order.
+	// threads pull the next index when they finish one, so uneven work items balance out. rethrows a worker's exception
+	template <typename Func>
+	void parallelFor(size_t count, Func func, uint32_t thread_count = 0)
+	{
+		if (thread_count == 0)
+		{
+			thread_count = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		std::atomic<size_t> next_index{ 0 };
+		auto worker = [&next_index, &func, count]()
+		{
+			for (size_t i = next_index++; i < count; i = next_index++)
+			{
+				func(i);
+			}
+		};
+
+		std::vector<std::future<void>> workers;
+		for (size_t i = 1; i < std::min<size_t>(thread_count, count); i++)
+		{
+			workers.push_back(std::async(std::launch::async, worker));
+		}
+		worker(); // the calling thread works as well
+		for (auto& task : workers)
+		{
+			task.get();
+		}
+	}
 }
 
+/**
+* a read-only memory mapping of a whole file, unmapped on destruction
+*/
+class VMappedFile
+{
+public:
+	VMappedFile() = default;
+	explicit VMappedFile(const std::string& path); // throws if the file cannot be opened or mapped
+	~VMappedFile();
+
+	VMappedFile(VMappedFile&& other);
+	VMappedFile& operator= (VMappedFile&& other);
+	VMappedFile(const VMappedFile&) = delete;
+	VMappedFile& operator= (const VMappedFile&) = delete;
+
+	const char* data() const
+	{
+		return mapped;
+	}
+
+	size_t size() const
+	{
+		return file_size;
+	}
+
+private:
+	void close();
+
+	const char* mapped = nullptr;
+	size_t file_size = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+};
+
 class VulkanApplication;
+class VDeviceMemoryAllocator;
+enum class VTextureKind : uint32_t;
 
 /**
 * a utility module for vulkan context
@@ -25,7 +121,7 @@ class VUtility
 public:
 
 	VUtility(const VulkanApplication& context);
-	~VUtility() = default;
+	~VUtility(); // waits for uploads still in flight
 
 	VUtility(VUtility&&) = delete;
 	VUtility& operator= (VUtility&&) = delete;
@@ -50,15 +146,44 @@ public:
 
 	std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>> createImage(uint32_t image_width, uint32_t image_height
 		, VkFormat format, VkImageTiling tiling
-		, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties);
+		, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties, uint32_t mip_levels = 1);
 
 	void copyImage(VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height);
 	void transitImageLayout(VkImage image, VkImageLayout old_layout, VkImageLayout new_layout);
 
-	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view);
-	VulkanRaii<VkImageView> createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask);
+	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view, uint32_t mip_levels = 1);
+	VulkanRaii<VkImageView> createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, uint32_t mip_levels = 1);
 
 	std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>, VulkanRaii<VkImageView>> loadImageFromFile(std::string path);
+	// decode the files concurrently on worker threads while this thread stages each image as soon as it is decoded.
+	// the copies are only enqueued, call submitUploads before using the images. results are in the order of paths.
+	// with mip_mapped the images get a full mip chain, blitted on the gpu or box filtered on the decoding threads
+	// when the format cannot be blitted with linear filtering.
+	// with compressed the block compressed textures cooked next to the sources are uploaded, cooking them on first use
+	// in the format for their kind. devices without BC support get rgba8
+	std::vector<std::tuple<VulkanRaii<VkImage>, VulkanRaii<VkDeviceMemory>, VulkanRaii<VkImageView>>> loadImagesFromFiles(const std::vector<std::string>& paths
+		, const std::vector<VTextureKind>& kinds, bool mip_mapped = true, bool compressed = true);
+
+	// batched uploads: data is copied into a shared staging arena right away, so the caller's memory can be released
+	// after the call. the copies are recorded into one command buffer and executed by submitUploads
+	void enqueueBufferUpload(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, VkDeviceSize size);
+	// dst_image must be in VK_IMAGE_LAYOUT_UNDEFINED or PREINITIALIZED, it ends up in SHADER_READ_ONLY_OPTIMAL.
+	// data holds mip_levels rgba8 or block compressed levels back to back, or only level 0 with generate_mip_levels,
+	// in which case the rest of the chain is blitted on the graphics queue. that needs TRANSFER_SRC usage on the image
+	void enqueueImageUpload(VkImage dst_image, VkFormat format, uint32_t width, uint32_t height, const void* data, VkDeviceSize size
+		, uint32_t mip_levels = 1, bool generate_mip_levels = false);
+	// submit every enqueued copy at once, wait for its fence and release the staging arena
+	void submitUploads();
+	// submit every enqueued copy without waiting. with a dedicated transfer queue the copies run there and the resources are
+	// released to the graphics family, which acquires them in a small submission that waits on the copies' semaphore.
+	// the resources may be used by graphics submissions made after this call. one batch is in flight at a time
+	void submitUploadsAsync();
+	bool isUploadComplete();
+	// wait for the batch in flight and release its staging arena
+	void waitUploads();
+	// drop every copy enqueued since the last submission, and the staging arena holding their data. a load that
+	// fails after enqueueing calls this, the copies may refer to buffers and images its unwinding destroys
+	void discardUploads();
 
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
@@ -67,11 +192,68 @@ public:
 	void recordCopyBuffer(VkCommandBuffer command_buffer, VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size, VkDeviceSize src_offset = 0, VkDeviceSize dst_offset = 0);
 	void recordCopyImage(VkCommandBuffer command_buffer, VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height);
 	void recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout);
+	// blit every level from the one above, level 0 must hold the image. all levels go from TRANSFER_DST_OPTIMAL to SHADER_READ_ONLY_OPTIMAL
+	void recordGenerateMipLevels(VkCommandBuffer command_buffer, VkImage image, uint32_t width, uint32_t height, uint32_t mip_levels);
 
 private:
 
+	// device local memory comes from the sub-allocator, host visible memory gets an allocation of its own since callers
+	// map it from offset 0. returns the memory and the offset to bind the resource at
+	std::tuple<VulkanRaii<VkDeviceMemory>, VkDeviceSize> allocateMemory(const VkMemoryRequirements& memory_req, VkMemoryPropertyFlags property_bits, bool optimal_tiling);
+
+	// optimal tiling supports sampling the format with linear filtering
+	bool supportsSampledFormat(VkFormat format);
+
 	std::tuple<VkBuffer, VkDeviceMemory> createBufferImpl(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags property_bits, int sharing_queue_family_index_a = -1, int sharing_queue_family_index_b = -1);
 
+	// a persistently mapped host visible buffer that staged uploads are sub-allocated from
+	struct StagingBlock
+	{
+		VulkanRaii<VkBuffer> buffer;
+		VulkanRaii<VkDeviceMemory> memory;
+		char* mapped = nullptr;
+		VkDeviceSize capacity = 0;
+		VkDeviceSize head = 0;
+	};
+
+	struct PendingBufferCopy
+	{
+		VkBuffer src_buffer;
+		VkBuffer dst_buffer;
+		VkBufferCopy region;
+	};
+
+	struct PendingImageCopy
+	{
+		VkBuffer src_buffer;
+		VkImage dst_image;
+		std::vector<VkBufferImageCopy> regions; // one per uploaded level
+		uint32_t width;
+		uint32_t height;
+		uint32_t mip_levels;
+		bool generate_mip_levels;
+	};
+
+	// copy size bytes of data into the staging arena, returns the buffer and offset they ended up at
+	std::tuple<VkBuffer, VkDeviceSize> stageUpload(const void* data, VkDeviceSize size);
+
+	// the arena normally is a single block, larger uploads get blocks of their own
+	static const VkDeviceSize STAGING_BLOCK_SIZE = 64 * 1024 * 1024;
+	std::vector<StagingBlock> staging_blocks;
+	std::vector<PendingBufferCopy> pending_buffer_copies;
+	std::vector<PendingImageCopy> pending_image_copies;
+
+	// the batch submitted by submitUploadsAsync
+	struct InFlightUpload
+	{
+		std::vector<StagingBlock> staging_blocks;
+		VkCommandBuffer transfer_command_buffer = VK_NULL_HANDLE;
+		VkCommandBuffer acquire_command_buffer = VK_NULL_HANDLE; // on the graphics queue, only with a dedicated transfer queue
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+	};
+	InFlightUpload in_flight_upload;
+
 
 	const VulkanApplication* context;
 	vk::PhysicalDevice physical_device;
@@ -82,7 +264,54 @@ private:
 	vk::Queue present_queue;
 	vk::CommandPool graphics_queue_command_pool;
 	vk::CommandPool compute_queue_command_pool;
+	vk::Queue transfer_queue; // graphics_queue without a dedicated transfer family
+	vk::CommandPool transfer_queue_command_pool;
+	int graphics_family;
+	int transfer_family; // -1 without a dedicated transfer family
+	VDeviceMemoryAllocator* memory_allocator;
 
 
 
+};
+
+/**
+* a persistently mapped host visible buffer split into one region per frame in flight.
+* transient per-frame data is sub-allocated linearly from the current frame's region,
+* which is only reused once that frame's fence has been waited on
+*/
+class VUploadRing
+{
+public:
+	struct Allocation
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0; // offset into buffer, to be used as the copy source
+		void* data = nullptr; // host pointer to write into
+	};
+
+	VUploadRing() = default;
+	VUploadRing(VUtility& utility, VkDevice device, VkDeviceSize frame_capacity, uint32_t frame_count);
+	~VUploadRing() = default; // freeing the memory implicitly unmaps it
+
+	VUploadRing(VUploadRing&&) = default;
+	VUploadRing& operator= (VUploadRing&&) = default;
+	VUploadRing(const VUploadRing&) = delete;
+	VUploadRing& operator= (const VUploadRing&) = delete;
+
+	// start sub-allocating from the region owned by frame_index, discarding what that frame allocated last time
+	void beginFrame(uint32_t frame_index);
+	Allocation allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+	VkBuffer getBuffer() const
+	{
+		return buffer.get();
+	}
+
+private:
+	VulkanRaii<VkBuffer> buffer;
+	VulkanRaii<VkDeviceMemory> buffer_memory;
+	char* mapped = nullptr;
+	VkDeviceSize frame_capacity = 0;
+	VkDeviceSize frame_begin = 0;
+	VkDeviceSize head = 0;
 };
\ No newline at end of file
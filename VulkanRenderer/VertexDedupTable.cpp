@@ -0,0 +1,118 @@
+#include "VertexDedupTable.h"
+
+#include <cstring>
+
+namespace
+{
+	const size_t MIN_CAPACITY = 64;
+
+	inline uint64_t rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline size_t capacityFor(size_t vertex_count)
+	{
+		// stay below a load factor of 3/4
+		size_t capacity = MIN_CAPACITY;
+		while (capacity * 3 < vertex_count * 4)
+		{
+			capacity *= 2;
+		}
+		return capacity;
+	}
+}
+
+VVertexDedupTable::VVertexDedupTable(size_t expected_vertex_count)
+	: slots(capacityFor(expected_vertex_count), Slot{ 0, EMPTY })
+{
+	mask = slots.size() - 1;
+}
+
+uint32_t VVertexDedupTable::hash(const Vertex& vertex)
+{
+	const float* components = &vertex.pos.x;
+	static_assert(sizeof(Vertex) == 11 * sizeof(float), "Vertex is expected to be tightly packed floats");
+
+	uint64_t hash = 0x9e3779b97f4a7c15ull;
+	for (size_t i = 0; i < sizeof(Vertex) / sizeof(float); i++)
+	{
+		float value = components[i] + 0.0f; // turns -0.0 into 0.0
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		hash = rotl(hash ^ bits, 27) * 0xc2b2ae3d27d4eb4full;
+	}
+	hash ^= hash >> 32;
+	return static_cast<uint32_t>(hash);
+}
+
+Vertex::index_t VVertexDedupTable::insert(const Vertex& vertex, std::vector<Vertex>& vertices)
+{
+	if ((count + 1) * 4 > slots.size() * 3)
+	{
+		grow();
+	}
+
+	uint32_t vertex_hash = hash(vertex);
+	size_t slot = vertex_hash & mask;
+	uint32_t distance = 0;
+	for (;; distance++, slot = (slot + 1) & mask)
+	{
+		const auto& current = slots[slot];
+		if (current.index == EMPTY)
+		{
+			break;
+		}
+		if (current.hash == vertex_hash && vertices[current.index] == vertex)
+		{
+			return current.index;
+		}
+		if (probeDistance(current.hash, slot) < distance)
+		{
+			// robin hood invariant: an equal vertex would have been found before a slot closer to its home
+			break;
+		}
+	}
+
+	auto index = static_cast<Vertex::index_t>(vertices.size());
+	vertices.push_back(vertex);
+	place({ vertex_hash, index }, slot, distance); // continues where the lookup stopped
+	count++;
+	return index;
+}
+
+void VVertexDedupTable::place(Slot slot, size_t position, uint32_t distance)
+{
+	for (;; distance++, position = (position + 1) & mask)
+	{
+		auto& current = slots[position];
+		if (current.index == EMPTY)
+		{
+			current = slot;
+			return;
+		}
+
+		// take the slot from an entry closer to its home and carry that one on
+		auto current_distance = probeDistance(current.hash, position);
+		if (current_distance < distance)
+		{
+			std::swap(current, slot);
+			distance = current_distance;
+		}
+	}
+}
+
+void VVertexDedupTable::grow()
+{
+	std::vector<Slot> old_slots(slots.size() * 2, Slot{ 0, EMPTY });
+	std::swap(slots, old_slots);
+	mask = slots.size() - 1;
+
+	for (const auto& slot : old_slots)
+	{
+		if (slot.index != EMPTY)
+		{
+			place(slot, slot.hash & mask, 0);
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "Model.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+* open addressing (robin hood) table that maps vertices to their index in a vertex array, for deduplicating
+* the corners of an imported mesh. slots only hold a 32 bit hash and the index, the vertices themselves stay in
+* the array, so a corner costs one probe sequence and no allocation
+*/
+class VVertexDedupTable
+{
+public:
+	explicit VVertexDedupTable(size_t expected_vertex_count = 0);
+
+	// index of an equal vertex in vertices, or append vertex and return its new index
+	Vertex::index_t insert(const Vertex& vertex, std::vector<Vertex>& vertices);
+
+	// hash of the vertex's bit pattern, -0.0 and 0.0 hash the same since they compare equal
+	static uint32_t hash(const Vertex& vertex);
+
+private:
+	static const uint32_t EMPTY = ~0u;
+
+	struct Slot
+	{
+		uint32_t hash;
+		uint32_t index; // into the vertex array, EMPTY for a free slot
+	};
+
+	uint32_t probeDistance(uint32_t hash, size_t slot) const
+	{
+		return static_cast<uint32_t>((slot - (hash & mask)) & mask);
+	}
+
+	// insert slot, probing from position which lies distance slots past its home
+	void place(Slot slot, size_t position, uint32_t distance);
+	void grow();
+
+	std::vector<Slot> slots;
+	size_t mask = 0;
+	size_t count = 0;
+};
@@ -0,0 +1,91 @@
+#include "VertexFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+Snorm16x2 VertexPacking::encodeOctahedral(const glm::vec3& normal)
+{
+	float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+	if (length == 0.0f)
+	{
+		return { 0, 0 };
+	}
+
+	float x = normal.x / length;
+	float y = normal.y / length;
+	if (normal.z < 0.0f)
+	{
+		// fold the lower half over the diagonals
+		float folded_x = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float folded_y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = folded_x;
+		y = folded_y;
+	}
+
+	auto toSnorm = [](float value)
+	{
+		return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+	};
+	return { toSnorm(x), toSnorm(y) };
+}
+
+uint16_t VertexPacking::packHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+	bits &= 0x7fffffff;
+
+	if (bits >= 0x7f800000) // infinity or nan
+	{
+		return sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 : 0);
+	}
+	if (bits >= 0x477ff000) // rounds to 65536 and beyond
+	{
+		return sign | 0x7c00;
+	}
+	if (bits < 0x38800000) // below the smallest normal half, in steps of 2^-24
+	{
+		float magnitude;
+		memcpy(&magnitude, &bits, sizeof(magnitude));
+		return sign | static_cast<uint16_t>(std::nearbyint(magnitude * 16777216.0f));
+	}
+
+	// rebias the exponent and round the 13 dropped mantissa bits to nearest even
+	bits += 0xfff + ((bits >> 13) & 1);
+	return sign | static_cast<uint16_t>((bits - 0x38000000) >> 13);
+}
+
+PackedPosition VertexPacking::packPosition(const glm::vec3& position, const PositionBounds& bounds)
+{
+	auto toUnorm = [](float value, float min, float max)
+	{
+		float extent = max - min;
+		float unit = extent > 0.0f ? std::clamp((value - min) / extent, 0.0f, 1.0f) : 0.0f;
+		return static_cast<uint16_t>(std::lround(unit * 65535.0f));
+	};
+
+	PackedPosition packed;
+	packed.position = {
+		toUnorm(position.x, bounds.min.x, bounds.max.x),
+		toUnorm(position.y, bounds.min.y, bounds.max.y),
+		toUnorm(position.z, bounds.min.z, bounds.max.z),
+		0
+	};
+	return packed;
+}
+
+glm::vec3 VertexPacking::unpackPosition(const PackedPosition& packed, const PositionBounds& bounds)
+{
+	glm::vec3 unit(packed.position.x, packed.position.y, packed.position.z);
+	return bounds.min + unit / 65535.0f * (bounds.max - bounds.min);
+}
+
+PackedAttributes VertexPacking::packAttributes(const glm::vec3& normal, const glm::vec2& tex_coord)
+{
+	PackedAttributes packed;
+	packed.normal = encodeOctahedral(normal);
+	packed.tex_coord = { packHalf(tex_coord.x), packHalf(tex_coord.y) };
+	return packed;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// storage types of packed attributes, each is read as the VkFormat given by VertexAttributeFormat
+struct Unorm16x4
+{
+	uint16_t x, y, z, w;
+};
+
+struct Snorm16x2
+{
+	int16_t x, y;
+};
+
+struct Half2
+{
+	uint16_t x, y;
+};
+
+template <class T> struct VertexAttributeFormat;
+template <> struct VertexAttributeFormat<glm::vec2> { static constexpr VkFormat value = VK_FORMAT_R32G32_SFLOAT; };
+template <> struct VertexAttributeFormat<glm::vec3> { static constexpr VkFormat value = VK_FORMAT_R32G32B32_SFLOAT; };
+template <> struct VertexAttributeFormat<glm::vec4> { static constexpr VkFormat value = VK_FORMAT_R32G32B32A32_SFLOAT; };
+template <> struct VertexAttributeFormat<Unorm16x4> { static constexpr VkFormat value = VK_FORMAT_R16G16B16A16_UNORM; };
+template <> struct VertexAttributeFormat<Snorm16x2> { static constexpr VkFormat value = VK_FORMAT_R16G16_SNORM; };
+template <> struct VertexAttributeFormat<Half2> { static constexpr VkFormat value = VK_FORMAT_R16G16_SFLOAT; };
+
+// one attribute of a vertex format, its VkFormat follows from the member's type
+template <class T, uint32_t Offset>
+struct VertexMember
+{
+	static constexpr VkFormat format = VertexAttributeFormat<T>::value;
+	static constexpr uint32_t offset = Offset;
+};
+
+#define VERTEX_MEMBER(vertex_type, member) VertexMember<decltype(vertex_type::member), offsetof(vertex_type, member)>
+
+// binding and attribute descriptions of a vertex format, locations are numbered in the order of the members
+// starting at first_location, so formats read from several bindings can be combined
+template <class VertexType, class... Members>
+struct VertexLayout
+{
+	static constexpr uint32_t attribute_count = sizeof...(Members);
+
+	static constexpr VkVertexInputBindingDescription getBindingDescription(uint32_t binding = 0)
+	{
+		return { binding, sizeof(VertexType), VK_VERTEX_INPUT_RATE_VERTEX };
+	}
+
+	static constexpr std::array<VkVertexInputAttributeDescription, sizeof...(Members)> getAttributeDescriptions(uint32_t binding = 0, uint32_t first_location = 0)
+	{
+		uint32_t location = first_location;
+		return { { { location++, binding, Members::format, Members::offset }... } };
+	}
+};
+
+// specialized for every vertex format as a VertexLayout of its members
+template <class VertexType> struct VertexFormatTraits;
+
+// a box around the positions of a mesh part, packed positions are relative to it
+struct PositionBounds
+{
+	glm::vec3 min = glm::vec3(0.0f);
+	glm::vec3 max = glm::vec3(0.0f);
+};
+
+/**
+* the gpu vertex is split into two streams, 16 bytes together instead of the 44 of an imported Vertex. the position
+* stream is all the depth pre-pass reads, the forward pass reads both. the position is unorm within the part's
+* PositionBounds and scaled back in the vertex shaders, the normal is octahedral encoded and the uv are half floats
+*/
+struct PackedPosition
+{
+	Unorm16x4 position; // w is unused padding
+};
+
+struct PackedAttributes
+{
+	Snorm16x2 normal;
+	Half2 tex_coord;
+};
+
+template <> struct VertexFormatTraits<PackedPosition> : VertexLayout<PackedPosition
+	, VERTEX_MEMBER(PackedPosition, position)>
+{};
+
+template <> struct VertexFormatTraits<PackedAttributes> : VertexLayout<PackedAttributes
+	, VERTEX_MEMBER(PackedAttributes, normal)
+	, VERTEX_MEMBER(PackedAttributes, tex_coord)>
+{};
+
+namespace VertexPacking
+{
+	// a unit vector folded onto the octahedron and unfolded into [-1, 1]^2
+	Snorm16x2 encodeOctahedral(const glm::vec3& normal);
+
+	// round to nearest even, values out of range become infinity
+	uint16_t packHalf(float value);
+
+	PackedPosition packPosition(const glm::vec3& position, const PositionBounds& bounds);
+	// the position the vertex shaders reconstruct
+	glm::vec3 unpackPosition(const PackedPosition& packed, const PositionBounds& bounds);
+	PackedAttributes packAttributes(const glm::vec3& normal, const glm::vec2& tex_coord);
+}
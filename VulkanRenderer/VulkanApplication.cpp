@@ -41,6 +41,69 @@ void GResult(VkResult result, const char* what = "Runtime error from vulkan_util
 	}
 }
 
+// the compiled shader, refusing one that is older than its glsl source so a stale binary can't run against new buffer layouts
+std::vector<char> readShaderFile(const std::string& spv_path, const std::string& source_path)
+{
+	auto source_time = Utilities::getFileModificationTime(source_path);
+	if (source_time != 0 && Utilities::getFileModificationTime(spv_path) < source_time)
+	{
+		throw std::runtime_error(spv_path + " is missing or older than " + source_path + ", rebuild the shaders");
+	}
+	return readFile(spv_path);
+}
+
+// ids decorated with the given decoration and literal, from the OpDecorate instructions of a spir-v module
+std::vector<uint32_t> findSpirvDecorated(const std::vector<char>& code, uint32_t decoration, uint32_t value)
+{
+	const uint32_t op_decorate = 71;
+	const size_t header_words = 5;
+
+	std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+	memcpy(words.data(), code.data(), words.size() * sizeof(uint32_t));
+
+	std::vector<uint32_t> ids;
+	for (size_t i = header_words; i < words.size();)
+	{
+		uint32_t word_count = words[i] >> 16;
+		if (word_count == 0 || i + word_count > words.size())
+		{
+			break;
+		}
+		if ((words[i] & 0xffff) == op_decorate && word_count >= 4 && words[i + 2] == decoration && words[i + 3] == value)
+		{
+			ids.push_back(words[i + 1]);
+		}
+		i += word_count;
+	}
+	return ids;
+}
+
+// specialization entries for ids a module doesn't declare are silently ignored, so check before relying on one
+void requireSpecConstant(const std::vector<char>& code, uint32_t spec_id, const std::string& name)
+{
+	const uint32_t decoration_spec_id = 1;
+	if (findSpirvDecorated(code, decoration_spec_id, spec_id).empty())
+	{
+		throw std::runtime_error(name + " has no specialization constant " + std::to_string(spec_id) + ", rebuild the shaders");
+	}
+}
+
+// a module that doesn't declare a binding the pipeline fills would read nothing from it without any error
+void requireDescriptorBinding(const std::vector<char>& code, uint32_t set, uint32_t binding, const std::string& name)
+{
+	const uint32_t decoration_binding = 33;
+	const uint32_t decoration_descriptor_set = 34;
+	auto in_set = findSpirvDecorated(code, decoration_descriptor_set, set);
+	for (auto id : findSpirvDecorated(code, decoration_binding, binding))
+	{
+		if (std::find(in_set.begin(), in_set.end(), id) != in_set.end())
+		{
+			return;
+		}
+	}
+	throw std::runtime_error(name + " has no binding " + std::to_string(binding) + " in set " + std::to_string(set) + ", rebuild the shaders");
+}
+
 
 void VulkanApplication::InitWindow()
 {
@@ -64,7 +127,10 @@ void VulkanApplication::FrameBufferCallback(GLFWwindow* window, int width, int h
 void VulkanApplication::Run()
 {
 	mpInputManager = new InputManager();
-	InitWindow();
+	if (!mScene->headless)
+	{
+		InitWindow();
+	}
 	InitVulkan();
 	graphicsdevice = getDevice();
 	device = getDevice();
@@ -72,6 +138,8 @@ void VulkanApplication::Run()
 	graphics_command_pool = getGraphicsCommandPool();
 	compute_command_pool = getComputeCommandPool();
 	initialize();
+	memory_allocator->printStats(std::cout);
+	texture_cache->printStats(std::cout);
 	Loop();
 }
 
@@ -81,30 +149,121 @@ void VulkanApplication::Loop()
 	decltype(previous) current;
 	float delta_time;
 
-	while (!glfwWindowShouldClose(mpWindow))
+	if (mScene->headless)
+	{
+		// no input to steer the camera, render from the scene's camera
+		mCamera.position = mScene->camera_position;
+		mCamera.rotation = mScene->camera_rotation;
+	}
+
+	int frame_count = 0;
+	while (!mScene->benchmark && (mScene->headless ? frame_count++ < mScene->headless_frame_count : !glfwWindowShouldClose(mpWindow)))
 	{
 		current = std::chrono::high_resolution_clock::now();
 		delta_time = std::chrono::duration<float>(current - previous).count();
 		previous = current;
 
-		glfwPollEvents();
-		CheckInput(delta_time);
+		if (!mScene->headless)
+		{
+			glfwPollEvents();
+			CheckInput(delta_time);
+		}
 		setCamera(mCamera.getViewMatrix(), mCamera.position);
 		requestDraw(delta_time);
-		
-		Cleanup();
 	}
 
+	if (mScene->benchmark)
+	{
+		BenchmarkLoop();
+	}
+
+	if (gpu_profiler.isEnabled() && mScene->gpu_profiler)
+	{
+		for (int i = 0; i < VGpuProfiler::PASS_COUNT; i++)
+		{
+			auto pass = static_cast<VGpuProfiler::Pass>(i);
+			auto stats = gpu_profiler.getStats(pass);
+			std::cout << VGpuProfiler::getPassName(pass) << ": average " << stats.time_ms.mean << " ms, p95 " << stats.time_ms.p95 << " ms, p99 " << stats.time_ms.p99 << " ms" << std::endl;
+		}
+		gpu_profiler.writeReport(mScene->gpu_profiler_output);
+	}
+
+	// frames may still be in flight when the window closes
+	Cleanup();
+}
+
+void VulkanApplication::BenchmarkLoop()
+{
+	auto total_frame_count = benchmark.getTotalFrameCount();
+	for (int frame_count = 0; frame_count < total_frame_count; frame_count++)
+	{
+		if (!mScene->headless)
+		{
+			glfwPollEvents(); // keeps the window responsive, input is ignored
+			if (glfwWindowShouldClose(mpWindow)) break;
+		}
+
+		// results are collected frames_in_flight frames late, from here on they belong to measured frames
+		if (frame_count == benchmark.getWarmupFrameCount() + static_cast<int>(frames.size()))
+		{
+			gpu_profiler.clearHistory();
+			benchmark.clearLightIndexCounts();
+		}
+
+		auto frame_start = std::chrono::high_resolution_clock::now();
+
+		benchmark.getCamera(frame_count, mCamera);
+		setCamera(mCamera.getViewMatrix(), mCamera.position);
+		requestDraw(benchmark.getTimestep());
+
+		if (benchmark.isMeasuring(frame_count))
+		{
+			benchmark.addCpuFrameTime(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frame_start).count());
+		}
+	}
+
+	// the last frame of every slot has not been collected yet
+	vkDeviceWaitIdle(graphicsdevice);
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		auto frame_index = (current_frame + i) % frames.size();
+		gpu_profiler.collect(static_cast<uint32_t>(frame_index));
+		benchmark.addLightIndexCount(*frames[frame_index].mapped_light_index_count);
+	}
+
+	std::vector<std::pair<std::string, double>> settings = {
+		{ "light_num", static_cast<double>(pointlights.size()) },
+		{ "tile_size", TILE_SIZE },
+		{ "width", swap_chain_extent.width },
+		{ "height", swap_chain_extent.height },
+		{ "cluster_depth_slices", mScene->cluster_depth_slices },
+		{ "frames_in_flight", static_cast<double>(frames.size()) },
+		{ "warmup_frames", mScene->benchmark_warmup_frames },
+		{ "measured_frames", mScene->benchmark_measured_frames },
+		{ "timestep", mScene->benchmark_timestep },
+		{ "headless", mScene->headless ? 1.0 : 0.0 },
+		{ "texture_mipmaps", mScene->texture_mipmaps ? 1.0 : 0.0 },
+		{ "texture_compression", mScene->texture_compression ? 1.0 : 0.0 },
+		{ "mesh_optimization", mScene->mesh_optimization ? 1.0 : 0.0 },
+		{ "meshlet_culling", mScene->meshlet_culling ? 1.0 : 0.0 },
+	};
+	benchmark.writeReport(mScene->benchmark_report, settings, gpu_profiler, static_cast<uint32_t>(tile_count_per_row * tile_count_per_col));
+	std::cout << "Benchmark report written to " << mScene->benchmark_report << std::endl;
 }
 
 void VulkanApplication::InitVulkan()
 {
 	CreateInstance();
 	setupDebugCallback();
-	createWindowSurface();
+	if (!mScene->headless)
+	{
+		createWindowSurface();
+	}
 	pickPhysicalDevice();
 	findQueueFamilyIndices();
 	createLogicalDevice();
+	memory_allocator = std::make_unique<VDeviceMemoryAllocator>(graphics_device.get(), physical_device);
+	texture_cache = std::make_unique<VTextureCache>(mScene->texture_mipmaps, mScene->texture_compression);
 	createCommandPools();
 }
 
@@ -291,11 +450,15 @@ void VulkanApplication::findQueueFamilyIndices()
 	{
 		throw std::runtime_error("Queue family indices not complete!");
 	}
+
+#ifdef ONE_QUEUE
+	queue_family_indices.transfer_family = -1; // uploads share the single queue as well
+#endif // ONE_QUEUE
 }
 
 void VulkanApplication::createLogicalDevice()
 {
-	QueueFamilyIndices indices = QueueFamilyIndices::findQueueFamilies(physical_device, static_cast<VkSurfaceKHR>(window_surface.get()));
+	const QueueFamilyIndices& indices = queue_family_indices;
 
 	std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
 
@@ -306,7 +469,18 @@ void VulkanApplication::createLogicalDevice()
 	queue_families = { indices.graphics_family };
 	queue_priorties = { { 1.0f } }; // 2 queues in graphics family, 1 used for light cullingf
 #else
-	if (indices.graphics_family != indices.present_family)
+	if (mScene->headless)
+	{
+		// no present queue, and software implementations may expose a single queue that light culling then shares
+		uint32_t queuefamily_count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queuefamily_count, nullptr);
+		std::vector<VkQueueFamilyProperties> queuefamilies(queuefamily_count);
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queuefamily_count, queuefamilies.data());
+
+		queue_families = { indices.graphics_family };
+		queue_priorties = { std::vector<float>(std::min(2u, queuefamilies[indices.graphics_family].queueCount), 1.0f) };
+	}
+	else if (indices.graphics_family != indices.present_family)
 	{
 		//TODO: refactor this part of code, use some structs to help queue creatrion
 		queue_families = { indices.graphics_family, indices.present_family };
@@ -317,6 +491,12 @@ void VulkanApplication::createLogicalDevice()
 		queue_families = { indices.graphics_family };
 		queue_priorties = { { 1.0f, 1.0f, 1.0f } };
 	}
+
+	if (indices.transfer_family >= 0)
+	{
+		queue_families.push_back(indices.transfer_family);
+		queue_priorties.push_back({ 1.0f });
+	}
 #endif // ONE_QUEUE
 
 	float queue_priority = 1.0f;
@@ -327,7 +507,7 @@ void VulkanApplication::createLogicalDevice()
 		// Create a graphics queue
 		VkDeviceQueueCreateInfo queue_create_info = {};
 		queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queue_create_info.queueFamilyIndex = indices.graphics_family;
+		queue_create_info.queueFamilyIndex = family;
 		queue_create_info.queueCount = static_cast<uint32_t>(queue_priorties[i].size());
 
 		queue_create_info.pQueuePriorities = queue_priorties[i].data();
@@ -337,6 +517,14 @@ void VulkanApplication::createLogicalDevice()
 	// Specify used device features
 	VkPhysicalDeviceFeatures device_features = {}; // Everything is by default VK_FALSE
 
+	// used by the gpu profiler when available
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+	device_features.pipelineStatisticsQuery = supported_features.pipelineStatisticsQuery;
+	// block compressed textures, which fall back to rgba8 without it
+	device_features.textureCompressionBC = supported_features.textureCompressionBC;
+	enabled_features = device_features;
+
 												   // Create the logical device
 	VkDeviceCreateInfo device_create_info = {};
 	device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -355,8 +543,11 @@ void VulkanApplication::createLogicalDevice()
 		device_create_info.enabledLayerCount = 0;
 	}
 
-	device_create_info.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
-	device_create_info.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+	if (!mScene->headless)
+	{
+		device_create_info.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
+		device_create_info.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+	}
 
 	VkDevice temp_device;
 	auto result = vkCreateDevice(physical_device, &device_create_info, nullptr, &temp_device);
@@ -378,11 +569,16 @@ void VulkanApplication::createLogicalDevice()
 	graphics_queue = device.getQueue(indices.graphics_family, 0);
 	compute_queue = device.getQueue(indices.graphics_family, 0);
 	present_queue = device.getQueue(indices.graphics_family, 0);
+	transfer_queue = graphics_queue;
 #else
 	graphics_queue = device.getQueue(indices.graphics_family, 0);
-	compute_queue = device.getQueue(indices.graphics_family, 1);
+	compute_queue = device.getQueue(indices.graphics_family, std::min(1u, static_cast<uint32_t>(queue_priorties[0].size()) - 1)); // shares queue 0 if it is the only one
 
-	if (indices.graphics_family != indices.present_family)
+	if (mScene->headless)
+	{
+		present_queue = graphics_queue; // never presented to
+	}
+	else if (indices.graphics_family != indices.present_family)
 	{
 		// TODO: refactor this part of code, use some structs to help queue creatrion
 		present_queue = device.getQueue(indices.present_family, 0);
@@ -391,6 +587,9 @@ void VulkanApplication::createLogicalDevice()
 	{
 		present_queue = device.getQueue(indices.graphics_family, 2);
 	}
+
+	// uploads fall back to the graphics queue
+	transfer_queue = indices.transfer_family >= 0 ? device.getQueue(indices.transfer_family, 0) : graphics_queue;
 #endif // ONE_QUEUE
 
 }
@@ -410,7 +609,7 @@ void VulkanApplication::createCommandPools()
 		VkCommandPoolCreateInfo pool_info = {};
 		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		pool_info.queueFamilyIndex = indices.graphics_family;
-		pool_info.flags = 0; // Optional
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // per-frame upload command buffers are re-recorded
 			
 		graphics_queue_command_pool = VulkanRaii<vk::CommandPool>(
 			device.createCommandPool(pool_info, nullptr),
@@ -432,6 +631,20 @@ void VulkanApplication::createCommandPools()
 			);
 	}
 
+	// transfer_queue_command_pool
+	if (indices.transfer_family >= 0)
+	{
+		VkCommandPoolCreateInfo cmd_pool_info = {};
+		cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmd_pool_info.queueFamilyIndex = indices.transfer_family;
+		cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // one-time upload command buffers
+
+		transfer_queue_command_pool = VulkanRaii<vk::CommandPool>(
+			device.createCommandPool(cmd_pool_info, nullptr),
+			raii_commandpool_deleter
+			);
+	}
+
 }
 
 
@@ -474,13 +687,17 @@ std::vector<const char*> VulkanApplication::getRequiredExtensions()
 {
 	std::vector<const char*> extensions;
 
-	unsigned int glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-	for (unsigned int i = 0; i < glfwExtensionCount; i++)
+	// headless mode needs no surface extensions, and glfw is never initialized
+	if (!mScene->headless)
 	{
-		extensions.push_back(glfwExtensions[i]);
+		unsigned int glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+		for (unsigned int i = 0; i < glfwExtensionCount; i++)
+		{
+			extensions.push_back(glfwExtensions[i]);
+		}
 	}
 
 	if (ENABLE_VALIDATION_LAYERS)
@@ -495,6 +712,11 @@ bool VulkanApplication::isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR w
 {
 	QueueFamilyIndices indices = QueueFamilyIndices::findQueueFamilies(device, static_cast<VkSurfaceKHR>(window_surface));
 
+	if (mScene->headless)
+	{
+		return indices.isComplete(); // no swap chain needed
+	}
+
 	bool extensions_supported = checkDeviceExtensionSupport(device);
 
 	bool swap_chain_adequate = false;
@@ -537,6 +759,28 @@ void VulkanApplication::resize(int width, int height)
 
 void VulkanApplication::requestDraw(float deltatime)
 {
+	// wait until the gpu is done with the resources of this frame slot before overwriting them
+	auto& frame = frames[current_frame];
+	device.waitForFences(1, frame.in_flight_fence.data(), VK_TRUE, std::numeric_limits<uint64_t>::max());
+
+	// the queries of this slot are complete now, so reading them back does not stall
+	gpu_profiler.collect(static_cast<uint32_t>(current_frame));
+	if (mScene->benchmark)
+	{
+		benchmark.addLightIndexCount(*frame.mapped_light_index_count);
+	}
+
+	// the last light culling of this slot ran out of index list space, grow it so the next frames are complete
+	if (*frame.mapped_light_index_count > light_index_capacity)
+	{
+		light_index_capacity = *frame.mapped_light_index_count + *frame.mapped_light_index_count / 4;
+
+		vkDeviceWaitIdle(graphicsdevice);
+		createLightVisibilityBuffer();
+		createGraphicsCommandBuffers();
+		createLightCullingCommandBuffer();
+	}
+
 	updateUniformBuffers(deltatime);
 	drawFrame();
 }
@@ -554,6 +798,12 @@ void VulkanApplication::setCamera(const glm::mat4& view, const glm::vec3 campos)
 
 void VulkanApplication::createSwapChain()
 {
+	if (mScene->headless)
+	{
+		createOffscreenImages();
+		return;
+	}
+
 	auto support_details = SwapChainSupportDetails::querySwapChainSupport(physical_device, getWindowSurface());
 
 	VkSurfaceFormatKHR surface_format = utility->chooseSwapSurfaceFormat(support_details.formats);
@@ -620,6 +870,31 @@ void VulkanApplication::createSwapChain()
 	swap_chain_extent = extent;
 }
 
+void VulkanApplication::createOffscreenImages()
+{
+	swap_chain_image_format = VK_FORMAT_B8G8R8A8_UNORM;
+	swap_chain_extent = { mWidth, mHeight };
+
+	// one image per frame in flight, so frames never wait on each other's color target
+	offscreen_images.clear();
+	offscreen_image_memories.clear();
+	swap_chain_images.clear();
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		VulkanRaii<VkImage> image;
+		VulkanRaii<VkDeviceMemory> image_memory;
+		std::tie(image, image_memory) = utility->createImage(swap_chain_extent.width, swap_chain_extent.height
+			, swap_chain_image_format
+			, VK_IMAGE_TILING_OPTIMAL
+			, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT // to be read back for regression runs
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		swap_chain_images.push_back(image.get());
+		offscreen_images.push_back(std::move(image));
+		offscreen_image_memories.push_back(std::move(image_memory));
+	}
+}
+
 void VulkanApplication::createSwapChainImageViews()
 {
 	auto raii_deleter = [device = this->device](auto& obj)
@@ -668,14 +943,16 @@ void VulkanApplication::createRenderPasses()
 		subpass.colorAttachmentCount = 0;
 		subpass.pDepthStencilAttachment = &depth_attachment_ref;
 
-		// overwrite subpass dependency to make it wait until VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		// with several frames in flight the depth image is still being read by the previous frame's forward pass
+		// (and, through the light culling semaphore it waited on, by the previous frame's light culling),
+		// so wait for those reads before clearing it
 		VkSubpassDependency dependency = {};
 		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 		dependency.dstSubpass = 0; // 0  refers to the subpass
-		dependency.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-		dependency.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependency.srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+		dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
 		std::array<VkAttachmentDescription, 1> attachments = { depth_attachment };
 
@@ -707,6 +984,10 @@ void VulkanApplication::createRenderPasses()
 		color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // to be directly used in swap chain
+		if (mScene->headless)
+		{
+			color_attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL; // no swap chain, ready to be copied out
+		}
 
 		VkAttachmentDescription depth_attachment = {};
 		depth_attachment.format = utility->findDepthFormat();
@@ -844,6 +1125,28 @@ void VulkanApplication::createDescriptorSetLayouts()
 			set_layout_bindings.push_back(lb);
 		}
 
+		{
+			// packed light index list, a range of the light visibility buffer
+			VkDescriptorSetLayoutBinding lb = {};
+			lb.binding = 2;
+			lb.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lb.descriptorCount = 1;
+			lb.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+			lb.pImmutableSamplers = nullptr;
+			set_layout_bindings.push_back(lb);
+		}
+
+		{
+			// precomputed view space tile frustums, only read by light culling
+			VkDescriptorSetLayoutBinding lb = {};
+			lb.binding = 3;
+			lb.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lb.descriptorCount = 1;
+			lb.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			lb.pImmutableSamplers = nullptr;
+			set_layout_bindings.push_back(lb);
+		}
+
 		VkDescriptorSetLayoutCreateInfo layout_info = {};
 		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		layout_info.bindingCount = static_cast<uint32_t>(set_layout_bindings.size());
@@ -855,6 +1158,33 @@ void VulkanApplication::createDescriptorSetLayouts()
 			);
 	}
 
+	// meshlet_culling_descriptor_set_layout, the inputs and outputs of the meshlet culling compute pipeline
+	{
+		auto compute_binding = [](uint32_t binding, vk::DescriptorType type)
+		{
+			return vk::DescriptorSetLayoutBinding(binding, type, 1, vk::ShaderStageFlagBits::eCompute, nullptr);
+		};
+
+		std::array<vk::DescriptorSetLayoutBinding, 5> bindings = {
+			compute_binding(0, vk::DescriptorType::eUniformBuffer),  // model transform
+			compute_binding(1, vk::DescriptorType::eStorageBuffer),  // meshlets
+			compute_binding(2, vk::DescriptorType::eStorageBuffer),  // the model's indices
+			compute_binding(3, vk::DescriptorType::eStorageBuffer),  // culled indices
+			compute_binding(4, vk::DescriptorType::eStorageBuffer),  // draw commands
+		};
+
+		vk::DescriptorSetLayoutCreateInfo create_info = {
+			vk::DescriptorSetLayoutCreateFlags(), // flags
+			static_cast<uint32_t>(bindings.size()),
+			bindings.data()
+		};
+
+		meshlet_culling_descriptor_set_layout = VulkanRaii<vk::DescriptorSetLayout>(
+			device.createDescriptorSetLayout(create_info, nullptr),
+			raii_layout_deleter
+			);
+	}
+
 	// descriptor set layout for intermediate objects during render passes, such as z-buffer
 	{
 		// reads from depth attachment of previous frame
@@ -939,13 +1269,14 @@ void VulkanApplication::createGraphicsPipelines()
 
 	// create main pipeline
 	{
-		auto vert_shader_code = readFile(("Shaders/forwardplus_vert.spv"));
-		auto frag_shader_code = readFile(("Shaders/forwardplus_frag.spv"));
+		auto vert_shader_code = readShaderFile("Shaders/forwardplus_vert.spv", "Shaders/forwardplus.vert");
+		auto frag_shader_code = readShaderFile("Shaders/forwardplus_frag.spv", "Shaders/forwardplus.frag");
 		// auto light_culling_comp_shader_code = util::readFile(util::getContentPath("light_culling.comp.spv"));
 
 
 
 		auto vert_shader_module = createShaderModule(vert_shader_code);
+		requireSpecConstant(frag_shader_code, 0, "forwardplus_frag.spv");
 		auto frag_shader_module = createShaderModule(frag_shader_code);
 
 
@@ -955,11 +1286,17 @@ void VulkanApplication::createGraphicsPipelines()
 		vert_shader_stage_info.module = vert_shader_module.get();
 		vert_shader_stage_info.pName = "main";
 
+		// picks tiled or clustered light lookup in the fragment shader
+		int32_t cluster_depth_slices = mScene->cluster_depth_slices;
+		VkSpecializationMapEntry cluster_depth_slices_entry = { 0, 0, sizeof(int32_t) };
+		VkSpecializationInfo frag_specialization_info = { 1, &cluster_depth_slices_entry, sizeof(int32_t), &cluster_depth_slices };
+
 		VkPipelineShaderStageCreateInfo frag_shader_stage_info = {};
 		frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		frag_shader_stage_info.module = frag_shader_module.get();
 		frag_shader_stage_info.pName = "main";
+		frag_shader_stage_info.pSpecializationInfo = &frag_specialization_info;
 
 		VkPipelineShaderStageCreateInfo shaderStages[] = { vert_shader_stage_info, frag_shader_stage_info };
 
@@ -967,13 +1304,20 @@ void VulkanApplication::createGraphicsPipelines()
 		VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
 		vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-		auto binding_description = Utilities::getVertexBindingDesciption();
-		auto attr_description = Utilities::getVertexAttributeDescriptions();
+		// positions from binding 0 and the other attributes from binding 1
+		std::array<VkVertexInputBindingDescription, 2> binding_descriptions = {
+			VertexFormatTraits<PackedPosition>::getBindingDescription(0),
+			VertexFormatTraits<PackedAttributes>::getBindingDescription(1)
+		};
+		auto position_attr_descriptions = VertexFormatTraits<PackedPosition>::getAttributeDescriptions(0);
+		auto other_attr_descriptions = VertexFormatTraits<PackedAttributes>::getAttributeDescriptions(1, VertexFormatTraits<PackedPosition>::attribute_count);
+		std::vector<VkVertexInputAttributeDescription> attr_descriptions(position_attr_descriptions.begin(), position_attr_descriptions.end());
+		attr_descriptions.insert(attr_descriptions.end(), other_attr_descriptions.begin(), other_attr_descriptions.end());
 
-		vertex_input_info.vertexBindingDescriptionCount = 1;
-		vertex_input_info.pVertexBindingDescriptions = &binding_description;
-		vertex_input_info.vertexAttributeDescriptionCount = (uint32_t)attr_description.size();
-		vertex_input_info.pVertexAttributeDescriptions = attr_description.data(); // Optional
+		vertex_input_info.vertexBindingDescriptionCount = static_cast<uint32_t>(binding_descriptions.size());
+		vertex_input_info.pVertexBindingDescriptions = binding_descriptions.data();
+		vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attr_descriptions.size());
+		vertex_input_info.pVertexAttributeDescriptions = attr_descriptions.data();
 
 		// input assembler
 		VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {};
@@ -1064,19 +1408,21 @@ void VulkanApplication::createGraphicsPipelines()
 		dynamic_state_info.dynamicStateCount = 2;
 		dynamic_state_info.pDynamicStates = dynamicStates;
 
-		VkPushConstantRange push_constant_range = {};
-		push_constant_range.offset = 0;
-		push_constant_range.size = sizeof(PushConstantObject);
-		push_constant_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		std::array<VkPushConstantRange, 2> push_constant_ranges = {};
+		push_constant_ranges[0].offset = 0;
+		push_constant_ranges[0].size = sizeof(VertexPushConstantObject);
+		push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		push_constant_ranges[1].offset = sizeof(VertexPushConstantObject);
+		push_constant_ranges[1].size = sizeof(PushConstantObject);
+		push_constant_ranges[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-		// no uniform variables or push constants
 		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
 		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 		std::vector<VkDescriptorSetLayout> set_layouts = { object_descriptor_set_layout.get(), camera_descriptor_set_layout.get(), light_culling_descriptor_set_layout.get(), intermediate_descriptor_set_layout.get(), material_descriptor_set_layout.get() };
 		pipeline_layout_info.setLayoutCount = static_cast<uint32_t>(set_layouts.size()); // Optional
 		pipeline_layout_info.pSetLayouts = set_layouts.data(); // Optional
-		pipeline_layout_info.pushConstantRangeCount = 1; // Optional
-		pipeline_layout_info.pPushConstantRanges = &push_constant_range; // Optional
+		pipeline_layout_info.pushConstantRangeCount = static_cast<uint32_t>(push_constant_ranges.size());
+		pipeline_layout_info.pPushConstantRanges = push_constant_ranges.data();
 
 		VkPipelineLayout temp_layout;
 		auto pipeline_layout_result = vkCreatePipelineLayout(graphicsdevice, &pipeline_layout_info, nullptr,
@@ -1122,10 +1468,17 @@ void VulkanApplication::createGraphicsPipelines()
 		{
 
 			VkPipelineDepthStencilStateCreateInfo pre_pass_depth_stencil = { depth_stencil };
+
+			// only the position stream
+			VkPipelineVertexInputStateCreateInfo depth_vertex_input_info = vertex_input_info;
+			depth_vertex_input_info.vertexBindingDescriptionCount = 1;
+			depth_vertex_input_info.pVertexBindingDescriptions = binding_descriptions.data();
+			depth_vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(position_attr_descriptions.size());
+			depth_vertex_input_info.pVertexAttributeDescriptions = position_attr_descriptions.data();
 			pre_pass_depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
 			pre_pass_depth_stencil.depthWriteEnable = VK_TRUE;
 
-			auto depth_vert_shader_code = readFile("Shaders/depth_vert.spv");
+			auto depth_vert_shader_code = readShaderFile("Shaders/depth_vert.spv", "Shaders/depth.vert");
 			// auto light_culling_comp_shader_code = util::readFile(util::getContentPath("light_culling.comp.spv"));
 			auto depth_vert_shader_module = createShaderModule(depth_vert_shader_code);
 			VkPipelineShaderStageCreateInfo depth_vert_shader_stage_info = {};
@@ -1136,13 +1489,14 @@ void VulkanApplication::createGraphicsPipelines()
 			VkPipelineShaderStageCreateInfo depth_shader_stages[] = { depth_vert_shader_stage_info };
 
 			std::array<vk::DescriptorSetLayout, 2> depth_set_layouts = { object_descriptor_set_layout.get(), camera_descriptor_set_layout.get() };
+			vk::PushConstantRange depth_push_constant_range = { vk::ShaderStageFlagBits::eVertex, 0, sizeof(VertexPushConstantObject) };
 
 			vk::PipelineLayoutCreateInfo depth_layout_info = {
 				vk::PipelineLayoutCreateFlags(),  // flags
 				static_cast<uint32_t>(depth_set_layouts.size()),  // setLayoutCount
 				depth_set_layouts.data(),  // setlayouts
-				0,  // pushConstantRangeCount
-				nullptr // pushConstantRanges
+				1,  // pushConstantRangeCount
+				&depth_push_constant_range // pushConstantRanges
 			};
 			depth_pipeline_layout = VulkanRaii<vk::PipelineLayout>(
 				device.createPipelineLayout(depth_layout_info, nullptr),
@@ -1154,7 +1508,7 @@ void VulkanApplication::createGraphicsPipelines()
 			depth_pipeline_info.stageCount = 1;
 			depth_pipeline_info.pStages = depth_shader_stages;
 
-			depth_pipeline_info.pVertexInputState = &vertex_input_info;
+			depth_pipeline_info.pVertexInputState = &depth_vertex_input_info;
 			depth_pipeline_info.pInputAssemblyState = &input_assembly_info;
 			depth_pipeline_info.pViewportState = &viewport_state_info;
 			depth_pipeline_info.pRasterizationState = &rasterizer;
@@ -1267,7 +1621,7 @@ void VulkanApplication::createTextureSampler()
 	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	sampler_info.mipLodBias = 0.0f;
 	sampler_info.minLod = 0.0f;
-	sampler_info.maxLod = 0.0f;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE; // the full chain of every texture
 
 	VkSampler sampler;
 	if (vkCreateSampler(graphicsdevice, &sampler_info, nullptr, &sampler) != VK_SUCCESS)
@@ -1310,14 +1664,12 @@ void VulkanApplication::createUniformBuffers()
 		utility->copyBuffer(object_staging_buffer.get(), object_uniform_buffer.get(), sizeof(ubo));
 	}
 
-	// create buffers for camera
+	// create buffers for camera, one per frame in flight. They are filled from the upload ring
+	for (auto& frame : frames)
 	{
 		VkDeviceSize bufferSize = sizeof(CameraUbo);
 
-		std::tie(camera_staging_buffer, camera_staging_buffer_memory) = utility->createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		std::tie(camera_uniform_buffer, camera_uniform_buffer_memory) = utility->createBuffer(bufferSize
+		std::tie(frame.camera_uniform_buffer, frame.camera_uniform_buffer_memory) = utility->createBuffer(bufferSize
 			, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT  // FIXME: change back to uniform
 			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 			, queue_family_indices.graphics_family
@@ -1337,13 +1689,66 @@ void VulkanApplication::createLights()
 
 	pointlight_buffer_size = sizeof(PointLight) * MAX_POINT_LIGHT_COUNT + sizeof(glm::vec4); // vec4 rather than int for padding
 
-	std::tie(lights_staging_buffer, lights_staging_buffer_memory) = utility->createBuffer(pointlight_buffer_size
-		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	for (auto& frame : frames)
+	{
+		std::tie(frame.pointlight_buffer, frame.pointlight_buffer_memory) = utility->createBuffer(pointlight_buffer_size
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT  // FIXME: change back to uniform
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT); // using barrier to sync
+	}
+}
+
+void VulkanApplication::createBenchmark()
+{
+	if (!mScene->benchmark)
+	{
+		return;
+	}
 
-	std::tie(pointlight_buffer, pointlight_buffer_memory) = utility->createBuffer(pointlight_buffer_size
-		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT  // FIXME: change back to uniform
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT); // using barrier to sync
+	std::srand(mScene->benchmark_seed); // glm::linearRand draws from std::rand, so every run places the same lights
+	benchmark = VBenchmark(*mScene);
+}
+
+void VulkanApplication::createUploadRing()
+{
+	// room for one camera ubo and a full point light buffer per frame
+	const VkDeviceSize alignment = 256;
+	VkDeviceSize frame_capacity = ((sizeof(CameraUbo) + pointlight_buffer_size) / alignment + 2) * alignment;
+
+	upload_ring = VUploadRing(*utility, graphicsdevice, frame_capacity, static_cast<uint32_t>(frames.size()));
+
+	for (auto& frame : frames)
+	{
+		vk::CommandBufferAllocateInfo alloc_info = {
+			graphics_command_pool, // command pool
+			vk::CommandBufferLevel::ePrimary, // level
+			1 // commandBufferCount
+		};
+
+		frame.upload_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
+	}
+}
+
+void VulkanApplication::createGpuProfiler()
+{
+	if (!mScene->gpu_profiler && !mScene->benchmark)
+	{
+		return; // stays disabled, recording and collecting are no-ops
+	}
+
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+
+	// a benchmark keeps every measured frame
+	size_t history_length = mScene->benchmark ? std::max<size_t>(512, mScene->benchmark_measured_frames) : 512;
+
+	// the compute queue belongs to the graphics family too
+	gpu_profiler = VGpuProfiler(graphicsdevice, physical_device, static_cast<uint32_t>(queue_family_indices.graphics_family)
+		, static_cast<uint32_t>(frames.size()), supported_features.pipelineStatisticsQuery == VK_TRUE, history_length);
+
+	if (!gpu_profiler.isEnabled())
+	{
+		std::cout << "GPU profiler unavailable, the graphics queue family has no timestamp support" << std::endl;
+	}
 }
 
 void VulkanApplication::createDescriptorPool()
@@ -1356,7 +1761,9 @@ void VulkanApplication::createDescriptorPool()
 	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	pool_sizes[1].descriptorCount = 100; // sampler for color map and normal map and depth map from depth prepass... and so many from scene materials
 	pool_sizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	pool_sizes[2].descriptorCount = 3; // light visiblity buffer in graphics pipeline and compute pipeline
+	// camera, tile light ranges, light index list, point light and tile frustum buffers of each frame,
+	// plus the meshlets, model indices, culled indices and draw commands of each frame's meshlet culling
+	pool_sizes[2].descriptorCount = 9 * static_cast<uint32_t>(frames.size());
 
 	VkDescriptorPoolCreateInfo pool_info = {};
 	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1424,41 +1831,44 @@ void VulkanApplication::createSceneObjectDescriptorSet()
 
 void VulkanApplication::createCameraDescriptorSet()
 {
-	// Create descriptor set
+	for (auto& frame : frames)
 	{
-		vk::DescriptorSetAllocateInfo alloc_info = {
-			descriptor_pool.get(),  // descriptorPool
-			1,  // descriptorSetCount
-			camera_descriptor_set_layout.data(), // pSetLayouts
-		};
-
-		camera_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
-	}
+		// Create descriptor set
+		{
+			vk::DescriptorSetAllocateInfo alloc_info = {
+				descriptor_pool.get(),  // descriptorPool
+				1,  // descriptorSetCount
+				camera_descriptor_set_layout.data(), // pSetLayouts
+			};
 
-	// Write desciptor set
-	{
-		// refer to the uniform object buffer
-		vk::DescriptorBufferInfo camera_uniform_buffer_info{
-			camera_uniform_buffer.get(), // buffer_
-			0, //offset_
-			sizeof(CameraUbo) // range_
-		};
+			frame.camera_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+		}
 
-		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+		// Write desciptor set
+		{
+			// refer to the uniform object buffer
+			vk::DescriptorBufferInfo camera_uniform_buffer_info{
+				frame.camera_uniform_buffer.get(), // buffer_
+				0, //offset_
+				sizeof(CameraUbo) // range_
+			};
 
-		descriptor_writes.emplace_back(
-			camera_descriptor_set, // dstSet
-			0, // dstBinding
-			0, // distArrayElement
-			1, // descriptorCount
-			vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
-			nullptr, //pImageInfo
-			&camera_uniform_buffer_info, //pBufferInfo
-			nullptr //pTexBufferView
-		);
+			std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+
+			descriptor_writes.emplace_back(
+				frame.camera_descriptor_set, // dstSet
+				0, // dstBinding
+				0, // distArrayElement
+				1, // descriptorCount
+				vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
+				nullptr, //pImageInfo
+				&camera_uniform_buffer_info, //pBufferInfo
+				nullptr //pTexBufferView
+			);
 
-		std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
-		device.updateDescriptorSets(descriptor_writes, descriptor_copies);
+			std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
+			device.updateDescriptorSets(descriptor_writes, descriptor_copies);
+		}
 	}
 }
 
@@ -1507,190 +1917,256 @@ void VulkanApplication::updateIntermediateDescriptorSet()
 
 void VulkanApplication::createDepthPrePassCommandBuffer()
 {
-	if (depth_prepass_command_buffer)
+	for (uint32_t frame_index = 0; frame_index < frames.size(); frame_index++)
 	{
-		device.freeCommandBuffers(graphics_command_pool, 1, &depth_prepass_command_buffer);
-		depth_prepass_command_buffer = nullptr;
-	}
+		auto& frame = frames[frame_index];
+		if (frame.depth_prepass_command_buffer)
+		{
+			device.freeCommandBuffers(graphics_command_pool, 1, &frame.depth_prepass_command_buffer);
+			frame.depth_prepass_command_buffer = nullptr;
+		}
 
-	// Create depth pre-pass command buffer
-	{
-		vk::CommandBufferAllocateInfo alloc_info = {
-			graphics_command_pool, // command pool
-			vk::CommandBufferLevel::ePrimary, // level
-			1 // commandBufferCount
-		};
+		// Create depth pre-pass command buffer
+		{
+			vk::CommandBufferAllocateInfo alloc_info = {
+				graphics_command_pool, // command pool
+				vk::CommandBufferLevel::ePrimary, // level
+				1 // commandBufferCount
+			};
 
-		depth_prepass_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
-	}
+			frame.depth_prepass_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
+		}
 
-	// Begin command
-	{
-		vk::CommandBufferBeginInfo begin_info =
+		// Begin command
 		{
-			vk::CommandBufferUsageFlagBits::eSimultaneousUse,
-			nullptr
-		};
-
-		auto command = depth_prepass_command_buffer;
+			vk::CommandBufferBeginInfo begin_info =
+			{
+				vk::CommandBufferUsageFlagBits::eSimultaneousUse,
+				nullptr
+			};
 
-		command.begin(begin_info);
+			auto command = frame.depth_prepass_command_buffer;
 
-		std::array<vk::ClearValue, 1> clear_values = {};
-		clear_values[0].depthStencil = vk::ClearDepthStencilValue(1.0f, 0); // 1.0 is far view plane
-		vk::RenderPassBeginInfo depth_pass_info = {
-			depth_pre_pass.get(),
-			depth_pre_pass_framebuffer.get(),
-			vk::Rect2D({ 0,0 }, swap_chain_extent),
-			static_cast<uint32_t>(clear_values.size()),
-			clear_values.data()
-		};
-		command.beginRenderPass(&depth_pass_info, vk::SubpassContents::eInline);
+			command.begin(begin_info);
 
-		for (const auto& part : model.getMeshParts())
-		{
-			command.bindPipeline(vk::PipelineBindPoint::eGraphics, depth_pipeline.get());
+			// recorded when off as well, so every pass has its queries
+			gpu_profiler.recordBegin(command, frame_index, VGpuProfiler::MESHLET_CULLING);
+			if (meshlet_culling)
+			{
+				recordMeshletCulling(command, frame);
+			}
+			gpu_profiler.recordEnd(command, frame_index, VGpuProfiler::MESHLET_CULLING);
+
+			gpu_profiler.recordBegin(command, frame_index, VGpuProfiler::DEPTH_PREPASS);
+
+			std::array<vk::ClearValue, 1> clear_values = {};
+			clear_values[0].depthStencil = vk::ClearDepthStencilValue(1.0f, 0); // 1.0 is far view plane
+			vk::RenderPassBeginInfo depth_pass_info = {
+				depth_pre_pass.get(),
+				depth_pre_pass_framebuffer.get(),
+				vk::Rect2D({ 0,0 }, swap_chain_extent),
+				static_cast<uint32_t>(clear_values.size()),
+				clear_values.data()
+			};
+			command.beginRenderPass(&depth_pass_info, vk::SubpassContents::eInline);
 
-			std::array<vk::DescriptorSet, 2> depth_descriptor_sets = { object_descriptor_set, camera_descriptor_set };
-			std::array<uint32_t, 0> depth_dynamic_offsets;
-			command.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, depth_pipeline_layout.get(), 0, depth_descriptor_sets, depth_dynamic_offsets);
+			const auto& mesh_parts = model.getMeshParts();
+			for (size_t part_index = 0; part_index < mesh_parts.size(); part_index++)
+			{
+				const auto& part = mesh_parts[part_index];
+				command.bindPipeline(vk::PipelineBindPoint::eGraphics, depth_pipeline.get());
+
+				std::array<vk::DescriptorSet, 2> depth_descriptor_sets = { object_descriptor_set, frame.camera_descriptor_set };
+				std::array<uint32_t, 0> depth_dynamic_offsets;
+				command.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, depth_pipeline_layout.get(), 0, depth_descriptor_sets, depth_dynamic_offsets);
+
+				std::array<vk::Buffer, 1> depth_vertex_buffers = { part.position_buffer_section.buffer };
+				std::array<vk::DeviceSize, 1> depth_offsets = { part.position_buffer_section.offset };
+				command.bindVertexBuffers(0, depth_vertex_buffers, depth_offsets);
+
+				VertexPushConstantObject vertex_pco(part.position_bounds);
+				command.pushConstants(depth_pipeline_layout.get(), vk::ShaderStageFlagBits::eVertex, 0, sizeof(vertex_pco), &vertex_pco);
+
+				if (meshlet_culling)
+				{
+					// the indices of the part's visible meshlets, counted by the culling shader
+					command.bindIndexBuffer(static_cast<vk::Buffer>(frame.culled_index_buffer.get()), part.culled_index_offset, part.index_type);
+					command.drawIndexedIndirect(static_cast<vk::Buffer>(frame.meshlet_draw_command_buffer.get())
+						, sizeof(MeshletDrawCommand) * part_index, 1, sizeof(MeshletDrawCommand));
+				}
+				else
+				{
+					command.bindIndexBuffer(part.index_buffer_section.buffer, part.index_buffer_section.offset, part.index_type);
+					command.drawIndexed(static_cast<uint32_t>(part.index_count), 1, 0, part.vertex_offset, 0);
+				}
+			}
+			command.endRenderPass();
 
-			std::array<vk::Buffer, 1> depth_vertex_buffers = { part.vertex_buffer_section.buffer };
-			std::array<vk::DeviceSize, 1> depth_offsets = { part.vertex_buffer_section.offset };
-			command.bindVertexBuffers(0, depth_vertex_buffers, depth_offsets);
-			command.bindIndexBuffer(part.index_buffer_section.buffer, part.index_buffer_section.offset, vk::IndexType::eUint32);
+			gpu_profiler.recordEnd(command, frame_index, VGpuProfiler::DEPTH_PREPASS);
+			command.end();
 
-			command.drawIndexed(static_cast<uint32_t>(part.index_count), 1, 0, 0, 0);
 		}
-		command.endRenderPass();
-
-		command.end();
-
 	}
-
 }
 
 void VulkanApplication::createGraphicsCommandBuffers()
 {
-	// Free old command buffers, if any
-	if (command_buffers.size() > 0)
+	for (uint32_t frame_index = 0; frame_index < frames.size(); frame_index++)
 	{
-		vkFreeCommandBuffers(graphicsdevice, graphics_command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
-	}
-	command_buffers.clear();
-
-	command_buffers.resize(swap_chain_framebuffers.size());
+		auto& frame = frames[frame_index];
+		auto& command_buffers = frame.command_buffers;
 
-	VkCommandBufferAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	alloc_info.commandPool = graphics_command_pool;
-	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	// primary: can be submitted to a queue but cannot be called from other command buffers
-	// secondary: can be called by others but cannot be submitted to a queue
-	alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+		// Free old command buffers, if any
+		if (command_buffers.size() > 0)
+		{
+			vkFreeCommandBuffers(graphicsdevice, graphics_command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
+		}
+		command_buffers.clear();
 
-	if (vkAllocateCommandBuffers(graphicsdevice, &alloc_info, command_buffers.data()) != VK_SUCCESS)
-	{
-		throw std::runtime_error("failed to allocate command buffers!");
-	}
+		command_buffers.resize(swap_chain_framebuffers.size());
 
-	// record command buffers
-	for (size_t i = 0; i < command_buffers.size(); i++)
-	{
-		VkCommandBufferBeginInfo begin_info = {};
-		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		begin_info.pInheritanceInfo = nullptr; // Optional
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = graphics_command_pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		// primary: can be submitted to a queue but cannot be called from other command buffers
+		// secondary: can be called by others but cannot be submitted to a queue
+		alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
 
-		vkBeginCommandBuffer(command_buffers[i], &begin_info);
+		if (vkAllocateCommandBuffers(graphicsdevice, &alloc_info, command_buffers.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
 
-		// render pass
+		// record command buffers
+		for (size_t i = 0; i < command_buffers.size(); i++)
 		{
-			VkRenderPassBeginInfo render_pass_info = {};
-			render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			render_pass_info.renderPass = render_pass.get();
-			render_pass_info.framebuffer = swap_chain_framebuffers[i].get();
-			render_pass_info.renderArea.offset = { 0, 0 };
-			render_pass_info.renderArea.extent = swap_chain_extent;
-
-			std::array<VkClearValue, 1> clear_values = {};
-			clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-			//clear_values[1].depthStencil = { 1.0f, 0 }; // don't clear with depth prepass
-			render_pass_info.clearValueCount = (uint32_t)clear_values.size();
-			render_pass_info.pClearValues = clear_values.data();
-
-			vkCmdBeginRenderPass(command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
-			PushConstantObject pco = {
-				static_cast<int>(swap_chain_extent.width),
-				static_cast<int>(swap_chain_extent.height),
-				tile_count_per_row, tile_count_per_col,
-				debug_view_index
-			};
-			vkCmdPushConstants(command_buffers[i], pipeline_layout.get(), VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pco), &pco);
+			VkCommandBufferBeginInfo begin_info = {};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+			begin_info.pInheritanceInfo = nullptr; // Optional
+
+			vkBeginCommandBuffer(command_buffers[i], &begin_info);
+			gpu_profiler.recordBegin(command_buffers[i], frame_index, VGpuProfiler::FORWARD);
 
+			// render pass
+			{
+				VkRenderPassBeginInfo render_pass_info = {};
+				render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+				render_pass_info.renderPass = render_pass.get();
+				render_pass_info.framebuffer = swap_chain_framebuffers[i].get();
+				render_pass_info.renderArea.offset = { 0, 0 };
+				render_pass_info.renderArea.extent = swap_chain_extent;
 
-			vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline.get());
+				std::array<VkClearValue, 1> clear_values = {};
+				clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+				//clear_values[1].depthStencil = { 1.0f, 0 }; // don't clear with depth prepass
+				render_pass_info.clearValueCount = (uint32_t)clear_values.size();
+				render_pass_info.pClearValues = clear_values.data();
 
-			std::array<VkDescriptorSet, 4> descriptor_sets = { object_descriptor_set, camera_descriptor_set, light_culling_descriptor_set, intermediate_descriptor_set };
-			vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
-				, pipeline_layout.get(), 0, static_cast<uint32_t>(descriptor_sets.size()), descriptor_sets.data(), 0, nullptr);
+				vkCmdBeginRenderPass(command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
 
-			for (const auto& part : model.getMeshParts())
-			{
+				PushConstantObject pco = {
+					static_cast<int>(swap_chain_extent.width),
+					static_cast<int>(swap_chain_extent.height),
+					tile_count_per_row, tile_count_per_col,
+					debug_view_index
+				};
+				vkCmdPushConstants(command_buffers[i], pipeline_layout.get(), VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(VertexPushConstantObject), sizeof(pco), &pco);
 
-				// bind vertex buffer
-				VkBuffer vertex_buffers[] = { part.vertex_buffer_section.buffer };
-				VkDeviceSize offsets[] = { part.vertex_buffer_section.offset };
-				vkCmdBindVertexBuffers(command_buffers[i], 0, 1, vertex_buffers, offsets);
-				//vkCmdBindIndexBuffer(command_buffers[i], index_buffer, 0, VK_INDEX_TYPE_UINT16);
-				vkCmdBindIndexBuffer(command_buffers[i], part.index_buffer_section.buffer, part.index_buffer_section.offset, VK_INDEX_TYPE_UINT32);
 
-				std::array<VkDescriptorSet, 1> mesh_descriptor_sets = { part.material_descriptor_set };
+				vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline.get());
+
+				std::array<VkDescriptorSet, 4> descriptor_sets = { object_descriptor_set, frame.camera_descriptor_set, frame.light_culling_descriptor_set, intermediate_descriptor_set };
 				vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
-					, pipeline_layout.get(), static_cast<uint32_t>(descriptor_sets.size()), static_cast<uint32_t>(mesh_descriptor_sets.size()), mesh_descriptor_sets.data(), 0, nullptr);
+					, pipeline_layout.get(), 0, static_cast<uint32_t>(descriptor_sets.size()), descriptor_sets.data(), 0, nullptr);
+
+				const auto& mesh_parts = model.getMeshParts();
+				for (size_t part_index = 0; part_index < mesh_parts.size(); part_index++)
+				{
+					const auto& part = mesh_parts[part_index];
+
+					// bind vertex buffer
+					VkBuffer vertex_buffers[] = { part.position_buffer_section.buffer, part.vertex_buffer_section.buffer };
+					VkDeviceSize offsets[] = { part.position_buffer_section.offset, part.vertex_buffer_section.offset };
+					vkCmdBindVertexBuffers(command_buffers[i], 0, 2, vertex_buffers, offsets);
+
+					VertexPushConstantObject vertex_pco(part.position_bounds);
+					vkCmdPushConstants(command_buffers[i], pipeline_layout.get(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vertex_pco), &vertex_pco);
+
+					std::array<VkDescriptorSet, 1> mesh_descriptor_sets = { part.material_descriptor_set };
+					vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
+						, pipeline_layout.get(), static_cast<uint32_t>(descriptor_sets.size()), static_cast<uint32_t>(mesh_descriptor_sets.size()), mesh_descriptor_sets.data(), 0, nullptr);
+
+					//vkCmdDraw(command_buffers[i], VERTICES.size(), 1, 0, 0);
+					if (meshlet_culling)
+					{
+						// the same culled indices as the depth pre-pass, whose command buffer ran the culling
+						vkCmdBindIndexBuffer(command_buffers[i], frame.culled_index_buffer.get(), part.culled_index_offset, static_cast<VkIndexType>(part.index_type));
+						vkCmdDrawIndexedIndirect(command_buffers[i], frame.meshlet_draw_command_buffer.get()
+							, sizeof(MeshletDrawCommand) * part_index, 1, sizeof(MeshletDrawCommand));
+					}
+					else
+					{
+						//vkCmdBindIndexBuffer(command_buffers[i], index_buffer, 0, VK_INDEX_TYPE_UINT16);
+						vkCmdBindIndexBuffer(command_buffers[i], part.index_buffer_section.buffer, part.index_buffer_section.offset, static_cast<VkIndexType>(part.index_type));
+						vkCmdDrawIndexed(command_buffers[i], static_cast<uint32_t>(part.index_count), 1, 0, part.vertex_offset, 0);
+					}
+				}
+				vkCmdEndRenderPass(command_buffers[i]);
+				//utility.recordTransitImageLayout(command_buffers[i], pre_pass_depth_image.get(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
-				//vkCmdDraw(command_buffers[i], VERTICES.size(), 1, 0, 0);
-				vkCmdDrawIndexed(command_buffers[i], static_cast<uint32_t>(part.index_count), 1, 0, 0, 0);
 			}
-			vkCmdEndRenderPass(command_buffers[i]);
-			//utility.recordTransitImageLayout(command_buffers[i], pre_pass_depth_image.get(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
-		}
+			gpu_profiler.recordEnd(command_buffers[i], frame_index, VGpuProfiler::FORWARD);
 
-		auto record_result = vkEndCommandBuffer(command_buffers[i]);
-		if (record_result != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to record command buffer!");
+			auto record_result = vkEndCommandBuffer(command_buffers[i]);
+			if (record_result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to record command buffer!");
+			}
 		}
 	}
 }
 
-void VulkanApplication::createSemaphores()
+void VulkanApplication::createSyncObjects()
 {
 	vk::SemaphoreCreateInfo semaphore_info = { vk::SemaphoreCreateFlags() };
+	// created signaled so the first wait on each frame slot returns immediately
+	vk::FenceCreateInfo fence_info = { vk::FenceCreateFlagBits::eSignaled };
 
 	auto destroy_func = [&device = this->device](auto& obj)
 	{
 		device.destroySemaphore(obj);
 	};
+	auto destroy_fence_func = [&device = this->device](auto& obj)
+	{
+		device.destroyFence(obj);
+	};
 
-	render_finished_semaphore = VulkanRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-		);
-	image_available_semaphore = VulkanRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-		);
-	lightculling_completed_semaphore = VulkanRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-		);
-	depth_prepass_finished_semaphore = VulkanRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-		);
+	for (auto& frame : frames)
+	{
+		frame.render_finished_semaphore = VulkanRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+			);
+		frame.image_available_semaphore = VulkanRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+			);
+		frame.lightculling_completed_semaphore = VulkanRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+			);
+		frame.depth_prepass_finished_semaphore = VulkanRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+			);
+		frame.in_flight_fence = VulkanRaii<vk::Fence>(
+			device.createFence(fence_info, nullptr),
+			destroy_fence_func
+			);
+	}
 }
 
 void VulkanApplication::createComputePipeline()
@@ -1723,14 +2199,22 @@ void VulkanApplication::createComputePipeline()
 		GResult(vkCreatePipelineLayout(graphicsdevice, &pipeline_layout_info, nullptr, &temp_layout));
 		compute_pipeline_layout = VulkanRaii<VkPipelineLayout>(temp_layout, raii_pipeline_layout_deleter);
 
-		auto light_culling_comp_shader_code = readFile("Shaders/light_culling_comp.spv");
+		auto light_culling_comp_shader_code = readShaderFile("Shaders/light_culling_comp.spv", "Shaders/light_culling.comp.glsl");
+
+		// 0 for 2D tiled culling, otherwise one workgroup per cluster with this many exponential depth slices
+		int32_t cluster_depth_slices = mScene->cluster_depth_slices;
+		VkSpecializationMapEntry cluster_depth_slices_entry = { 0, 0, sizeof(int32_t) };
+		VkSpecializationInfo comp_specialization_info = { 1, &cluster_depth_slices_entry, sizeof(int32_t), &cluster_depth_slices };
 
+		requireSpecConstant(light_culling_comp_shader_code, 0, "light_culling_comp.spv");
+		requireDescriptorBinding(light_culling_comp_shader_code, 0, 3, "light_culling_comp.spv"); // tile frustums, the light culling set is set 0 in the compute layout
 		auto comp_shader_module = createShaderModule(light_culling_comp_shader_code);
 		VkPipelineShaderStageCreateInfo comp_shader_stage_info = {};
 		comp_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		comp_shader_stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
 		comp_shader_stage_info.module = comp_shader_module.get();
 		comp_shader_stage_info.pName = "main";
+		comp_shader_stage_info.pSpecializationInfo = &comp_specialization_info;
 
 		VkComputePipelineCreateInfo pipeline_create_info;
 		pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -1750,6 +2234,7 @@ void VulkanApplication::createComputePipeline()
 void VulkanApplication::createLigutCullingDescriptorSet()
 {
 	// create shared dercriptor set between compute pipeline and rendering pipeline
+	for (auto& frame : frames)
 	{
 		// todo: reduce code duplication with createDescriptorSet()
 		VkDescriptorSetLayout layouts[] = { light_culling_descriptor_set_layout.get() };
@@ -1759,199 +2244,553 @@ void VulkanApplication::createLigutCullingDescriptorSet()
 		alloc_info.descriptorSetCount = 1;
 		alloc_info.pSetLayouts = layouts;
 
-		light_culling_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+		frame.light_culling_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
 	}
 
 }
 
-struct _Dummy_VisibleLightsForTile
-{
-	uint32_t count;
-	std::array<uint32_t, MAX_POINT_LIGHT_PER_TILE> lightindices;
-};
-
 void VulkanApplication::createLightVisibilityBuffer()
 {
-	assert(sizeof(_Dummy_VisibleLightsForTile) == sizeof(int) * (MAX_POINT_LIGHT_PER_TILE + 1));
-
 	tile_count_per_row = (swap_chain_extent.width - 1) / TILE_SIZE + 1;
 	tile_count_per_col = (swap_chain_extent.height - 1) / TILE_SIZE + 1;
+	cluster_count_per_tile = std::max(1, mScene->cluster_depth_slices);
+	auto tile_count = static_cast<uint32_t>(tile_count_per_row * tile_count_per_col);
+	auto cluster_count = tile_count * static_cast<uint32_t>(cluster_count_per_tile);
+
+	// layout: uvec4 header (requested index count, capacity), one TileLightRange per tile or cluster, then the packed index list
+	// the index list is budgeted per tile either way, clusters split a tile's lights between them
+	light_index_capacity = std::max(light_index_capacity, tile_count * AVERAGE_POINT_LIGHT_PER_TILE);
+	tile_light_ranges_size = sizeof(glm::uvec4) + sizeof(TileLightRange) * cluster_count;
 
-	light_visibility_buffer_size = sizeof(_Dummy_VisibleLightsForTile) * tile_count_per_row * tile_count_per_col;
+	updateTileFrustumBuffer();
 
-	std::tie(light_visibility_buffer, light_visibility_buffer_memory) = utility->createBuffer(
-		light_visibility_buffer_size
-		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-	); // using barrier to sync
+	auto alignment = physical_device_properties.limits.minStorageBufferOffsetAlignment;
+	light_index_list_offset = ((tile_light_ranges_size - 1) / alignment + 1) * alignment;
+	light_visibility_buffer_size = light_index_list_offset + sizeof(uint32_t) * light_index_capacity;
 
-	// Write desciptor set in compute shader
+	for (auto& frame : frames)
 	{
-		// refer to the uniform object buffer
-		vk::DescriptorBufferInfo light_visibility_buffer_info{
-			light_visibility_buffer.get(), // buffer_
-			0, //offset_
-			light_visibility_buffer_size // range_
-		};
+		std::tie(frame.light_visibility_buffer, frame.light_visibility_buffer_memory) = utility->createBuffer(
+			light_visibility_buffer_size
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		); // using barrier to sync
 
-		// refer to the uniform object buffer
-		vk::DescriptorBufferInfo pointlight_buffer_info = {
-			pointlight_buffer.get(), // buffer_
-			0, //offset_
-			pointlight_buffer_size // range_
-		};
+		std::tie(frame.light_index_count_readback_buffer, frame.light_index_count_readback_memory) = utility->createBuffer(
+			sizeof(uint32_t)
+			, VK_BUFFER_USAGE_TRANSFER_DST_BIT
+			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		void* data = device.mapMemory(frame.light_index_count_readback_memory.get(), 0, sizeof(uint32_t), vk::MemoryMapFlags());
+		memset(data, 0, sizeof(uint32_t));
+		frame.mapped_light_index_count = static_cast<const uint32_t*>(data);
 
-		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+		// Write desciptor set in compute shader
+		{
+			// refer to the uniform object buffer
+			vk::DescriptorBufferInfo light_visibility_buffer_info{
+				frame.light_visibility_buffer.get(), // buffer_
+				0, //offset_
+				tile_light_ranges_size // range_
+			};
 
-		descriptor_writes.emplace_back(
-			light_culling_descriptor_set, // dstSet
-			0, // dstBinding
-			0, // distArrayElement
-			1, // descriptorCount
-			vk::DescriptorType::eStorageBuffer, //descriptorType
-			nullptr, //pImageInfo
-			&light_visibility_buffer_info, //pBufferInfo
-			nullptr //pTexBufferView
-		);
+			vk::DescriptorBufferInfo light_index_list_info{
+				frame.light_visibility_buffer.get(), // buffer_
+				light_index_list_offset, //offset_
+				light_visibility_buffer_size - light_index_list_offset // range_
+			};
 
-		descriptor_writes.emplace_back(
-			light_culling_descriptor_set, // dstSet
-			1, // dstBinding
-			0, // distArrayElement
-			1, // descriptorCount
-			vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
-			nullptr, //pImageInfo
-			&pointlight_buffer_info, //pBufferInfo
-			nullptr //pTexBufferView
-		);
+			// refer to the uniform object buffer
+			vk::DescriptorBufferInfo pointlight_buffer_info = {
+				frame.pointlight_buffer.get(), // buffer_
+				0, //offset_
+				pointlight_buffer_size // range_
+			};
 
-		std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
-		device.updateDescriptorSets(descriptor_writes, descriptor_copies);
-	}
+			vk::DescriptorBufferInfo tile_frustum_buffer_info = {
+				tile_frustum_buffer.get(), // buffer_
+				0, //offset_
+				tile_frustum_buffer_size // range_
+			};
+
+			std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+
+			descriptor_writes.emplace_back(
+				frame.light_culling_descriptor_set, // dstSet
+				0, // dstBinding
+				0, // distArrayElement
+				1, // descriptorCount
+				vk::DescriptorType::eStorageBuffer, //descriptorType
+				nullptr, //pImageInfo
+				&light_visibility_buffer_info, //pBufferInfo
+				nullptr //pTexBufferView
+			);
+
+			descriptor_writes.emplace_back(
+				frame.light_culling_descriptor_set, // dstSet
+				1, // dstBinding
+				0, // distArrayElement
+				1, // descriptorCount
+				vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
+				nullptr, //pImageInfo
+				&pointlight_buffer_info, //pBufferInfo
+				nullptr //pTexBufferView
+			);
+
+			descriptor_writes.emplace_back(
+				frame.light_culling_descriptor_set, // dstSet
+				2, // dstBinding
+				0, // distArrayElement
+				1, // descriptorCount
+				vk::DescriptorType::eStorageBuffer, //descriptorType
+				nullptr, //pImageInfo
+				&light_index_list_info, //pBufferInfo
+				nullptr //pTexBufferView
+			);
 
+			descriptor_writes.emplace_back(
+				frame.light_culling_descriptor_set, // dstSet
+				3, // dstBinding
+				0, // distArrayElement
+				1, // descriptorCount
+				vk::DescriptorType::eStorageBuffer, //descriptorType
+				nullptr, //pImageInfo
+				&tile_frustum_buffer_info, //pBufferInfo
+				nullptr //pTexBufferView
+			);
+
+			std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
+			device.updateDescriptorSets(descriptor_writes, descriptor_copies);
+		}
+	}
 }
 
-void VulkanApplication::createLightCullingCommandBuffer()
+void VulkanApplication::updateTileFrustumBuffer()
 {
-
-	if (light_culling_command_buffer)
+	auto proj = getProjectionMatrix();
+	auto tile_count = static_cast<uint32_t>(tile_count_per_row * tile_count_per_col);
+	if (tile_frustum_buffer.get() != VK_NULL_HANDLE && proj == tile_frustum_projection && tile_frustum_buffer_size == sizeof(TileFrustum) * tile_count)
 	{
-		device.freeCommandBuffers(compute_command_pool, 1, &light_culling_command_buffer);
-		light_culling_command_buffer = nullptr;
+		return; // a light index list reallocation keeps the projection and the tile grid
 	}
+	tile_frustum_projection = proj;
+	tile_frustum_buffer_size = sizeof(TileFrustum) * tile_count;
 
-	// Create light culling command buffer
+	// unproject points on the far plane, every side plane passes through the camera at the view space origin
+	auto inverse_proj = glm::inverse(proj);
+	auto unproject = [&inverse_proj](glm::vec2 ndc_pt)
 	{
-		vk::CommandBufferAllocateInfo alloc_info = {
-			compute_command_pool, // command pool
-			vk::CommandBufferLevel::ePrimary, // level
-			1 // commandBufferCount
-		};
+		auto temp = inverse_proj * glm::vec4(ndc_pt, 1.0f, 1.0f);
+		return glm::vec3(temp) / temp.w;
+	};
+
+	glm::vec2 ndc_size_per_tile = 2.0f * glm::vec2(TILE_SIZE, TILE_SIZE) / glm::vec2(swap_chain_extent.width, swap_chain_extent.height);
+
+	std::vector<TileFrustum> tile_frustums(tile_count);
+	for (int y = 0; y < tile_count_per_col; y++)
+	{
+		for (int x = 0; x < tile_count_per_row; x++)
+		{
+			// corners of tile in ndc: upper left, upper right, lower right, lower left
+			glm::vec2 ndc_upper_left = glm::vec2(-1.0f, -1.0f) + glm::vec2(x, y) * ndc_size_per_tile;
+			std::array<glm::vec3, 4> corners = {
+				unproject(ndc_upper_left),
+				unproject(ndc_upper_left + glm::vec2(ndc_size_per_tile.x, 0.0f)),
+				unproject(ndc_upper_left + ndc_size_per_tile),
+				unproject(ndc_upper_left + glm::vec2(0.0f, ndc_size_per_tile.y)),
+			};
+			auto center = unproject(ndc_upper_left + 0.5f * ndc_size_per_tile);
 
-		light_culling_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
+			auto& frustum = tile_frustums[y * tile_count_per_row + x];
+			for (int i = 0; i < 4; i++)
+			{
+				auto normal = glm::normalize(glm::cross(corners[i], corners[(i + 1) % 4]));
+				if (glm::dot(normal, center) < 0.0f)
+				{
+					normal = -normal; // make every normal point into the tile
+				}
+				frustum.planes[i] = glm::vec4(normal, 0.0f);
+			}
+		}
 	}
 
-	// Record command buffer
+	std::tie(tile_frustum_buffer, tile_frustum_buffer_memory) = utility->createBuffer(tile_frustum_buffer_size
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	VulkanRaii<VkBuffer> staging_buffer;
+	VulkanRaii<VkDeviceMemory> staging_buffer_memory;
+	std::tie(staging_buffer, staging_buffer_memory) = utility->createBuffer(tile_frustum_buffer_size
+		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	void* data = device.mapMemory(staging_buffer_memory.get(), 0, tile_frustum_buffer_size, vk::MemoryMapFlags());
+	memcpy(data, tile_frustums.data(), static_cast<size_t>(tile_frustum_buffer_size));
+	device.unmapMemory(staging_buffer_memory.get());
+
+	utility->copyBuffer(staging_buffer.get(), tile_frustum_buffer.get(), tile_frustum_buffer_size);
+}
+
+void VulkanApplication::createLightCullingCommandBuffer()
+{
+	for (uint32_t frame_index = 0; frame_index < frames.size(); frame_index++)
 	{
-		vk::CommandBufferBeginInfo begin_info =
+		auto& frame = frames[frame_index];
+		if (frame.light_culling_command_buffer)
 		{
-			vk::CommandBufferUsageFlagBits::eSimultaneousUse,
-			nullptr
-		};
+			device.freeCommandBuffers(compute_command_pool, 1, &frame.light_culling_command_buffer);
+			frame.light_culling_command_buffer = nullptr;
+		}
+
+		// Create light culling command buffer
+		{
+			vk::CommandBufferAllocateInfo alloc_info = {
+				compute_command_pool, // command pool
+				vk::CommandBufferLevel::ePrimary, // level
+				1 // commandBufferCount
+			};
+
+			frame.light_culling_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
+		}
 
-		vk::CommandBuffer command(light_culling_command_buffer);
+		// Record command buffer
+		{
+			vk::CommandBufferBeginInfo begin_info =
+			{
+				vk::CommandBufferUsageFlagBits::eSimultaneousUse,
+				nullptr
+			};
 
-		command.begin(begin_info);
+			vk::CommandBuffer command(frame.light_culling_command_buffer);
 
-		// using barrier since the sharing mode when allocating memory is exclusive
-		// begin after fragment shader finished reading from storage buffer
+			command.begin(begin_info);
+			gpu_profiler.recordBegin(command, frame_index, VGpuProfiler::LIGHT_CULLING);
 
-		std::vector<vk::BufferMemoryBarrier> barriers_before;
-		barriers_before.emplace_back
-		(
-			vk::AccessFlagBits::eShaderRead,  // srcAccessMask
-			vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(light_visibility_buffer.get()),  // buffer
-			0,  // offset
-			light_visibility_buffer_size  // size
-		);
-		barriers_before.emplace_back
-		(
-			vk::AccessFlagBits::eShaderRead,  // srcAccessMask // FIXME: change back to uniform
-			vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(pointlight_buffer.get()),  // buffer
-			0,  // offset
-			pointlight_buffer_size  // size
-		);
+			// reset the index list allocator in the header, and tell the shader how much room there is
+			std::array<uint32_t, 2> header = { 0, light_index_capacity };
+			command.updateBuffer(frame.light_visibility_buffer.get(), 0, sizeof(header), header.data());
 
-		command.pipelineBarrier(
-			vk::PipelineStageFlagBits::eFragmentShader,  // srcStageMask
-			vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
-			vk::DependencyFlags(),  // dependencyFlags
-			0,  // memoryBarrierCount
-			nullptr,  // pBUfferMemoryBarriers
-			static_cast<uint32_t>(barriers_before.size()),  // bufferMemoryBarrierCount
-			barriers_before.data(),  // pBUfferMemoryBarriers
-			0,  // imageMemoryBarrierCount
-			nullptr // pImageMemoryBarriers
-		);
+			vk::BufferMemoryBarrier header_barrier = {
+				vk::AccessFlagBits::eTransferWrite,  // srcAccessMask
+				vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
+				VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+				VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(frame.light_visibility_buffer.get()),  // buffer
+				0,  // offset
+				sizeof(header)  // size
+			};
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				1, &header_barrier,
+				0, nullptr
+			);
 
+			// using barrier since the sharing mode when allocating memory is exclusive
+			// begin after fragment shader finished reading from storage buffer
+
+			std::vector<vk::BufferMemoryBarrier> barriers_before;
+			barriers_before.emplace_back
+			(
+				vk::AccessFlagBits::eShaderRead,  // srcAccessMask
+				vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
+				0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
+				0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(frame.light_visibility_buffer.get()),  // buffer
+				0,  // offset
+				light_visibility_buffer_size  // size
+			);
+			barriers_before.emplace_back
+			(
+				vk::AccessFlagBits::eShaderRead,  // srcAccessMask // FIXME: change back to uniform
+				vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
+				0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
+				0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(frame.pointlight_buffer.get()),  // buffer
+				0,  // offset
+				pointlight_buffer_size  // size
+			);
 
-		// barrier
-		command.bindDescriptorSets(
-			vk::PipelineBindPoint::eCompute, // pipelineBindPoint
-			compute_pipeline_layout.get(), // layout
-			0, // firstSet
-			std::array<vk::DescriptorSet, 3>{light_culling_descriptor_set, camera_descriptor_set, intermediate_descriptor_set}, // descriptorSets
-			std::array<uint32_t, 0>() // pDynamicOffsets
-		);
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eFragmentShader,  // srcStageMask
+				vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+				vk::DependencyFlags(),  // dependencyFlags
+				0,  // memoryBarrierCount
+				nullptr,  // pBUfferMemoryBarriers
+				static_cast<uint32_t>(barriers_before.size()),  // bufferMemoryBarrierCount
+				barriers_before.data(),  // pBUfferMemoryBarriers
+				0,  // imageMemoryBarrierCount
+				nullptr // pImageMemoryBarriers
+			);
 
-		PushConstantObject pco = { static_cast<int>(swap_chain_extent.width), static_cast<int>(swap_chain_extent.height), tile_count_per_row, tile_count_per_col };
-		command.pushConstants(compute_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pco), &pco);
 
-		command.bindPipeline(vk::PipelineBindPoint::eCompute, static_cast<VkPipeline>(compute_pipeline.get()));
-		command.dispatch(tile_count_per_row, tile_count_per_col, 1);
+			// barrier
+			command.bindDescriptorSets(
+				vk::PipelineBindPoint::eCompute, // pipelineBindPoint
+				compute_pipeline_layout.get(), // layout
+				0, // firstSet
+				std::array<vk::DescriptorSet, 3>{frame.light_culling_descriptor_set, frame.camera_descriptor_set, intermediate_descriptor_set}, // descriptorSets
+				std::array<uint32_t, 0>() // pDynamicOffsets
+			);
 
+			PushConstantObject pco = { static_cast<int>(swap_chain_extent.width), static_cast<int>(swap_chain_extent.height), tile_count_per_row, tile_count_per_col };
+			command.pushConstants(compute_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pco), &pco);
 
-		std::vector<vk::BufferMemoryBarrier> barriers_after;
-		barriers_after.emplace_back
-		(
-			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
-			vk::AccessFlagBits::eShaderRead,  // dstAccessMask
-			0,//static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
-			0,//static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(light_visibility_buffer.get()),  // buffer
-			0,  // offset
-			light_visibility_buffer_size  // size
-		);
-		barriers_after.emplace_back
-		(
-			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask // TODO: change back to uniform
-			vk::AccessFlagBits::eShaderRead,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(pointlight_buffer.get()),  // buffer
-			0,  // offset
-			pointlight_buffer_size  // size
+			command.bindPipeline(vk::PipelineBindPoint::eCompute, static_cast<VkPipeline>(compute_pipeline.get()));
+			command.dispatch(tile_count_per_row, tile_count_per_col, cluster_count_per_tile);
+
+
+			std::vector<vk::BufferMemoryBarrier> barriers_after;
+			barriers_after.emplace_back
+			(
+				vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
+				vk::AccessFlagBits::eShaderRead,  // dstAccessMask
+				0,//static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
+				0,//static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(frame.light_visibility_buffer.get()),  // buffer
+				0,  // offset
+				light_visibility_buffer_size  // size
+			);
+			barriers_after.emplace_back
+			(
+				vk::AccessFlagBits::eShaderWrite,  // srcAccessMask // TODO: change back to uniform
+				vk::AccessFlagBits::eShaderRead,  // dstAccessMask
+				0, //static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
+				0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(frame.pointlight_buffer.get()),  // buffer
+				0,  // offset
+				pointlight_buffer_size  // size
+			);
+
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eFragmentShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				static_cast<uint32_t>(barriers_after.size()), barriers_after.data(), // TODO
+				0, nullptr
+			);
+
+			// copy the requested index count back so the cpu can grow the list after an overflow
+			vk::BufferMemoryBarrier count_barrier = {
+				vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
+				vk::AccessFlagBits::eTransferRead,  // dstAccessMask
+				VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+				VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(frame.light_visibility_buffer.get()),  // buffer
+				0,  // offset
+				sizeof(uint32_t)  // size
+			};
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::DependencyFlags(),
+				0, nullptr,
+				1, &count_barrier,
+				0, nullptr
+			);
+
+			utility->recordCopyBuffer(command, frame.light_visibility_buffer.get(), frame.light_index_count_readback_buffer.get(), sizeof(uint32_t));
+
+			vk::MemoryBarrier host_barrier = {
+				vk::AccessFlagBits::eTransferWrite,  // srcAccessMask
+				vk::AccessFlagBits::eHostRead  // dstAccessMask
+			};
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::PipelineStageFlagBits::eHost,
+				vk::DependencyFlags(),
+				1, &host_barrier,
+				0, nullptr,
+				0, nullptr
+			);
+
+			gpu_profiler.recordEnd(command, frame_index, VGpuProfiler::LIGHT_CULLING);
+			command.end();
+		}
+	}
+}
+
+void VulkanApplication::createMeshletCullingPipeline()
+{
+	if (!mScene->meshlet_culling)
+	{
+		return;
+	}
+
+	auto raii_pipeline_layout_deleter = [device = this->device](auto& obj)
+	{
+		device.destroyPipelineLayout(obj);
+	};
+	auto raii_pipeline_deleter = [device = this->device](auto& obj)
+	{
+		device.destroyPipeline(obj);
+	};
+
+	std::array<vk::DescriptorSetLayout, 2> set_layouts = { meshlet_culling_descriptor_set_layout.get(), camera_descriptor_set_layout.get() };
+	vk::PushConstantRange push_constant_range = { vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t) }; // the meshlet count
+
+	vk::PipelineLayoutCreateInfo layout_info = {
+		vk::PipelineLayoutCreateFlags(),  // flags
+		static_cast<uint32_t>(set_layouts.size()),  // setLayoutCount
+		set_layouts.data(),  // setlayouts
+		1,  // pushConstantRangeCount
+		&push_constant_range // pushConstantRanges
+	};
+	meshlet_culling_pipeline_layout = VulkanRaii<vk::PipelineLayout>(
+		device.createPipelineLayout(layout_info, nullptr),
+		raii_pipeline_layout_deleter
 		);
 
-		command.pipelineBarrier(
-			vk::PipelineStageFlagBits::eComputeShader,
-			vk::PipelineStageFlagBits::eFragmentShader,
-			vk::DependencyFlags(),
-			0, nullptr,
-			static_cast<uint32_t>(barriers_after.size()), barriers_after.data(), // TODO
-			0, nullptr
+	auto meshlet_culling_comp_shader_code = readShaderFile("Shaders/meshlet_culling_comp.spv", "Shaders/meshlet_culling.comp.glsl");
+	auto comp_shader_module = createShaderModule(meshlet_culling_comp_shader_code);
+
+	vk::PipelineShaderStageCreateInfo comp_shader_stage_info = {
+		vk::PipelineShaderStageCreateFlags(),  // flags
+		vk::ShaderStageFlagBits::eCompute,  // stage
+		comp_shader_module.get(),  // module
+		"main"  // pName
+	};
+
+	vk::ComputePipelineCreateInfo pipeline_info = {
+		vk::PipelineCreateFlags(),  // flags
+		comp_shader_stage_info,  // stage
+		meshlet_culling_pipeline_layout.get()  // layout
+	};
+	meshlet_culling_pipeline = VulkanRaii<vk::Pipeline>(
+		device.createComputePipeline(vk::PipelineCache(), pipeline_info, nullptr),
+		raii_pipeline_deleter
 		);
+}
 
-		command.end();
+void VulkanApplication::createMeshletCullingResources()
+{
+	meshlet_culling = mScene->meshlet_culling && model.getMeshletCount() > 0;
+	if (!meshlet_culling)
+	{
+		return;
+	}
+
+	for (auto& frame : frames)
+	{
+		std::tie(frame.culled_index_buffer, frame.culled_index_buffer_memory) = utility->createBuffer(model.getCulledIndexBufferSize()
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		std::tie(frame.meshlet_draw_command_buffer, frame.meshlet_draw_command_buffer_memory) = utility->createBuffer(model.getDrawCommandSection().size
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		vk::DescriptorSetAllocateInfo alloc_info = {
+			descriptor_pool.get(),  // descriptorPool
+			1,  // descriptorSetCount
+			meshlet_culling_descriptor_set_layout.data(), // pSetLayouts
+		};
+		frame.meshlet_culling_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+
+		std::array<vk::DescriptorBufferInfo, 5> buffer_infos = {
+			vk::DescriptorBufferInfo(object_uniform_buffer.get(), 0, sizeof(SceneObjectUbo)),
+			vk::DescriptorBufferInfo(model.getMeshletSection().buffer, model.getMeshletSection().offset, model.getMeshletSection().size),
+			vk::DescriptorBufferInfo(model.getBuffer(), 0, VK_WHOLE_SIZE),
+			vk::DescriptorBufferInfo(frame.culled_index_buffer.get(), 0, VK_WHOLE_SIZE),
+			vk::DescriptorBufferInfo(frame.meshlet_draw_command_buffer.get(), 0, VK_WHOLE_SIZE),
+		};
+
+		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+		for (uint32_t binding = 0; binding < buffer_infos.size(); binding++)
+		{
+			descriptor_writes.emplace_back(
+				frame.meshlet_culling_descriptor_set, // dstSet
+				binding, // dstBinding
+				0, // distArrayElement
+				1, // descriptorCount
+				binding == 0 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer, //descriptorType
+				nullptr, //pImageInfo
+				&buffer_infos[binding], //pBufferInfo
+				nullptr //pTexBufferView
+			);
+		}
+
+		std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
+		device.updateDescriptorSets(descriptor_writes, descriptor_copies);
 	}
 }
 
+void VulkanApplication::recordMeshletCulling(vk::CommandBuffer command, const FrameResources& frame)
+{
+	// every part starts out with no indices
+	const auto& draw_commands = model.getDrawCommandSection();
+	vk::Buffer draw_command_buffer = static_cast<vk::Buffer>(frame.meshlet_draw_command_buffer.get());
+	vk::BufferCopy copy_region = { draw_commands.offset, 0, draw_commands.size };
+	command.copyBuffer(draw_commands.buffer, draw_command_buffer, 1, &copy_region);
+
+	vk::BufferMemoryBarrier reset_barrier = {
+		vk::AccessFlagBits::eTransferWrite,  // srcAccessMask
+		vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
+		VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+		VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+		draw_command_buffer,  // buffer
+		0,  // offset
+		VK_WHOLE_SIZE  // size
+	};
+	command.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(),
+		0, nullptr,
+		1, &reset_barrier,
+		0, nullptr
+	);
+
+	command.bindPipeline(vk::PipelineBindPoint::eCompute, meshlet_culling_pipeline.get());
+	command.bindDescriptorSets(
+		vk::PipelineBindPoint::eCompute, // pipelineBindPoint
+		meshlet_culling_pipeline_layout.get(), // layout
+		0, // firstSet
+		std::array<vk::DescriptorSet, 2>{ frame.meshlet_culling_descriptor_set, frame.camera_descriptor_set }, // descriptorSets
+		std::array<uint32_t, 0>() // pDynamicOffsets
+	);
+
+	auto meshlet_count = static_cast<uint32_t>(model.getMeshletCount());
+	command.pushConstants(meshlet_culling_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(meshlet_count), &meshlet_count);
+
+	// one workgroup per meshlet, wrapped into rows when there are more than one dimension of a dispatch takes
+	uint32_t group_count_x = std::min(meshlet_count, physical_device_properties.limits.maxComputeWorkGroupCount[0]);
+	uint32_t group_count_y = (meshlet_count - 1) / group_count_x + 1;
+	command.dispatch(group_count_x, group_count_y, 1);
+
+	// the barrier also orders the forward pass, which is submitted later to the same queue
+	std::array<vk::BufferMemoryBarrier, 2> culled_barriers = {
+		vk::BufferMemoryBarrier(
+			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
+			vk::AccessFlagBits::eIndexRead,  // dstAccessMask
+			VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+			VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+			static_cast<vk::Buffer>(frame.culled_index_buffer.get()),  // buffer
+			0,  // offset
+			VK_WHOLE_SIZE  // size
+		),
+		vk::BufferMemoryBarrier(
+			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
+			vk::AccessFlagBits::eIndirectCommandRead,  // dstAccessMask
+			VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+			VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+			draw_command_buffer,  // buffer
+			0,  // offset
+			VK_WHOLE_SIZE  // size
+		)
+	};
+	command.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput,
+		vk::DependencyFlags(),
+		0, nullptr,
+		static_cast<uint32_t>(culled_barriers.size()), culled_barriers.data(),
+		0, nullptr
+	);
+}
+
 void VulkanApplication::updateUniformBuffers(float deltatime)
 {
 	static auto start_time = std::chrono::high_resolution_clock::now();
@@ -1959,27 +2798,34 @@ void VulkanApplication::updateUniformBuffers(float deltatime)
 	auto current_time = std::chrono::high_resolution_clock::now();
 	float time = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count() / 1000.0f;
 
+	auto& frame = frames[current_frame];
+
+	// the frame's fence has been waited on, so its ring region and upload command buffer are free to reuse
+	upload_ring.beginFrame(static_cast<uint32_t>(current_frame));
+
+	vk::CommandBuffer command = frame.upload_command_buffer;
+	command.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr }); // implicitly resets the buffer
+
+	// the upload is submitted ahead of all passes of this frame, so it resets the frame's queries
+	gpu_profiler.recordReset(command, static_cast<uint32_t>(current_frame));
+
 	// update camera ubo
 	{
 		CameraUbo ubo = {};
 		ubo.view = view_matrix;
-		ubo.proj = glm::perspective(glm::radians(45.0f), swap_chain_extent.width / (float)swap_chain_extent.height, 0.5f, 100.0f);
-		ubo.proj[1][1] *= -1; //since the Y axis of Vulkan NDC points down
+		ubo.proj = getProjectionMatrix();
 		ubo.projview = ubo.proj * ubo.view;
 		ubo.cam_pos = cam_pos;
 
-		void* data;
-		vkMapMemory(graphicsdevice, camera_staging_buffer_memory.get(), 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(graphicsdevice, camera_staging_buffer_memory.get());
+		auto allocation = upload_ring.allocate(sizeof(ubo));
+		memcpy(allocation.data, &ubo, sizeof(ubo));
 
-		utility->copyBuffer(camera_staging_buffer.get(), camera_uniform_buffer.get(), sizeof(ubo));
+		utility->recordCopyBuffer(command, allocation.buffer, frame.camera_uniform_buffer.get(), sizeof(ubo), allocation.offset);
 	}
 
 	// update light ubo
 	{
 		auto light_num = static_cast<int>(pointlights.size());
-		VkDeviceSize bufferSize = sizeof(PointLight) * MAX_POINT_LIGHT_COUNT + sizeof(glm::vec4);
 
 		for (int i = 0; i < light_num; i++) {
 			pointlights[i].pos += glm::vec3(0, 3.0f, 0) * deltatime;
@@ -1988,25 +2834,53 @@ void VulkanApplication::updateUniformBuffers(float deltatime)
 			}
 		}
 
+		// only the lights in use are uploaded, not the whole MAX_POINT_LIGHT_COUNT buffer
 		auto pointlights_size = sizeof(PointLight) * pointlights.size();
-		void* data;
-		vkMapMemory(graphicsdevice, lights_staging_buffer_memory.get(), 0, pointlight_buffer_size, 0, &data);
-		memcpy(data, &light_num, sizeof(int));
-		memcpy((char*)data + sizeof(glm::vec4), pointlights.data(), pointlights_size);
-		vkUnmapMemory(graphicsdevice, lights_staging_buffer_memory.get());
-		utility->copyBuffer(lights_staging_buffer.get(), pointlight_buffer.get(), pointlight_buffer_size);
+		auto upload_size = sizeof(glm::vec4) + pointlights_size;
+
+		auto allocation = upload_ring.allocate(upload_size);
+		memcpy(allocation.data, &light_num, sizeof(int));
+		memcpy((char*)allocation.data + sizeof(glm::vec4), pointlights.data(), pointlights_size);
+
+		utility->recordCopyBuffer(command, allocation.buffer, frame.pointlight_buffer.get(), upload_size, allocation.offset);
 	}
+
+	// make the copies visible to every shader stage reading them later in this frame
+	vk::MemoryBarrier barrier = {
+		vk::AccessFlagBits::eTransferWrite,  // srcAccessMask
+		vk::AccessFlagBits::eShaderRead  // dstAccessMask
+	};
+	command.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,  // srcStageMask
+		vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+		vk::DependencyFlags(),  // dependencyFlags
+		1, &barrier,  // memoryBarriers
+		0, nullptr,  // bufferMemoryBarriers
+		0, nullptr  // imageMemoryBarriers
+	);
+
+	command.end();
+}
+
+glm::mat4 VulkanApplication::getProjectionMatrix() const
+{
+	auto proj = glm::perspective(glm::radians(45.0f), swap_chain_extent.width / (float)swap_chain_extent.height, 0.5f, 100.0f);
+	proj[1][1] *= -1; //since the Y axis of Vulkan NDC points down
+	return proj;
 }
 
 const uint64_t ACQUIRE_NEXT_IMAGE_TIMEOUT{ std::numeric_limits<uint64_t>::max() };
 
 void VulkanApplication::drawFrame()
 {
+	auto& frame = frames[current_frame];
+
 	// 1. Acquiring an image from the swap chain
-	uint32_t image_index;
+	uint32_t image_index = static_cast<uint32_t>(current_frame); // headless: every frame slot owns an offscreen image
+	if (!mScene->headless)
 	{
 		auto aquiring_result = vkAcquireNextImageKHR(graphicsdevice, swap_chain.get()
-			, ACQUIRE_NEXT_IMAGE_TIMEOUT, image_available_semaphore.get(), VK_NULL_HANDLE, &image_index);
+			, ACQUIRE_NEXT_IMAGE_TIMEOUT, frame.image_available_semaphore.get(), VK_NULL_HANDLE, &image_index);
 
 		if (aquiring_result == VK_ERROR_OUT_OF_DATE_KHR)
 		{
@@ -2020,32 +2894,36 @@ void VulkanApplication::drawFrame()
 		}
 	}
 
-	// submit depth pre-pass command buffer
+	// only reset once we know work will be submitted, otherwise the next wait on this slot never returns
+	device.resetFences(1, frame.in_flight_fence.data());
+
+	// submit per-frame uploads and depth pre-pass command buffer
 	{
+		vk::CommandBuffer command_buffers[] = { frame.upload_command_buffer, frame.depth_prepass_command_buffer };
 		vk::SubmitInfo submit_info = {
 			0, // waitSemaphoreCount
 			nullptr, // pWaitSemaphores
 			nullptr, // pwaitDstStageMask
-			1, // commandBufferCount
-			&depth_prepass_command_buffer, // pCommandBuffers
+			2, // commandBufferCount
+			command_buffers, // pCommandBuffers
 			1, // singalSemaphoreCount
-			depth_prepass_finished_semaphore.data() // pSingalSemaphores
+			frame.depth_prepass_finished_semaphore.data() // pSingalSemaphores
 		};
 		graphics_queue.submit(1, &submit_info, nullptr);
 	}
 
 	// submit light culling command buffer
 	{
-		vk::Semaphore wait_semaphores[] = { depth_prepass_finished_semaphore.get() }; // which semaphore to wait
+		vk::Semaphore wait_semaphores[] = { frame.depth_prepass_finished_semaphore.get() }; // which semaphore to wait
 		vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eComputeShader }; // which stage to execute
 		vk::SubmitInfo submit_info = {
 			1, // waitSemaphoreCount
 			wait_semaphores, // pWaitSemaphores
 			wait_stages, // pwaitDstStageMask
 			1, // commandBufferCount
-			&light_culling_command_buffer, // pCommandBuffers
+			&frame.light_culling_command_buffer, // pCommandBuffers
 			1, // singalSemaphoreCount
-			lightculling_completed_semaphore.data() // pSingalSemaphores
+			frame.lightculling_completed_semaphore.data() // pSingalSemaphores
 		};
 		compute_queue.submit(1, &submit_info, nullptr);
 	}
@@ -2054,30 +2932,32 @@ void VulkanApplication::drawFrame()
 	{
 		VkSubmitInfo submit_info = {};
 		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		VkSemaphore wait_semaphores[] = { image_available_semaphore.get() , lightculling_completed_semaphore.get() }; // which semaphore to wait
-		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT }; // which stage to execute
-		submit_info.waitSemaphoreCount = 2;
+		VkSemaphore wait_semaphores[] = { frame.lightculling_completed_semaphore.get(), frame.image_available_semaphore.get() }; // which semaphore to wait
+		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }; // which stage to execute
+		submit_info.waitSemaphoreCount = mScene->headless ? 1 : 2; // nothing is acquired headless
 		submit_info.pWaitSemaphores = wait_semaphores;
 		submit_info.pWaitDstStageMask = wait_stages;
 		submit_info.commandBufferCount = 1;
-		submit_info.pCommandBuffers = &command_buffers[image_index];
-		VkSemaphore signal_semaphores[] = { render_finished_semaphore.get() };
-		submit_info.signalSemaphoreCount = 1;
+		submit_info.pCommandBuffers = &frame.command_buffers[image_index];
+		VkSemaphore signal_semaphores[] = { frame.render_finished_semaphore.get() };
+		submit_info.signalSemaphoreCount = mScene->headless ? 0 : 1; // nobody would wait on it headless
 		submit_info.pSignalSemaphores = signal_semaphores;
 
-		auto submit_result = vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+		// the fence covers the whole frame: this submission waits on the light culling, which waits on the depth pre-pass
+		auto submit_result = vkQueueSubmit(graphics_queue, 1, &submit_info, frame.in_flight_fence.get());
 		if (submit_result != VK_SUCCESS) {
 			throw std::runtime_error("Failed to submit draw command buffer!");
 		}
+		gpu_profiler.frameSubmitted(static_cast<uint32_t>(current_frame));
 	}
-	// TODO: use Fence and we can have cpu start working at a earlier time
 
 	// 3. Submitting the result back to the swap chain to show it on screen
+	if (!mScene->headless)
 	{
 		VkPresentInfoKHR present_info = {};
 		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 		present_info.waitSemaphoreCount = 1;
-		VkSemaphore present_wait_semaphores[] = { render_finished_semaphore.get() };
+		VkSemaphore present_wait_semaphores[] = { frame.render_finished_semaphore.get() };
 		present_info.pWaitSemaphores = present_wait_semaphores;
 		VkSwapchainKHR swapChains[] = { swap_chain.get() };
 		present_info.swapchainCount = 1;
@@ -2096,6 +2976,8 @@ void VulkanApplication::drawFrame()
 			throw std::runtime_error("Failed to present swap chain image!");
 		}
 	}
+
+	current_frame = (current_frame + 1) % frames.size();
 }
 
 VulkanRaii<VkShaderModule> VulkanApplication::createShaderModule(const std::vector<char>& code)
@@ -8,6 +8,7 @@
 #include <GLFW/glfw3.h>
 #include <chrono>
 #include <iostream>
+#include <memory>
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -19,6 +20,10 @@
 #include "VulkanRaii.h"
 #include "Utilities.h"
 #include "Model.h"
+#include "GpuProfiler.h"
+#include "Benchmark.h"
+#include "DeviceMemoryAllocator.h"
+#include "TextureCache.h"
 
 #ifdef NDEBUG
 const bool ENABLE_VALIDATION_LAYERS = false;
@@ -38,7 +43,7 @@ const uint32_t WINDOW_WIDTH = 1920;
 const uint32_t WINDOW_HEIGHT = 1080;
 
 const int MAX_POINT_LIGHT_COUNT = 10000; 
-const int MAX_POINT_LIGHT_PER_TILE = 1023;
+const int AVERAGE_POINT_LIGHT_PER_TILE = 128; // initial size of the packed light index list, grown on overflow
 const int TILE_SIZE = 16;
 
 struct PointLight
@@ -73,6 +78,20 @@ struct CameraUbo
 	glm::vec3 cam_pos;
 };
 
+// per-tile (or per-cluster) entry of the light visibility buffer, its lights are light_indices[offset, offset + count)
+struct TileLightRange
+{
+	uint32_t offset;
+	uint32_t count;
+};
+
+// view space side planes of a tile's frustum, they pass through the camera so only the normals are stored
+// depends on the projection and the tile grid only, so it is shared by all frames
+struct TileFrustum
+{
+	glm::vec4 planes[4];
+};
+
 struct PushConstantObject
 {
 	glm::ivec2 viewport_size;
@@ -86,10 +105,24 @@ struct PushConstantObject
 	{}
 };
 
+// per mesh part, for the vertex stage: scales the unorm positions of a PackedPosition back into the part's bounds.
+// it comes first in the push constant block, the fragment stage's PushConstantObject follows at its size
+struct VertexPushConstantObject
+{
+	glm::vec4 position_offset;
+	glm::vec4 position_scale;
+
+	explicit VertexPushConstantObject(const PositionBounds& bounds)
+		: position_offset(bounds.min, 0.0f),
+		position_scale(bounds.max - bounds.min, 0.0f)
+	{}
+};
+
 struct QueueFamilyIndices
 {
 	int graphics_family = -1;
 	int present_family = -1;
+	int transfer_family = -1; // a transfer only family (a dedicated dma engine), -1 if there is none
 
 	bool isComplete()
 	{
@@ -106,13 +139,16 @@ struct QueueFamilyIndices
 		std::vector<VkQueueFamilyProperties> queuefamilies(queuefamily_count);
 		vkGetPhysicalDeviceQueueFamilyProperties(device, &queuefamily_count, queuefamilies.data());
 
+		// without a surface (headless) nothing is presented, and light culling may share the graphics queue
+		bool headless = (surface == VK_NULL_HANDLE);
+
 		int i = 0;
 		for (const auto& queuefamily : queuefamilies)
 		{
 			if (queuefamily.queueCount > 0 && (queuefamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))
 			{
 				auto support_compute = static_cast<bool>(queuefamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
-				auto enough_size = (queuefamily.queueCount >= 2);
+				auto enough_size = (queuefamily.queueCount >= 2) || headless;
 
 				if (!support_compute)
 				{
@@ -129,11 +165,18 @@ struct QueueFamilyIndices
 				}
 			}
 
-			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-			if (queuefamily.queueCount > 0 && presentSupport)
+			if (headless)
 			{
-				indices.present_family = i;
+				indices.present_family = indices.graphics_family;
+			}
+			else
+			{
+				VkBool32 presentSupport = false;
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+				if (queuefamily.queueCount > 0 && presentSupport)
+				{
+					indices.present_family = i;
+				}
 			}
 			if (indices.isComplete()) {
 				break;
@@ -142,6 +185,17 @@ struct QueueFamilyIndices
 			i++;
 		}
 
+		// without graphics or compute the family is usually a dedicated dma engine, so uploads there do not take graphics queue time
+		for (uint32_t j = 0; j < queuefamily_count; j++)
+		{
+			auto flags = queuefamilies[j].queueFlags;
+			if (queuefamilies[j].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			{
+				indices.transfer_family = static_cast<int>(j);
+				break;
+			}
+		}
+
 		return indices;
 	}
 };
@@ -179,6 +233,49 @@ struct SwapChainSupportDetails
 	}
 };
 
+// Everything a single frame in flight writes to or waits on.
+// The cpu only touches a slot again after its fence is signaled, so frame N+1 can be recorded while the gpu renders frame N
+struct FrameResources
+{
+	VulkanRaii<vk::Semaphore> image_available_semaphore;
+	VulkanRaii<vk::Semaphore> render_finished_semaphore;
+	VulkanRaii<vk::Semaphore> lightculling_completed_semaphore;
+	VulkanRaii<vk::Semaphore> depth_prepass_finished_semaphore;
+	VulkanRaii<vk::Fence> in_flight_fence;
+
+	VulkanRaii<VkBuffer> camera_uniform_buffer;
+	VulkanRaii<VkDeviceMemory> camera_uniform_buffer_memory;
+
+	VulkanRaii<VkBuffer> pointlight_buffer;
+	VulkanRaii<VkDeviceMemory> pointlight_buffer_memory;
+
+	// visible lights for each tile or cluster, output from the light culling compute shader
+	// holds a header, one TileLightRange per tile or cluster and the packed light index list
+	VulkanRaii<VkBuffer> light_visibility_buffer;
+	VulkanRaii<VkDeviceMemory> light_visibility_buffer_memory;
+
+	// number of light indices the culling pass asked for, copied back to grow the index list on overflow
+	VulkanRaii<VkBuffer> light_index_count_readback_buffer;
+	VulkanRaii<VkDeviceMemory> light_index_count_readback_memory;
+	const uint32_t* mapped_light_index_count = nullptr;
+
+	// output of meshlet culling, read by the depth pre-pass and the forward pass
+	// holds every mesh part's surviving indices, and a MeshletDrawCommand per part
+	VulkanRaii<VkBuffer> culled_index_buffer;
+	VulkanRaii<VkDeviceMemory> culled_index_buffer_memory;
+	VulkanRaii<VkBuffer> meshlet_draw_command_buffer;
+	VulkanRaii<VkDeviceMemory> meshlet_draw_command_buffer_memory;
+
+	vk::DescriptorSet camera_descriptor_set;
+	VkDescriptorSet light_culling_descriptor_set;
+	vk::DescriptorSet meshlet_culling_descriptor_set;
+
+	vk::CommandBuffer upload_command_buffer; // re-recorded every frame, copies upload ring data into the buffers above
+	vk::CommandBuffer depth_prepass_command_buffer;
+	vk::CommandBuffer light_culling_command_buffer;
+	std::vector<VkCommandBuffer> command_buffers; // one per swap chain image
+};
+
 class VulkanApplication
 {
 public:
@@ -193,11 +290,27 @@ public:
 		return physical_device;
 	}
 
+	VDeviceMemoryAllocator* getMemoryAllocator() const
+	{
+		return memory_allocator.get();
+	}
+
+	VTextureCache* getTextureCache() const
+	{
+		return texture_cache.get();
+	}
+
 	const vk::PhysicalDeviceProperties& getPhysicalDeviceProperties() const
 	{
 		return physical_device_properties;
 	}
 
+	// features the logical device was created with
+	const VkPhysicalDeviceFeatures& getEnabledFeatures() const
+	{
+		return enabled_features;
+	}
+
 	vk::Device getDevice() const
 	{
 		return graphics_device.get();
@@ -218,6 +331,12 @@ public:
 		return compute_queue;
 	}
 
+	// the graphics queue when there is no dedicated transfer family
+	vk::Queue getTransferQueue() const
+	{
+		return transfer_queue;
+	}
+
 	vk::SurfaceKHR getWindowSurface() const
 	{
 		return window_surface.get();
@@ -232,6 +351,12 @@ public:
 	{
 		return compute_queue_command_pool.get();
 	}
+
+	// null when there is no dedicated transfer family
+	vk::CommandPool getTransferCommandPool() const
+	{
+		return transfer_queue_command_pool.get();
+	}
 	std::pair<int, int> getWindowFrameBufferSize() const
 	{
 		int framebuffer_width, framebuffer_height;
@@ -251,6 +376,7 @@ private:
 	////////////////////////////////////////////////////
 	void InitWindow();
 	void Loop();
+	void BenchmarkLoop();
 	void Cleanup();
 	void FrameBufferCallback(GLFWwindow* window, int width, int height);
 
@@ -289,29 +415,42 @@ private:
 
 	void initialize()
 	{
+		frames.resize(mScene->frames_in_flight);
+
 		createSwapChain();
 		createSwapChainImageViews();
 		createRenderPasses();
 		createDescriptorSetLayouts();
 		createGraphicsPipelines();
 		createComputePipeline();
+		createMeshletCullingPipeline();
 		createDepthResources();
 		createFrameBuffers();
 		createTextureSampler();
 		createUniformBuffers();
+		createBenchmark();
 		createLights();
+		createUploadRing();
+		createGpuProfiler();
 		createDescriptorPool();
-		model = VModel::loadModelFromFile(*this, mScene->model_file, texture_sampler.get(), descriptor_pool.get(), material_descriptor_set_layout.get());
+		if (mScene->import_benchmark_iterations > 0)
+		{
+			benchmarkModelImport(mScene->model_file, mScene->import_benchmark_iterations);
+			benchmarkVertexDedup(mScene->model_file, mScene->import_benchmark_iterations);
+		}
+		model = VModel::loadModelFromFile(*this, mScene->model_file, texture_sampler.get(), descriptor_pool.get(), material_descriptor_set_layout.get()
+			, mScene->mesh_optimization, mScene->model_stats);
 		createSceneObjectDescriptorSet();
 		createCameraDescriptorSet();
 		createIntermediateDescriptorSet();
 		updateIntermediateDescriptorSet();
 		createLigutCullingDescriptorSet();
 		createLightVisibilityBuffer(); // create a light visiblity buffer and update descriptor sets, need to rerun after changing size
+		createMeshletCullingResources();
 		createGraphicsCommandBuffers();
 		createLightCullingCommandBuffer();
 		createDepthPrePassCommandBuffer();
-		createSemaphores();
+		createSyncObjects();
 	}
 
 	void recreateSwapChain()
@@ -332,6 +471,7 @@ private:
 	}
 
 	void createSwapChain();
+	void createOffscreenImages();
 	void createSwapChainImageViews();
 	void createRenderPasses();
 	void createDescriptorSetLayouts();
@@ -341,25 +481,34 @@ private:
 	void createTextureSampler();
 	void createUniformBuffers();
 	void createLights();
+	void createUploadRing();
+	void createGpuProfiler();
+	void createBenchmark();
 	void createDescriptorPool();
 	void createSceneObjectDescriptorSet();
 	void createCameraDescriptorSet();
 	void createIntermediateDescriptorSet();
 	void updateIntermediateDescriptorSet();
 	void createGraphicsCommandBuffers();
-	void createSemaphores();
+	void createSyncObjects();
 
 	void createComputePipeline();
 	void createLigutCullingDescriptorSet();
 	void createLightVisibilityBuffer();
+	void updateTileFrustumBuffer();
 	void createLightCullingCommandBuffer();
 
+	void createMeshletCullingPipeline();
+	void createMeshletCullingResources(); // per frame output buffers and descriptor sets, needs the model
+	void recordMeshletCulling(vk::CommandBuffer command, const FrameResources& frame);
+
 	void createDepthPrePassCommandBuffer();
 
 	void updateUniformBuffers(float deltatime);
 	void drawFrame();
 
 	VulkanRaii<VkShaderModule> createShaderModule(const std::vector<char>& code);
+	glm::mat4 getProjectionMatrix() const;
 
 
 	void CheckInput(float deltatime);
@@ -387,6 +536,8 @@ private:
 	VUtility *utility;
 	VulkanRaii<vk::DebugReportCallbackEXT> callback;
 	VulkanRaii<vk::Device> graphics_device;
+	std::unique_ptr<VDeviceMemoryAllocator> memory_allocator; // declared after the device so it outlives every resource it backs
+	std::unique_ptr<VTextureCache> texture_cache; // only weak references, the models own their textures
 	VulkanRaii<vk::SurfaceKHR> window_surface;
 
 	QueueFamilyIndices queue_family_indices;
@@ -396,11 +547,15 @@ private:
 	vk::Queue graphics_queue;
 	vk::Queue present_queue;
 	vk::Queue compute_queue;
+	vk::Queue transfer_queue;
 	vk::CommandPool graphics_command_pool;
 	vk::CommandPool compute_command_pool;
 
 	VulkanRaii<vk::SwapchainKHR> swap_chain;
 	std::vector<VkImage> swap_chain_images;
+	// headless mode renders into these instead of swap chain images, one per frame in flight
+	std::vector<VulkanRaii<VkImage>> offscreen_images;
+	std::vector<VulkanRaii<VkDeviceMemory>> offscreen_image_memories;
 	VkFormat swap_chain_image_format;
 	VkExtent2D swap_chain_extent;
 	std::vector<VulkanRaii<vk::ImageView>> swap_chain_imageviews;
@@ -422,15 +577,13 @@ private:
 	VulkanRaii<vk::DescriptorSetLayout> intermediate_descriptor_set_layout; // which is exclusive to compute queue
 	VulkanRaii<VkPipelineLayout> compute_pipeline_layout;
 	VulkanRaii<VkPipeline> compute_pipeline;
-	vk::CommandBuffer light_culling_command_buffer = {};
 
-	std::vector<VkCommandBuffer> command_buffers; // buffers will be released when pool destroyed
-	vk::CommandBuffer depth_prepass_command_buffer;
+	VulkanRaii<vk::DescriptorSetLayout> meshlet_culling_descriptor_set_layout;
+	VulkanRaii<vk::PipelineLayout> meshlet_culling_pipeline_layout;
+	VulkanRaii<vk::Pipeline> meshlet_culling_pipeline;
 
-	VulkanRaii<vk::Semaphore> image_available_semaphore;
-	VulkanRaii<vk::Semaphore> render_finished_semaphore;
-	VulkanRaii<vk::Semaphore> lightculling_completed_semaphore;
-	VulkanRaii<vk::Semaphore> depth_prepass_finished_semaphore;
+	std::vector<FrameResources> frames; // command buffers will be released when pool destroyed
+	size_t current_frame = 0;
 
 	// for depth
 	VulkanRaii<VkImage> depth_image;
@@ -451,37 +604,36 @@ private:
 	VulkanRaii<VkDeviceMemory> object_staging_buffer_memory;
 	VulkanRaii<VkBuffer> object_uniform_buffer;
 	VulkanRaii<VkDeviceMemory> object_uniform_buffer_memory;
-	VulkanRaii<VkBuffer> camera_staging_buffer;
-	VulkanRaii<VkDeviceMemory> camera_staging_buffer_memory;
-	VulkanRaii<VkBuffer> camera_uniform_buffer;
-	VulkanRaii<VkDeviceMemory> camera_uniform_buffer_memory;
 
 	VulkanRaii<VkDescriptorPool> descriptor_pool;
 	VkDescriptorSet object_descriptor_set;
-	vk::DescriptorSet camera_descriptor_set;
-	VkDescriptorSet light_culling_descriptor_set;
 	vk::DescriptorSet intermediate_descriptor_set;
 
 	VModel model;
+	bool meshlet_culling = false; // asked for by the scene and the model has meshlets
 
-
-	VulkanRaii<VkBuffer> pointlight_buffer;
-	VulkanRaii<VkDeviceMemory> pointlight_buffer_memory;
-	VulkanRaii<VkBuffer> lights_staging_buffer;
-	VulkanRaii<VkDeviceMemory> lights_staging_buffer_memory;
 	VkDeviceSize pointlight_buffer_size;
 
+	VUploadRing upload_ring; // per-frame camera and light data
+	VGpuProfiler gpu_profiler; // per-pass gpu timings, disabled unless requested by the scene
+	VBenchmark benchmark;
+
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> vertex_indices;
 
 	std::vector<PointLight> pointlights;
 
-	// This storage buffer stores visible lights for each tile
-	// which is output from the light culling compute shader
-	// max MAX_POINT_LIGHT_PER_TILE point lights per tile
-	VulkanRaii<VkBuffer> light_visibility_buffer;
-	VulkanRaii<VkDeviceMemory> light_visibility_buffer_memory;
+	// size of each frame's light visibility buffer, the index list starts at light_index_list_offset
 	VkDeviceSize light_visibility_buffer_size = 0;
+	VkDeviceSize tile_light_ranges_size = 0;
+	VkDeviceSize light_index_list_offset = 0;
+	uint32_t light_index_capacity = 0;
+
+	// tile side planes for light culling, rebuilt when the projection or the tile grid changes
+	VulkanRaii<VkBuffer> tile_frustum_buffer;
+	VulkanRaii<VkDeviceMemory> tile_frustum_buffer_memory;
+	VkDeviceSize tile_frustum_buffer_size = 0;
+	glm::mat4 tile_frustum_projection = glm::mat4(0.0f);
 
 	int window_framebuffer_width;
 	int window_framebuffer_height;
@@ -490,11 +642,14 @@ private:
 	glm::vec3 cam_pos;
 	int tile_count_per_row;
 	int tile_count_per_col;
+	int cluster_count_per_tile = 1; // depth slices when clustered light culling is enabled
 	int debug_view_index = 0;
 
 	VulkanRaii<vk::CommandPool> graphics_queue_command_pool;
 	VulkanRaii<vk::CommandPool> compute_queue_command_pool;
+	VulkanRaii<vk::CommandPool> transfer_queue_command_pool;
 	vk::PhysicalDeviceProperties physical_device_properties;
+	VkPhysicalDeviceFeatures enabled_features = {};
 
 };
 